@@ -43,8 +43,12 @@ void* release_early_fn(void* arg __attribute__((unused)));
 extern void swap_out_all_allocations(void);
 /* From hook.c - reset memory location after receiving lock */
 extern void swap_in_all_allocations(void);
+/* From hook.c - prefetch memory before receiving lock */
+extern void prefetch_all_allocations(void);
 /* From hook.c - update memory limit dynamically */
 extern void update_memory_limit(size_t new_limit);
+/* From hook.c - report the working set of the quantum that just ended */
+extern void end_wss_quantum(void);
 
 pthread_t client_tid;
 pthread_t release_early_thread_tid;
@@ -67,6 +71,7 @@ uint64_t xpushare_client_id;
 char nvscheduler_socket_path[XPUSHARE_SOCK_PATH_MAX];
 char xpushare_gpu_uuid[XPUSHARE_GPU_UUID_LEN];
 time_t lock_acquire_time;    /* Timestamp of first lock acquire (warmup base) */
+int switch_slowdown_pending; /* Measure the first kernels after a LOCK_OK */
 int client_core_limit = 100; /* Client's compute quota (1-100%), default 100 */
 size_t client_memory_limit = 0; /* 0 means no memory quota control */
 
@@ -338,6 +343,65 @@ void report_memory_usage_to_scheduler(size_t allocated) {
   }
 }
 
+/*
+ * Report how much longer the first kernels took after getting the lock than
+ * they would have with our memory on the GPU, so the scheduler can learn the
+ * cost of a switch. resident is the memory that had to come back.
+ */
+void report_switch_slowdown_to_scheduler(long slowdown_ms, size_t resident) {
+  struct message stats_msg = {0};
+
+  if (rsock <= 0) return;
+
+  stats_msg.type = CLIENT_STATS;
+  stats_msg.id = xpushare_client_id;
+  stats_msg.memory_usage = resident;
+  snprintf(stats_msg.data, sizeof(stats_msg.data), "%ld", slowdown_ms);
+
+  if (xpushare_send_noblock(rsock, &stats_msg, sizeof(stats_msg)) < 0)
+    log_debug("Failed to send CLIENT_STATS to scheduler");
+  else
+    log_debug("Reported switch slowdown: %ld ms for %zu MB", slowdown_ms,
+              resident / (1024 * 1024));
+}
+
+/*
+ * Report how many kernels completed in busy_ms of them being in flight while
+ * holding the lock, so the scheduler can tell whether co-running with other
+ * clients still gets work done.
+ */
+void report_progress_to_scheduler(long kernels, long busy_ms) {
+  struct message progress_msg = {0};
+
+  if (rsock <= 0) return;
+
+  progress_msg.type = CLIENT_PROGRESS;
+  progress_msg.id = xpushare_client_id;
+  snprintf(progress_msg.data, sizeof(progress_msg.data), "%ld %ld", kernels,
+           busy_ms);
+
+  if (xpushare_send_noblock(rsock, &progress_msg, sizeof(progress_msg)) < 0)
+    log_debug("Failed to send CLIENT_PROGRESS to scheduler");
+  else
+    log_debug("Reported progress: %ld kernels in %ld ms", kernels, busy_ms);
+}
+
+/* Report the bytes of the allocations touched in the last quantum */
+void report_wss_to_scheduler(size_t wss) {
+  struct message wss_msg = {0};
+
+  if (rsock <= 0) return;
+
+  wss_msg.type = WSS_UPDATE;
+  wss_msg.id = xpushare_client_id;
+  wss_msg.memory_usage = wss;
+
+  if (xpushare_send_noblock(rsock, &wss_msg, sizeof(wss_msg)) < 0)
+    log_debug("Failed to send WSS_UPDATE to scheduler");
+  else
+    log_debug("Reported working set: %zu MB", wss / (1024 * 1024));
+}
+
 /*
  * Spawn all xpushare-related threads, bootstrap the client.
  *
@@ -395,6 +459,7 @@ void* client_fn(void* arg __attribute__((unused))) {
   struct message in_msg;
   struct message out_msg;
   CUresult cu_err = CUDA_SUCCESS;
+  int was_owner;
 
   memset(&out_msg, 0, sizeof(out_msg));
   out_msg.id = 1234;
@@ -499,6 +564,8 @@ void* client_fn(void* arg __attribute__((unused))) {
          */
         swap_in_all_allocations();
 
+        /* A repeated LOCK_OK is no new grant, nothing to measure */
+        was_owner = own_lock;
         need_lock = 0;
         own_lock = 1;
         maybe_release_lock_if_unneeded_locked(&out_msg);
@@ -510,7 +577,10 @@ void* client_fn(void* arg __attribute__((unused))) {
           lock_acquire_time = time(NULL);
           log_info("Warmup period started at first LOCK_OK");
         }
-        last_lock_ok_ms = monotonic_time_ms();
+        if (!was_owner) {
+          last_lock_ok_ms = monotonic_time_ms();
+          switch_slowdown_pending = 1;
+        }
         did_work = 1; /* Restart the early release timer to avoid race */
         true_or_exit(pthread_cond_broadcast(&own_lock_cv) == 0);
         true_or_exit(pthread_cond_broadcast(&release_early_cv) == 0);
@@ -535,6 +605,7 @@ void* client_fn(void* arg __attribute__((unused))) {
           true_or_exit(write_whole(rsock, &out_msg, sizeof(out_msg)) ==
                        sizeof(out_msg));
           log_debug("Sent %s", message_type_string[out_msg.type]);
+          end_wss_quantum();
 
           long released_ms = monotonic_time_ms();
           if (released_ms >= drop_recv_ms) {
@@ -587,10 +658,13 @@ void* client_fn(void* arg __attribute__((unused))) {
           true_or_exit(pthread_cond_broadcast(&own_lock_cv) == 0);
         }
         break;
-      case REQ_LOCK:   /* Should not receive this as client */
-      case REGISTER:   /* Should not receive this as client */
-      case SET_TQ:     /* Should not receive this as client */
-      case MEM_UPDATE: /* Should not receive this as client */
+      case REQ_LOCK:        /* Should not receive this as client */
+      case REGISTER:        /* Should not receive this as client */
+      case SET_TQ:          /* Should not receive this as client */
+      case MEM_UPDATE:      /* Should not receive this as client */
+      case CLIENT_STATS:    /* Should not receive this as client */
+      case CLIENT_PROGRESS: /* Should not receive this as client */
+      case WSS_UPDATE:      /* Should not receive this as client */
         log_warn("Received unexpected message type %s",
                  message_type_string[in_msg.type]);
         break;
@@ -601,6 +675,18 @@ void* client_fn(void* arg __attribute__((unused))) {
         swap_out_all_allocations();
         break;
 
+      case CANCEL_SWAP_OUT:
+        log_debug("Received %s", message_type_string[in_msg.type]);
+        /* We keep the lock after all, let our pages stay on the GPU */
+        if (own_lock == 1) swap_in_all_allocations();
+        break;
+
+      case PREPARE_SWAP_IN:
+        log_debug("Received %s", message_type_string[in_msg.type]);
+        /* The holder is about to drop the lock, and we are next */
+        prefetch_all_allocations();
+        break;
+
       case WAIT_FOR_MEM:
         log_debug("Received %s", message_type_string[in_msg.type]);
         /* Scheduler tells us to wait for memory, we stay in wait queue */
@@ -782,6 +868,7 @@ void* release_early_fn(void* arg __attribute__((unused))) {
                    sizeof(release_msg));
       own_lock = 0;
       log_debug("Sent %s", message_type_string[release_msg.type]);
+      end_wss_quantum();
     } else if (ret != 0) { /* BAD */
       errno = ret;
       log_fatal_errno("pthread_cond_timedwait() failed");
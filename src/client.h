@@ -23,8 +23,13 @@
 extern void continue_with_lock(void);
 extern void initialize_client(void);
 extern void report_memory_usage_to_scheduler(size_t allocated);
+extern void report_switch_slowdown_to_scheduler(long slowdown_ms,
+                                                size_t resident);
+extern void report_progress_to_scheduler(long kernels, long busy_ms);
+extern void report_wss_to_scheduler(size_t wss);
 extern int xpushare_quota_control_required(void);
 extern int xpushare_native_compute_quota_required(void);
 extern time_t lock_acquire_time;
+extern int switch_slowdown_pending;
 
 #endif /* _XPUSHARE_CLIENT_H */
@@ -54,6 +54,11 @@ const char* message_type_string[] = {
     [PREPARE_SWAP_OUT] = "PREPARE_SWAP_OUT",
     [UPDATE_LIMIT] = "UPDATE_LIMIT",
     [UPDATE_CORE_LIMIT] = "UPDATE_CORE_LIMIT",
+    [CLIENT_STATS] = "CLIENT_STATS",
+    [PREPARE_SWAP_IN] = "PREPARE_SWAP_IN",
+    [CLIENT_PROGRESS] = "CLIENT_PROGRESS",
+    [WSS_UPDATE] = "WSS_UPDATE",
+    [CANCEL_SWAP_OUT] = "CANCEL_SWAP_OUT",
 };
 
 /*
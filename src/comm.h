@@ -73,7 +73,13 @@ enum message_type {
       13, /* Scheduler -> Client: update memory limit from annotation */
   /* Dynamic compute limit adjustment */
   UPDATE_CORE_LIMIT =
-      14 /* Scheduler -> Client: update compute limit from annotation */
+      14, /* Scheduler -> Client: update compute limit from annotation */
+  /* Switch cost feedback */
+  CLIENT_STATS = 15, /* Client -> Scheduler: slowdown (ms) after a LOCK_OK */
+  PREPARE_SWAP_IN = 16, /* Scheduler -> Client: prefetch, LOCK_OK is next */
+  CLIENT_PROGRESS = 17, /* Client -> Scheduler: kernels done in how many ms */
+  WSS_UPDATE = 18,      /* Client -> Scheduler: bytes touched in a quantum */
+  CANCEL_SWAP_OUT = 19  /* Scheduler -> Client: keep the lock, undo the hint */
 } __attribute__((__packed__));
 
 #define XPUSHARE_GPU_UUID_LEN 96
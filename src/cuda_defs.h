@@ -83,6 +83,11 @@ typedef enum CUmem_advise_enum {
 /* Special device identifier for CPU */
 #define CU_DEVICE_CPU (-1)
 
+/* Keys of the extra argument of cuLaunchKernel */
+#define CU_LAUNCH_PARAM_END ((void*)0x00)
+#define CU_LAUNCH_PARAM_BUFFER_POINTER ((void*)0x01)
+#define CU_LAUNCH_PARAM_BUFFER_SIZE ((void*)0x02)
+
 /*
  * Flags to indicate CUDA symbol query status.
  * For more details see
@@ -161,6 +166,13 @@ typedef CUresult (*cuMemcpyDtoDAsync_func)(CUdeviceptr dstDevice,
                                            size_t ByteCount, CUstream hStream);
 typedef CUresult (*cuMemAdvise_func)(CUdeviceptr devPtr, size_t count,
                                      CUmem_advise advice, CUdevice device);
+typedef CUresult (*cuMemPrefetchAsync_func)(CUdeviceptr devPtr, size_t count,
+                                            CUdevice dstDevice,
+                                            CUstream hStream);
+typedef CUresult (*cuCtxGetDevice_func)(CUdevice* device);
+typedef CUresult (*cuFuncGetParamInfo_func)(CUfunction func, size_t paramIndex,
+                                            size_t* paramOffset,
+                                            size_t* paramSize);
 
 typedef nvmlReturn_t (*nvmlDeviceGetUtilizationRates_func)(
     nvmlDevice_t device, nvmlUtilization_t* utilization);
@@ -224,6 +236,9 @@ extern cuMemcpyHtoDAsync_func real_cuMemcpyHtoDAsync;
 extern cuMemcpyDtoD_func real_cuMemcpyDtoD;
 extern cuMemcpyDtoDAsync_func real_cuMemcpyDtoDAsync;
 extern cuMemAdvise_func real_cuMemAdvise;
+extern cuMemPrefetchAsync_func real_cuMemPrefetchAsync;
+extern cuCtxGetDevice_func real_cuCtxGetDevice;
+extern cuFuncGetParamInfo_func real_cuFuncGetParamInfo;
 
 extern void cuda_driver_check_error(CUresult err, const char* func_name);
 
@@ -49,6 +49,7 @@ extern void* dlvsym(void* handle, const char* symbol, const char* version);
 #endif
 
 #define ENV_XPUSHARE_ENABLE_SINGLE_OVERSUB "XPUSHARE_ENABLE_SINGLE_OVERSUB"
+#define ENV_XPUSHARE_WSS_ESTIMATE "XPUSHARE_WSS_ESTIMATE"
 #define ENV_XPUSHARE_NPU_ENABLE_HOOK "XPUSHARE_NPU_ENABLE_HOOK"
 #define ENV_XPUSHARE_NPU_ENABLE_CLIENT "XPUSHARE_NPU_ENABLE_CLIENT"
 #define ENV_XPUSHARE_NPU_STATIC_CORE_LIMIT "XPUSHARE_NPU_STATIC_CORE_LIMIT"
@@ -168,6 +169,9 @@ cuCtxSetCurrent_func real_cuCtxSetCurrent = NULL;
 cuCtxGetCurrent_func real_cuCtxGetCurrent = NULL;
 cuInit_func real_cuInit = NULL;
 cuMemAdvise_func real_cuMemAdvise = NULL;
+cuMemPrefetchAsync_func real_cuMemPrefetchAsync = NULL;
+cuCtxGetDevice_func real_cuCtxGetDevice = NULL;
+cuFuncGetParamInfo_func real_cuFuncGetParamInfo = NULL;
 
 nvmlDeviceGetUtilizationRates_func real_nvmlDeviceGetUtilizationRates = NULL;
 nvmlInit_func real_nvmlInit = NULL;
@@ -206,11 +210,19 @@ pthread_mutex_t limit_mutex =
     PTHREAD_MUTEX_INITIALIZER; /* Protect memory_limit */
 
 int kern_since_sync = 0;
+/* Per-kernel completion time away from switches (ms), < 0 until known */
+static double kern_ms_ewma = -1;
+/* Progress since progress_start_ms, see the progress reports */
+static long window_start_ms; /* First launch of the current window */
+static long progress_kernels, progress_busy_ms;
+static long progress_start_ms; /* 0 until the first window of a hold */
+#define PROGRESS_REPORT_MS 1000
 int pending_kernel_window = 64; /* Start optimistic */
 int consecutive_timeout_count = 0;
 pthread_mutex_t kcount_mutex;
 
 int enable_single_oversub = 0;
+static int wss_estimate = 0; /* XPUSHARE_WSS_ESTIMATE, see touch_kernel_args() */
 int nvml_ok = 1;
 int acl_ok = 0;
 static int cuda_bootstrapped = 0;
@@ -331,6 +343,7 @@ void update_memory_limit(size_t new_limit) {
 struct cuda_mem_allocation {
   CUdeviceptr ptr;
   size_t size;
+  unsigned long touched; /* Last WSS quantum it was touched in */
   struct cuda_mem_allocation* next;
 };
 
@@ -492,6 +505,31 @@ static void bootstrap_cuda(void) {
     log_debug("cuMemAdvise not available: %s", error);
     real_cuMemAdvise = NULL;
   }
+  real_cuMemPrefetchAsync = (cuMemPrefetchAsync_func)real_dlsym_225(
+      cuda_handle, CUDA_SYMBOL_STRING(cuMemPrefetchAsync));
+  error = dlerror();
+  if (error != NULL) {
+    log_debug("cuMemPrefetchAsync not available: %s", error);
+    real_cuMemPrefetchAsync = NULL;
+  }
+  real_cuCtxGetDevice = (cuCtxGetDevice_func)real_dlsym_225(
+      cuda_handle, CUDA_SYMBOL_STRING(cuCtxGetDevice));
+  error = dlerror();
+  if (error != NULL) {
+    log_debug("cuCtxGetDevice not available: %s", error);
+    real_cuCtxGetDevice = NULL;
+  }
+  /* CUDA 12.4+, without it there is no working set estimate */
+  if (wss_estimate) {
+    real_cuFuncGetParamInfo = (cuFuncGetParamInfo_func)real_dlsym_225(
+        cuda_handle, CUDA_SYMBOL_STRING(cuFuncGetParamInfo));
+    error = dlerror();
+    if (error != NULL) {
+      log_warn("cuFuncGetParamInfo not available, no working set estimate: %s",
+               error);
+      real_cuFuncGetParamInfo = NULL;
+    }
+  }
   real_cuLaunchKernel = (cuLaunchKernel_func)real_dlsym_225(
       cuda_handle, CUDA_SYMBOL_STRING(cuLaunchKernel));
   error = dlerror();
@@ -1145,6 +1183,149 @@ static int apply_npu_static_compute_quota(aclrtStream stream,
   return 1;
 }
 
+/*
+ * Working set estimate. An allocation counts as touched in a quantum when a
+ * kernel gets a pointer into it among its arguments, or a copy reads or
+ * writes it. A quantum is a lock hold, cut every WSS_QUANTUM_MAX_MS; at its
+ * end the bytes of the allocations touched go to the scheduler. Listing the
+ * arguments of a kernel takes cuFuncGetParamInfo (CUDA 12.4); without it
+ * nothing is reported, and the scheduler goes by the allocations.
+ *
+ * Off unless XPUSHARE_WSS_ESTIMATE is set, as the scheduler only uses it in
+ * AUTO mode. Only the first launch of each kernel window is looked at.
+ */
+#define WSS_QUANTUM_MAX_MS 10000
+#define WSS_FUNC_CACHE 64 /* Power of two */
+#define WSS_MAX_PARAMS 32
+#define WSS_ARG_SCAN_MAX 4096 /* Bytes of an argument looked for pointers */
+
+/* Parameter sizes of a kernel */
+struct wss_func {
+  CUfunction f;
+  int nparams;
+  size_t size[WSS_MAX_PARAMS];
+};
+
+/* Protects the allocation list as well */
+static pthread_mutex_t wss_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct wss_func wss_funcs[WSS_FUNC_CACHE];
+static unsigned long wss_quantum = 1;
+static size_t wss_bytes;
+static unsigned long wss_start_ms;
+/* The allocations sorted by address, kept only with cuFuncGetParamInfo */
+static struct cuda_mem_allocation** wss_allocs;
+static size_t wss_nallocs, wss_allocs_cap;
+
+/* Index of the first allocation ending past ptr. wss_mutex held. */
+static size_t wss_alloc_index(CUdeviceptr ptr) {
+  size_t lo = 0, hi = wss_nallocs;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (wss_allocs[mid]->ptr + wss_allocs[mid]->size <= ptr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Count the allocations overlapping [ptr, ptr + len). wss_mutex held. */
+static void touch_cuda_range(CUdeviceptr ptr, size_t len) {
+  for (size_t i = wss_alloc_index(ptr);
+       i < wss_nallocs && wss_allocs[i]->ptr < ptr + len; i++) {
+    struct cuda_mem_allocation* a = wss_allocs[i];
+
+    if (a->touched != wss_quantum) {
+      a->touched = wss_quantum;
+      wss_bytes += a->size;
+    }
+  }
+}
+
+/* Every aligned word of an argument that points into an allocation */
+static void touch_cuda_arg(const void* arg, size_t size) {
+  CUdeviceptr word;
+
+  if (size > WSS_ARG_SCAN_MAX) size = WSS_ARG_SCAN_MAX;
+  for (size_t off = 0; off + sizeof(word) <= size; off += sizeof(word)) {
+    memcpy(&word, (const char*)arg + off, sizeof(word));
+    touch_cuda_range(word, 1);
+  }
+}
+
+static struct wss_func* wss_func_lookup(CUfunction f) {
+  struct wss_func* wf =
+      &wss_funcs[((uintptr_t)f >> 4) & (WSS_FUNC_CACHE - 1)];
+  size_t offset, size;
+
+  if (wf->f == f) return wf;
+  wf->f = f;
+  wf->nparams = 0;
+  while (wf->nparams < WSS_MAX_PARAMS &&
+         real_cuFuncGetParamInfo(f, wf->nparams, &offset, &size) ==
+             CUDA_SUCCESS)
+    wf->size[wf->nparams++] = size;
+  return wf;
+}
+
+static void touch_kernel_args(CUfunction f, void** kernelParams,
+                              void** extra) {
+  void* buf = NULL;
+  size_t len = 0;
+
+  if (real_cuFuncGetParamInfo == NULL || wss_nallocs == 0) return;
+
+  true_or_exit(pthread_mutex_lock(&wss_mutex) == 0);
+  if (wss_start_ms == 0) wss_start_ms = monotonic_time_ms();
+  if (kernelParams != NULL) {
+    struct wss_func* wf = wss_func_lookup(f);
+
+    for (int i = 0; i < wf->nparams; i++)
+      touch_cuda_arg(kernelParams[i], wf->size[i]);
+  } else if (extra != NULL) {
+    /* Arguments packed into one buffer */
+    for (int i = 0; extra[i] != CU_LAUNCH_PARAM_END; i += 2) {
+      if (extra[i] == CU_LAUNCH_PARAM_BUFFER_POINTER)
+        buf = extra[i + 1];
+      else if (extra[i] == CU_LAUNCH_PARAM_BUFFER_SIZE)
+        len = *(size_t*)extra[i + 1];
+    }
+    if (buf != NULL) touch_cuda_arg(buf, len);
+  }
+  true_or_exit(pthread_mutex_unlock(&wss_mutex) == 0);
+}
+
+static void touch_cuda_copy(CUdeviceptr dst, CUdeviceptr src, size_t len) {
+  if (real_cuFuncGetParamInfo == NULL || wss_nallocs == 0) return;
+
+  true_or_exit(pthread_mutex_lock(&wss_mutex) == 0);
+  if (dst != 0) touch_cuda_range(dst, len);
+  if (src != 0) touch_cuda_range(src, len);
+  true_or_exit(pthread_mutex_unlock(&wss_mutex) == 0);
+}
+
+/*
+ * End the WSS quantum: report what it touched, if anything. Called when the
+ * lock is released, and by cuLaunchKernel when a hold runs long.
+ */
+void end_wss_quantum(void) {
+  size_t bytes;
+
+  if (real_cuFuncGetParamInfo == NULL) return;
+
+  true_or_exit(pthread_mutex_lock(&wss_mutex) == 0);
+  bytes = wss_bytes;
+  wss_bytes = 0;
+  wss_quantum++;
+  wss_start_ms = monotonic_time_ms();
+  true_or_exit(pthread_mutex_unlock(&wss_mutex) == 0);
+
+  /* Idle all along: says nothing about the working set */
+  if (bytes > 0) report_wss_to_scheduler(bytes);
+}
+
 /* Append a new CUDA memory allocation at the end of the list. */
 static void insert_cuda_allocation(CUdeviceptr dptr, size_t bytesize) {
   struct cuda_mem_allocation* allocation;
@@ -1156,8 +1337,24 @@ static void insert_cuda_allocation(CUdeviceptr dptr, size_t bytesize) {
 
   allocation->ptr = dptr;
   allocation->size = bytesize;
+  allocation->touched = 0;
   allocation->next = NULL;
+  true_or_exit(pthread_mutex_lock(&wss_mutex) == 0);
   LL_APPEND(cuda_allocation_list, allocation);
+  if (real_cuFuncGetParamInfo != NULL) {
+    size_t i = wss_alloc_index(dptr);
+
+    if (wss_nallocs == wss_allocs_cap) {
+      wss_allocs_cap = wss_allocs_cap ? wss_allocs_cap * 2 : 64;
+      true_or_exit(wss_allocs = realloc(wss_allocs, wss_allocs_cap *
+                                                        sizeof(*wss_allocs)));
+    }
+    memmove(&wss_allocs[i + 1], &wss_allocs[i],
+            (wss_nallocs - i) * sizeof(*wss_allocs));
+    wss_allocs[i] = allocation;
+    wss_nallocs++;
+  }
+  true_or_exit(pthread_mutex_unlock(&wss_mutex) == 0);
 
   /* Report memory usage to scheduler for memory-aware scheduling */
   report_memory_usage_to_scheduler(sum_allocated);
@@ -1172,7 +1369,18 @@ static void remove_cuda_allocation(CUdeviceptr rm_ptr) {
       sum_allocated -= a->size;
       log_debug("Total allocated memory on GPU is %.2f MiB",
                 toMiB(sum_allocated));
+      true_or_exit(pthread_mutex_lock(&wss_mutex) == 0);
       LL_DELETE(cuda_allocation_list, a);
+      if (real_cuFuncGetParamInfo != NULL) {
+        size_t i = wss_alloc_index(a->ptr);
+
+        if (i < wss_nallocs && wss_allocs[i] == a) {
+          memmove(&wss_allocs[i], &wss_allocs[i + 1],
+                  (wss_nallocs - i - 1) * sizeof(*wss_allocs));
+          wss_nallocs--;
+        }
+      }
+      true_or_exit(pthread_mutex_unlock(&wss_mutex) == 0);
       free(a);
 
       /* Report memory usage to scheduler for memory-aware scheduling */
@@ -1441,14 +1649,59 @@ void swap_out_all_allocations(void) {
     }
   }
 
-  /* Synchronize to ensure hints are processed */
+  /*
+   * No cuCtxSynchronize(): the advice applies as pages migrate, and the
+   * caller holds global_mutex, so waiting for the kernels in flight here
+   * would block the application and delay our reading DROP_LOCK.
+   */
   if (count > 0) {
-    real_cuCtxSynchronize();
     log_info("Swap-out hints sent for %d allocations (%.2f MB total)", count,
              (double)total_evicted / (1024 * 1024));
   }
 }
 
+/*
+ * Start bringing our allocations back to the GPU while the current holder
+ * drains. Called when receiving PREPARE_SWAP_IN from the scheduler, which
+ * is followed by LOCK_OK. Allocations are prefetched in allocation order, as
+ * many as fit in the memory the GPU has free right now; the rest fault in
+ * as usual.
+ */
+void prefetch_all_allocations(void) {
+  struct cuda_mem_allocation* a;
+  size_t free_mem = 0, total_mem = 0, prefetched = 0;
+  CUdevice device;
+  int count = 0;
+
+  if (xpushare_backend_mode != XPUSHARE_BACKEND_CUDA) return;
+  if (real_cuMemAdvise == NULL || real_cuMemPrefetchAsync == NULL ||
+      real_cuCtxGetDevice == NULL)
+    return;
+
+  if (cuda_ctx == NULL || real_cuCtxSetCurrent == NULL ||
+      real_cuCtxSetCurrent(cuda_ctx) != CUDA_SUCCESS ||
+      real_cuCtxGetDevice(&device) != CUDA_SUCCESS) {
+    log_debug("No CUDA context to prefetch into");
+    return;
+  }
+  if (real_cuMemGetInfo(&free_mem, &total_mem) != CUDA_SUCCESS) return;
+
+  LL_FOREACH(cuda_allocation_list, a) {
+    if (prefetched + a->size > free_mem) break;
+    real_cuMemAdvise(a->ptr, a->size, CU_MEM_ADVISE_UNSET_PREFERRED_LOCATION,
+                     CU_DEVICE_CPU);
+    if (real_cuMemPrefetchAsync(a->ptr, a->size, device, NULL) !=
+        CUDA_SUCCESS)
+      break;
+    prefetched += a->size;
+    count++;
+  }
+
+  if (count > 0)
+    log_info("Prefetching %d allocations (%.2f MB) ahead of LOCK_OK", count,
+             (double)prefetched / (1024 * 1024));
+}
+
 /*
  * Reset memory preferred location after receiving LOCK_OK.
  * This undoes the SET_PREFERRED_LOCATION CPU hint from swap-out,
@@ -1530,6 +1783,9 @@ static void initialize_libxpushare(void) {
         " application");
   }
 
+  value = getenv(ENV_XPUSHARE_WSS_ESTIMATE);
+  if (value != NULL && atoi(value) != 0) wss_estimate = 1;
+
   value = getenv(ENV_XPUSHARE_NPU_NATIVE_QUOTA);
   npu_native_quota_enabled = env_switch_default_on(value);
 
@@ -2172,6 +2428,13 @@ CUresult cuLaunchKernel(CUfunction f, unsigned int gridDimX,
    * trying to maintain a good throughput rate for smaller kernels.
    */
   kern_since_sync++;
+  if (kern_since_sync == 1) {
+    struct timespec now_ts;
+    true_or_exit(clock_gettime(CLOCK_MONOTONIC, &now_ts) == 0);
+    window_start_ms = now_ts.tv_sec * 1000 + now_ts.tv_nsec / 1000000;
+    /* A sample of the launches is enough for the working set */
+    touch_kernel_args(f, kernelParams, extra);
+  }
   if (kern_since_sync >= pending_kernel_window) {
     struct timespec cuda_cuda_sync_start_time = {0, 0};
     struct timespec cuda_sync_complete_time = {0, 0};
@@ -2184,6 +2447,52 @@ CUresult cuLaunchKernel(CUfunction f, unsigned int gridDimX,
     timespecsub(&cuda_sync_complete_time, &cuda_cuda_sync_start_time,
                 &cuda_sync_duration);
 
+    /*
+     * Switch cost feedback: the first window after a LOCK_OK pays for
+     * faulting our memory back in. Compare it with what as many kernels take
+     * otherwise, and tell the scheduler.
+     */
+    double sync_ms = cuda_sync_duration.tv_sec * 1e3 +
+                     cuda_sync_duration.tv_nsec / 1e6;
+    /*
+     * Progress feedback: kernels completed per ms a window was in flight,
+     * from its first launch to the end of its sync, so time the application
+     * spends away from the GPU does not count. Reported about once a second
+     * of holding the lock, starting after the first window of a hold, which
+     * pays for the switch. The scheduler compares what we get done next to
+     * other clients with what we get done alone, see check_thrash() there.
+     */
+    long sync_end_ms = cuda_sync_complete_time.tv_sec * 1000 +
+                       cuda_sync_complete_time.tv_nsec / 1000000;
+    if (switch_slowdown_pending) {
+      switch_slowdown_pending = 0;
+      if (kern_ms_ewma >= 0) {
+        long slowdown_ms = (long)(sync_ms - kern_ms_ewma * kern_since_sync);
+        report_switch_slowdown_to_scheduler(slowdown_ms > 0 ? slowdown_ms : 0,
+                                            sum_allocated);
+      }
+      progress_start_ms = sync_end_ms;
+      progress_kernels = progress_busy_ms = 0;
+    } else {
+      double per_kernel_ms = sync_ms / kern_since_sync;
+      kern_ms_ewma = kern_ms_ewma < 0 ? per_kernel_ms
+                                      : (kern_ms_ewma * 7 + per_kernel_ms) / 8;
+      if (progress_start_ms > 0) {
+        progress_kernels += kern_since_sync;
+        progress_busy_ms += sync_end_ms - window_start_ms;
+        if (sync_end_ms - progress_start_ms >= PROGRESS_REPORT_MS &&
+            progress_busy_ms > 0) {
+          report_progress_to_scheduler(progress_kernels, progress_busy_ms);
+          progress_start_ms = sync_end_ms;
+          progress_kernels = progress_busy_ms = 0;
+        }
+      }
+    }
+    /* A long hold still reports its working set now and then */
+    if (wss_start_ms > 0 &&
+        sync_end_ms - (long)wss_start_ms >= WSS_QUANTUM_MAX_MS)
+      end_wss_quantum();
+
     /*
      * Adaptive Flow Control Logic (AIMD + Warmup)
      *
@@ -2272,6 +2581,7 @@ CUresult cuMemcpy(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount) {
 
   result = real_cuMemcpy(dst, src, ByteCount);
   cuda_driver_check_error(result, CUDA_SYMBOL_STRING(cuMemcpy));
+  touch_cuda_copy(dst, src, ByteCount);
 
   return result;
 }
@@ -2290,6 +2600,7 @@ CUresult cuMemcpyAsync(CUdeviceptr dst, CUdeviceptr src, size_t ByteCount,
 
   result = real_cuMemcpyAsync(dst, src, ByteCount, hStream);
   cuda_driver_check_error(result, CUDA_SYMBOL_STRING(cuMemcpyAsync));
+  touch_cuda_copy(dst, src, ByteCount);
 
   return result;
 }
@@ -2307,6 +2618,7 @@ CUresult cuMemcpyDtoH(void* dstHost, CUdeviceptr srcDevice, size_t ByteCount) {
   continue_with_lock();
   result = real_cuMemcpyDtoH(dstHost, srcDevice, ByteCount);
   cuda_driver_check_error(result, CUDA_SYMBOL_STRING(cuMemcpyDtoH));
+  touch_cuda_copy(0, srcDevice, ByteCount);
 
   return result;
 }
@@ -2325,6 +2637,7 @@ CUresult cuMemcpyDtoHAsync(void* dstHost, CUdeviceptr srcDevice,
   continue_with_lock();
   result = real_cuMemcpyDtoHAsync(dstHost, srcDevice, ByteCount, hStream);
   cuda_driver_check_error(result, CUDA_SYMBOL_STRING(cuMemcpyDtoHAsync));
+  touch_cuda_copy(0, srcDevice, ByteCount);
 
   return result;
 }
@@ -2343,6 +2656,7 @@ CUresult cuMemcpyHtoD(CUdeviceptr dstDevice, const void* srcHost,
   continue_with_lock();
   result = real_cuMemcpyHtoD(dstDevice, srcHost, ByteCount);
   cuda_driver_check_error(result, CUDA_SYMBOL_STRING(cuMemcpyHtoD));
+  touch_cuda_copy(dstDevice, 0, ByteCount);
 
   return result;
 }
@@ -2361,6 +2675,7 @@ CUresult cuMemcpyHtoDAsync(CUdeviceptr dstDevice, const void* srcHost,
   continue_with_lock();
   result = real_cuMemcpyHtoDAsync(dstDevice, srcHost, ByteCount, hStream);
   cuda_driver_check_error(result, CUDA_SYMBOL_STRING(cuMemcpyHtoDAsync));
+  touch_cuda_copy(dstDevice, 0, ByteCount);
 
   return result;
 }
@@ -2379,6 +2694,7 @@ CUresult cuMemcpyDtoD(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
   continue_with_lock();
   result = real_cuMemcpyDtoD(dstDevice, srcDevice, ByteCount);
   cuda_driver_check_error(result, CUDA_SYMBOL_STRING(cuMemcpyDtoD));
+  touch_cuda_copy(dstDevice, srcDevice, ByteCount);
 
   return result;
 }
@@ -2397,6 +2713,7 @@ CUresult cuMemcpyDtoDAsync(CUdeviceptr dstDevice, CUdeviceptr srcDevice,
   continue_with_lock();
   result = real_cuMemcpyDtoDAsync(dstDevice, srcDevice, ByteCount, hStream);
   cuda_driver_check_error(result, CUDA_SYMBOL_STRING(cuMemcpyDtoDAsync));
+  touch_cuda_copy(dstDevice, srcDevice, ByteCount);
 
   return result;
 }
@@ -0,0 +1,60 @@
+/*
+ * Host memory headroom for xpushare-scheduler.
+ */
+
+#include "host_mem.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+/* A single number from a cgroup file, or -1; "max" reads as no number */
+static int read_cgroup_value(const char* dir, const char* name,
+                             unsigned long long* value) {
+  char path[PATH_MAX];
+  FILE* f;
+  int ret;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  f = fopen(path, "r");
+  if (f == NULL) return -1;
+  ret = fscanf(f, "%llu", value) == 1 ? 0 : -1;
+  fclose(f);
+  return ret;
+}
+
+int host_mem_read(const char* meminfo_path, const char* cgroup_dir,
+                  struct host_mem* hm) {
+  unsigned long long total_kb = 0, avail_kb = 0, kb;
+  unsigned long long max, current, headroom;
+  int found = 0;
+  char line[256];
+  FILE* f;
+
+  f = fopen(meminfo_path, "r");
+  if (f == NULL) return -1;
+  while (fgets(line, sizeof(line), f) != NULL && found != 3) {
+    if (sscanf(line, "MemTotal: %llu kB", &kb) == 1) {
+      total_kb = kb;
+      found |= 1;
+    } else if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1) {
+      avail_kb = kb;
+      found |= 2;
+    }
+  }
+  fclose(f);
+  if (found != 3) return -1;
+
+  hm->total = (size_t)total_kb * 1024;
+  hm->available = (size_t)avail_kb * 1024;
+
+  if (cgroup_dir == NULL ||
+      read_cgroup_value(cgroup_dir, "memory.max", &max) < 0 ||
+      read_cgroup_value(cgroup_dir, "memory.current", &current) < 0)
+    return 0;
+
+  if (max < hm->total) hm->total = (size_t)max;
+  headroom = current < max ? max - current : 0;
+  if (headroom < hm->available) hm->available = (size_t)headroom;
+  return 0;
+}
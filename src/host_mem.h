@@ -0,0 +1,29 @@
+/*
+ * Host memory headroom for xpushare-scheduler.
+ *
+ * Whatever does not fit on a GPU lives in system RAM through Unified
+ * Memory. Where the scheduler runs, that is bounded by the node
+ * (/proc/meminfo) and, when given, by a cgroup v2 memory controller, say
+ * the one the pods are in. Both paths are parameters, so the readers can be
+ * pointed at fixtures.
+ */
+
+#ifndef _XPUSHARE_HOST_MEM_H_
+#define _XPUSHARE_HOST_MEM_H_
+
+#include <stddef.h>
+
+struct host_mem {
+  size_t total;     /* MemTotal, or memory.max if lower */
+  size_t available; /* MemAvailable, or memory.max - memory.current if lower */
+};
+
+/*
+ * Read the headroom. cgroup_dir may be NULL; a cgroup without a limit
+ * (memory.max is "max") or that can't be read is left out. Returns -1 if
+ * meminfo_path can't be read or has no MemTotal/MemAvailable.
+ */
+int host_mem_read(const char* meminfo_path, const char* cgroup_dir,
+                  struct host_mem* hm);
+
+#endif /* _XPUSHARE_HOST_MEM_H_ */
@@ -10,6 +10,7 @@
 #include "k8s_api.h"
 
 #include <curl/curl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,25 +43,27 @@ static size_t k8s_curl_write_cb(void* contents, size_t size, size_t nmemb,
   return realsize;
 }
 
-/* Read service account token */
-static char* read_sa_token(void) {
-  static char token[8192];
-  static int loaded = 0;
-
-  if (loaded) return token;
+/* Read service account token, once; lookups run on several threads */
+static char sa_token[8192];
+static int sa_token_loaded = 0;
+static pthread_once_t sa_token_once = PTHREAD_ONCE_INIT;
 
+static void load_sa_token(void) {
   FILE* f = fopen("/var/run/secrets/kubernetes.io/serviceaccount/token", "r");
   if (!f) {
     log_warn("k8s_api: Cannot read service account token");
-    return NULL;
+    return;
   }
 
-  size_t n = fread(token, 1, sizeof(token) - 1, f);
+  size_t n = fread(sa_token, 1, sizeof(sa_token) - 1, f);
   fclose(f);
-  token[n] = '\0';
-  loaded = 1;
+  sa_token[n] = '\0';
+  sa_token_loaded = 1;
+}
 
-  return token;
+static char* read_sa_token(void) {
+  pthread_once(&sa_token_once, load_sa_token);
+  return sa_token_loaded ? sa_token : NULL;
 }
 
 /* Parse memory size string (e.g., "4Gi", "512Mi") */
@@ -144,35 +147,40 @@ char* extract_json_string(const char* json, const char* key) {
 }
 
 /*
- * Get Pod annotation value from K8s API.
- * Returns the annotation value or NULL if not found.
- * Caller MUST free the returned string.
+ * Fetch an object from the K8s API, path being e.g. /api/v1/namespaces/<ns>.
+ * Returns the JSON response or NULL on failure. Caller MUST free it.
+ *
+ * XPUSHARE_K8S_API_URL overrides the in-cluster API server, e.g. to point the
+ * scheduler at a local stand-in. The service account token is optional then.
  */
-char* k8s_get_pod_annotation(const char* ns, const char* pod_name,
-                             const char* annotation_key) {
+static char* k8s_get_json(const char* path) {
   CURL* curl;
   CURLcode res;
   struct curl_buffer response = {0};
+  char* api_url = getenv("XPUSHARE_K8S_API_URL");
 
   char* token = read_sa_token();
-  if (!token) return NULL;
+  if (!token && !api_url) return NULL;
 
   curl = curl_easy_init();
   if (!curl) return NULL;
 
   /* Build API URL */
   char url[512];
-  char* api_server = getenv("KUBERNETES_SERVICE_HOST");
-  char* api_port = getenv("KUBERNETES_SERVICE_PORT");
+  if (api_url) {
+    snprintf(url, sizeof(url), "%s%s", api_url, path);
+  } else {
+    char* api_server = getenv("KUBERNETES_SERVICE_HOST");
+    char* api_port = getenv("KUBERNETES_SERVICE_PORT");
+
+    if (!api_server || !api_port) {
+      api_server = "kubernetes.default.svc";
+      api_port = "443";
+    }
 
-  if (!api_server || !api_port) {
-    api_server = "kubernetes.default.svc";
-    api_port = "443";
+    snprintf(url, sizeof(url), "https://%s:%s%s", api_server, api_port, path);
   }
 
-  snprintf(url, sizeof(url), "https://%s:%s/api/v1/namespaces/%s/pods/%s",
-           api_server, api_port, ns, pod_name);
-
   /* Set curl options */
   curl_easy_setopt(curl, CURLOPT_URL, url);
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, k8s_curl_write_cb);
@@ -182,13 +190,18 @@ char* k8s_get_pod_annotation(const char* ns, const char* pod_name,
   curl_easy_setopt(curl, CURLOPT_CAINFO,
                    "/var/run/secrets/kubernetes.io/serviceaccount/ca.crt");
   curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
+  /* We run on worker threads; signals would hit whichever thread */
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
 
   /* Set auth header */
   struct curl_slist* headers = NULL;
-  char auth_header[8300];
-  snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", token);
-  headers = curl_slist_append(headers, auth_header);
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  if (token) {
+    char auth_header[8300];
+    snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s",
+             token);
+    headers = curl_slist_append(headers, auth_header);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  }
 
   /* Perform request */
   res = curl_easy_perform(curl);
@@ -202,30 +215,72 @@ char* k8s_get_pod_annotation(const char* ns, const char* pod_name,
     return NULL;
   }
 
-  /* Parse response for annotation */
-  if (response.data) {
-    /* Look for the annotation in the response */
-    if (getenv("XPUSHARE_DEBUG")) {
-      log_debug("k8s_api: Response JSON: %s", response.data);
-    }
+  if (response.data && getenv("XPUSHARE_DEBUG")) {
+    log_debug("k8s_api: Response JSON: %s", response.data);
+  }
+
+  return response.data;
+}
+
+/*
+ * Get several annotations of the object at path with a single API request.
+ * values[i] is set to the value of keys[i], or NULL if not found.
+ * Returns -1 if the object could not be fetched, 0 otherwise.
+ * Caller MUST free the returned values.
+ */
+static int k8s_get_annotations(const char* path, const char* const keys[],
+                               char* values[], int n) {
+  char* json;
+
+  for (int i = 0; i < n; i++) values[i] = NULL;
 
+  json = k8s_get_json(path);
+  if (!json) return -1;
+
+  for (int i = 0; i < n; i++) {
     /* extract_json_string returns malloc'd string now */
-    char* anno_value = extract_json_string(response.data, annotation_key);
+    values[i] = extract_json_string(json, keys[i]);
 
     if (getenv("XPUSHARE_DEBUG")) {
-      if (anno_value) {
-        log_debug("k8s_api: Found annotation '%s': '%s'", annotation_key,
-                  anno_value);
+      if (values[i]) {
+        log_debug("k8s_api: Found annotation '%s': '%s'", keys[i], values[i]);
       } else {
-        log_debug("k8s_api: Annotation '%s' not found", annotation_key);
+        log_debug("k8s_api: Annotation '%s' not found", keys[i]);
       }
     }
-
-    free(response.data);
-    return anno_value;
   }
 
-  return NULL;
+  free(json);
+  return 0;
+}
+
+int k8s_get_pod_annotations(const char* ns, const char* pod_name,
+                            const char* const keys[], char* values[], int n) {
+  char path[512];
+
+  snprintf(path, sizeof(path), "/api/v1/namespaces/%s/pods/%s", ns, pod_name);
+  return k8s_get_annotations(path, keys, values, n);
+}
+
+int k8s_get_namespace_annotations(const char* ns, const char* const keys[],
+                                  char* values[], int n) {
+  char path[512];
+
+  snprintf(path, sizeof(path), "/api/v1/namespaces/%s", ns);
+  return k8s_get_annotations(path, keys, values, n);
+}
+
+/*
+ * Get Pod annotation value from K8s API.
+ * Returns the annotation value or NULL if not found.
+ * Caller MUST free the returned string.
+ */
+char* k8s_get_pod_annotation(const char* ns, const char* pod_name,
+                             const char* annotation_key) {
+  char* value;
+
+  k8s_get_pod_annotations(ns, pod_name, &annotation_key, &value, 1);
+  return value;
 }
 
 /* Initialize K8s API (call curl_global_init) */
@@ -15,11 +15,22 @@ void k8s_api_cleanup(void);
 
 /*
  * Get Pod annotation value.
- * Returns static buffer with value, or NULL if not found.
+ * Returns malloc'd value, or NULL if not found.
  */
 char* k8s_get_pod_annotation(const char* ns, const char* pod_name,
                              const char* annotation_key);
 
+/*
+ * Get n Pod annotations with one API request. Returns -1 if the Pod could not
+ * be fetched; otherwise values[i] is the malloc'd value of keys[i], or NULL.
+ */
+int k8s_get_pod_annotations(const char* ns, const char* pod_name,
+                            const char* const keys[], char* values[], int n);
+
+/* The same for the annotations of a Namespace */
+int k8s_get_namespace_annotations(const char* ns, const char* const keys[],
+                                  char* values[], int n);
+
 /* Parse memory size string (e.g., "4Gi") to bytes */
 size_t parse_memory_size(const char* str);
 
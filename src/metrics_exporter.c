@@ -4,8 +4,8 @@
  * Provides a minimal HTTP server that serves Prometheus text format
  * metrics on /metrics and a health check on /healthz.
  *
- * Thread-safety: snapshots scheduler state under global_mutex,
- * then formats the response outside the lock.
+ * Thread-safety: snapshots scheduler state one GPU shard at a time under
+ * the scheduler's own locks, then formats the response outside of them.
  */
 
 #include "metrics_exporter.h"
@@ -28,9 +28,6 @@
 
 /* ---- External scheduler state (defined in scheduler.c) ---- */
 
-/* We need to access these from scheduler.c */
-extern pthread_mutex_t global_mutex;
-
 /* Forward declarations of types from scheduler.c.
  * We include them here via extern pointers; the actual struct definitions
  * live in scheduler.c. To avoid exposing internal structs, we use a
@@ -44,6 +41,18 @@ unsigned long g_metrics_drop_lock_count = 0;
 unsigned long g_metrics_client_disconnect_count = 0;
 unsigned long g_metrics_wait_for_mem_count = 0;
 unsigned long g_metrics_mem_available_count = 0;
+unsigned long g_metrics_lease_overdue_count = 0;
+
+/* Spans quick handoffs up to clients stuck in a long synchronize */
+const long g_metrics_drop_release_bounds_ms[XPUSHARE_DROP_RELEASE_BUCKETS] = {
+    10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000};
+unsigned long g_metrics_drop_release_buckets[XPUSHARE_DROP_RELEASE_BUCKETS +
+                                             1] = {0};
+unsigned long g_metrics_drop_release_sum_ms = 0;
+
+/* From an idle GPU to a full default TQ and beyond */
+const long g_metrics_lock_wait_bounds_ms[XPUSHARE_LOCK_WAIT_BUCKETS] = {
+    1, 5, 10, 25, 50, 100, 200, 500, 1000, 2500, 5000, 10000, 30000, 60000};
 
 /* ---- Metrics config ---- */
 
@@ -97,8 +106,8 @@ void metrics_exporter_init_config(void) {
 }
 
 /*
- * This function is implemented in scheduler.c to fill the snapshot
- * while holding global_mutex. It avoids exposing internal data structures.
+ * This function is implemented in scheduler.c to fill the snapshot. It takes
+ * the scheduler locks itself and avoids exposing internal data structures.
  */
 extern void metrics_fill_scheduler_snapshot(struct scheduler_snapshot* snap);
 
@@ -120,15 +129,31 @@ static void buf_init(struct metrics_buf* b, size_t cap) {
 static void buf_append(struct metrics_buf* b, const char* fmt, ...)
     __attribute__((format(printf, 2, 3)));
 static void buf_append(struct metrics_buf* b, const char* fmt, ...) {
-  if (!b->data || b->len >= b->cap - 1) return;
+  if (!b->data) return;
   va_list ap;
   va_start(ap, fmt);
   int n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
   va_end(ap);
-  if (n > 0) {
-    b->len += (size_t)n;
-    if (b->len >= b->cap) b->len = b->cap - 1;
+  if (n < 0) return;
+  if ((size_t)n >= b->cap - b->len) {
+    /* Did not fit: grow to at least twice the size and format again */
+    size_t cap = b->cap * 2;
+    char* data;
+
+    while (cap - b->len <= (size_t)n) cap *= 2;
+    data = realloc(b->data, cap);
+    if (data == NULL) {
+      log_warn("Out of memory for metrics output, truncating it");
+      b->data[b->len] = '\0';
+      return;
+    }
+    b->data = data;
+    b->cap = cap;
+    va_start(ap, fmt);
+    vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
   }
+  b->len += (size_t)n;
 }
 
 static void buf_free(struct metrics_buf* b) {
@@ -320,6 +345,33 @@ static void format_client_metrics(struct metrics_buf* b,
                c->peak_allocated);
   }
 
+  buf_append(b,
+             "# HELP xpushare_client_predicted_peak_bytes Peak allocation of "
+             "the workload, counted by admission until the client gets there\n"
+             "# TYPE xpushare_client_predicted_peak_bytes gauge\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    buf_append(b,
+               "xpushare_client_predicted_peak_bytes{namespace=\"%s\","
+               "pod=\"%s\",client_id=\"%016lx\",gpu_uuid=\"%s\"} %zu\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->predicted_peak);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_client_wss_bytes Smoothed working set: bytes of "
+             "the allocations touched per quantum\n"
+             "# TYPE xpushare_client_wss_bytes gauge\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    if (c->wss == 0) continue;
+    buf_append(b,
+               "xpushare_client_wss_bytes{namespace=\"%s\",pod=\"%s\","
+               "client_id=\"%016lx\",gpu_uuid=\"%s\"} %zu\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->wss);
+  }
+
   /* NVML used bytes (per-process, matched by host_pid) */
   buf_append(
       b,
@@ -401,6 +453,34 @@ static void format_compute_metrics(struct metrics_buf* b,
                c->core_limit);
   }
 
+  buf_append(
+      b,
+      "# HELP xpushare_client_core_request_percent Guaranteed compute share "
+      "(1-100)\n"
+      "# TYPE xpushare_client_core_request_percent gauge\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    buf_append(b,
+               "xpushare_client_core_request_percent{namespace=\"%s\",pod="
+               "\"%s\",client_id=\"%016lx\",gpu_uuid=\"%s\"} %d\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->core_request);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_client_namespace_share_percent Part of the GPU "
+             "its namespace gets, divided among its quota-limited clients\n"
+             "# TYPE xpushare_client_namespace_share_percent gauge\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    if (c->namespace_share == 0) continue;
+    buf_append(b,
+               "xpushare_client_namespace_share_percent{namespace=\"%s\",pod="
+               "\"%s\",client_id=\"%016lx\",gpu_uuid=\"%s\"} %d\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->namespace_share);
+  }
+
   buf_append(
       b,
       "# HELP xpushare_client_core_quota_effective_percent Effective compute "
@@ -475,6 +555,32 @@ static void format_compute_metrics(struct metrics_buf* b,
                c->is_throttled);
   }
 
+  buf_append(b,
+             "# HELP xpushare_client_core_borrowed_ms_total Compute time run "
+             "past the guarantee on lent capacity (ms)\n"
+             "# TYPE xpushare_client_core_borrowed_ms_total counter\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    buf_append(b,
+               "xpushare_client_core_borrowed_ms_total{namespace=\"%s\",pod="
+               "\"%s\",client_id=\"%016lx\",gpu_uuid=\"%s\"} %ld\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->core_borrowed_ms);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_client_core_lent_ms_total Compute time of the "
+             "unused guarantee run by borrowers (ms)\n"
+             "# TYPE xpushare_client_core_lent_ms_total counter\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    buf_append(b,
+               "xpushare_client_core_lent_ms_total{namespace=\"%s\",pod="
+               "\"%s\",client_id=\"%016lx\",gpu_uuid=\"%s\"} %ld\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->core_lent_ms);
+  }
+
   buf_append(
       b,
       "# HELP xpushare_client_pending_drop Whether DROP sent awaiting release "
@@ -489,6 +595,148 @@ static void format_compute_metrics(struct metrics_buf* b,
                c->pending_drop);
   }
 
+  buf_append(b,
+             "# HELP xpushare_client_priority_class Priority class (0 "
+             "best-effort, 1 standard, 2 latency-critical)\n"
+             "# TYPE xpushare_client_priority_class gauge\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    buf_append(b,
+               "xpushare_client_priority_class{namespace=\"%s\",pod=\"%s\","
+               "client_id=\"%016lx\",gpu_uuid=\"%s\"} %d\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->priority);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_client_mlfq_level MLFQ level (0 most "
+             "interactive)\n"
+             "# TYPE xpushare_client_mlfq_level gauge\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    buf_append(b,
+               "xpushare_client_mlfq_level{namespace=\"%s\",pod=\"%s\","
+               "client_id=\"%016lx\",gpu_uuid=\"%s\"} %d\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->mlfq_level);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_client_predicted_burst_ms Predicted next lock "
+             "hold (ms), EWMA of past ones\n"
+             "# TYPE xpushare_client_predicted_burst_ms gauge\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    buf_append(b,
+               "xpushare_client_predicted_burst_ms{namespace=\"%s\","
+               "pod=\"%s\",client_id=\"%016lx\",gpu_uuid=\"%s\"} %ld\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->burst_est_ms);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_client_max_wait_ms Lock wait SLO (ms), 0 if "
+             "none\n"
+             "# TYPE xpushare_client_max_wait_ms gauge\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    buf_append(b,
+               "xpushare_client_max_wait_ms{namespace=\"%s\",pod=\"%s\","
+               "client_id=\"%016lx\",gpu_uuid=\"%s\"} %ld\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->max_wait_ms);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_client_deadline_misses_total Lock grants later "
+             "than the lock wait SLO\n"
+             "# TYPE xpushare_client_deadline_misses_total counter\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    buf_append(b,
+               "xpushare_client_deadline_misses_total{namespace=\"%s\","
+               "pod=\"%s\",client_id=\"%016lx\",gpu_uuid=\"%s\"} %lu\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->deadline_miss_count);
+  }
+
+  /*
+   * Quantiles are the upper bound of the bucket they fall in, which is as
+   * precise as the histogram gets.
+   */
+  buf_append(b,
+             "# HELP xpushare_client_lock_wait_ms REQ_LOCK to LOCK_OK wait "
+             "(ms)\n"
+             "# TYPE xpushare_client_lock_wait_ms summary\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    static const double quantiles[] = {0.5, 0.9, 0.99};
+    struct client_snapshot* c = &snap->clients[i];
+    unsigned long count = 0;
+
+    for (int j = 0; j <= XPUSHARE_LOCK_WAIT_BUCKETS; j++)
+      count += c->lock_wait_buckets[j];
+    if (count == 0) continue;
+
+    for (int q = 0; q < 3; q++) {
+      unsigned long rank = (unsigned long)(quantiles[q] * count + 0.5);
+      unsigned long seen = 0;
+      int j = 0;
+
+      if (rank == 0) rank = 1;
+      while (j < XPUSHARE_LOCK_WAIT_BUCKETS &&
+             (seen += c->lock_wait_buckets[j]) < rank)
+        j++;
+      if (j < XPUSHARE_LOCK_WAIT_BUCKETS)
+        buf_append(b,
+                   "xpushare_client_lock_wait_ms{namespace=\"%s\",pod=\"%s\","
+                   "client_id=\"%016lx\",gpu_uuid=\"%s\",quantile=\"%g\"} "
+                   "%ld\n",
+                   c->pod_namespace, c->pod_name, (unsigned long)c->id,
+                   c->gpu_uuid, quantiles[q], g_metrics_lock_wait_bounds_ms[j]);
+      else
+        buf_append(b,
+                   "xpushare_client_lock_wait_ms{namespace=\"%s\",pod=\"%s\","
+                   "client_id=\"%016lx\",gpu_uuid=\"%s\",quantile=\"%g\"} "
+                   "+Inf\n",
+                   c->pod_namespace, c->pod_name, (unsigned long)c->id,
+                   c->gpu_uuid, quantiles[q]);
+    }
+    buf_append(b,
+               "xpushare_client_lock_wait_ms_sum{namespace=\"%s\",pod=\"%s\","
+               "client_id=\"%016lx\",gpu_uuid=\"%s\"} %lu\n"
+               "xpushare_client_lock_wait_ms_count{namespace=\"%s\",pod=\"%s\","
+               "client_id=\"%016lx\",gpu_uuid=\"%s\"} %lu\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->lock_wait_sum_ms, c->pod_namespace, c->pod_name,
+               (unsigned long)c->id, c->gpu_uuid, count);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_client_lease_overdue Whether the client holds the "
+             "lock past its DROP_LOCK lease (0/1)\n"
+             "# TYPE xpushare_client_lease_overdue gauge\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    buf_append(b,
+               "xpushare_client_lease_overdue{namespace=\"%s\",pod=\"%s\","
+               "client_id=\"%016lx\",gpu_uuid=\"%s\"} %d\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->lease_overdue);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_client_lease_overdue_total Times the client "
+             "overran its DROP_LOCK lease\n"
+             "# TYPE xpushare_client_lease_overdue_total counter\n");
+  for (int i = 0; i < snap->client_count; i++) {
+    struct client_snapshot* c = &snap->clients[i];
+    buf_append(b,
+               "xpushare_client_lease_overdue_total{namespace=\"%s\",pod=\"%s\","
+               "client_id=\"%016lx\",gpu_uuid=\"%s\"} %lu\n",
+               c->pod_namespace, c->pod_name, (unsigned long)c->id, c->gpu_uuid,
+               c->lease_overdue_count);
+  }
+
   buf_append(b,
              "# HELP xpushare_client_quota_debt_ms Carryover debt (ms)\n"
              "# TYPE xpushare_client_quota_debt_ms gauge\n");
@@ -563,15 +811,42 @@ static void format_scheduler_metrics(struct metrics_buf* b,
                ctx->uuid, ctx->gpu_index, ctx->peak_memory);
   }
 
+  buf_append(b,
+             "# HELP xpushare_scheduler_unmanaged_memory_bytes Device memory "
+             "of all clients outside managed allocations (NVML)\n"
+             "# TYPE xpushare_scheduler_unmanaged_memory_bytes gauge\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_unmanaged_memory_bytes{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\"} %zu\n",
+               ctx->uuid, ctx->gpu_index, ctx->unmanaged_memory);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_process_overhead_bytes Learned device "
+             "memory per client outside managed allocations\n"
+             "# TYPE xpushare_scheduler_process_overhead_bytes gauge\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_process_overhead_bytes{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\"} %zu\n",
+               ctx->uuid, ctx->gpu_index, ctx->process_overhead);
+  }
+
   buf_append(
       b,
       "# HELP xpushare_scheduler_memory_safe_limit_bytes Safe memory limit "
-      "(total*(1-reserve))\n"
+      "(total*(1-reserve) - unmanaged)\n"
       "# TYPE xpushare_scheduler_memory_safe_limit_bytes gauge\n");
   for (int i = 0; i < snap->context_count; i++) {
     struct context_snapshot* ctx = &snap->contexts[i];
     size_t safe_limit =
         ctx->total_memory * (100 - ctx->memory_reserve_percent) / 100;
+    safe_limit = ctx->unmanaged_memory < safe_limit
+                     ? safe_limit - ctx->unmanaged_memory
+                     : 0;
     buf_append(b,
                "xpushare_scheduler_memory_safe_limit_bytes{gpu_uuid=\"%s\",gpu_"
                "index=\"%d\"} %zu\n",
@@ -589,6 +864,185 @@ static void format_scheduler_metrics(struct metrics_buf* b,
                "\"%d\"} %d\n",
                ctx->uuid, ctx->gpu_index, ctx->memory_overloaded);
   }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_memory_overload_transitions_total "
+             "Memory overload fallback entered/left\n"
+             "# TYPE xpushare_scheduler_memory_overload_transitions_total "
+             "counter\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_memory_overload_transitions_total{gpu_uuid="
+               "\"%s\",gpu_index=\"%d\",direction=\"enter\"} %lu\n"
+               "xpushare_scheduler_memory_overload_transitions_total{gpu_uuid="
+               "\"%s\",gpu_index=\"%d\",direction=\"exit\"} %lu\n",
+               ctx->uuid, ctx->gpu_index, ctx->overload_enter_count, ctx->uuid,
+               ctx->gpu_index, ctx->overload_exit_count);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_memory_overload_preemptions_total "
+             "Clients preempted to relieve memory overload\n"
+             "# TYPE xpushare_scheduler_memory_overload_preemptions_total "
+             "counter\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_memory_overload_preemptions_total{gpu_uuid="
+               "\"%s\",gpu_index=\"%d\"} %lu\n",
+               ctx->uuid, ctx->gpu_index, ctx->overload_victim_count);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_thrashing Serial after co-running "
+             "thrashed (0/1)\n"
+             "# TYPE xpushare_scheduler_thrashing gauge\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_thrashing{gpu_uuid=\"%s\",gpu_index=\"%d\"} "
+               "%d\n",
+               ctx->uuid, ctx->gpu_index, ctx->thrashing);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_thrash_transitions_total "
+             "Thrash fallback entered/left for a co-run probe\n"
+             "# TYPE xpushare_scheduler_thrash_transitions_total counter\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_thrash_transitions_total{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\",direction=\"enter\"} %lu\n"
+               "xpushare_scheduler_thrash_transitions_total{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\",direction=\"exit\"} %lu\n",
+               ctx->uuid, ctx->gpu_index, ctx->thrash_enter_count, ctx->uuid,
+               ctx->gpu_index, ctx->thrash_exit_count);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_corun_progress_ratio Progress of the "
+             "co-running clients at the last check, in solo runs\n"
+             "# TYPE xpushare_scheduler_corun_progress_ratio gauge\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    if (ctx->corun_progress < 0) continue;
+    buf_append(b,
+               "xpushare_scheduler_corun_progress_ratio{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\"} %.3f\n",
+               ctx->uuid, ctx->gpu_index, ctx->corun_progress);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_backfill_total "
+             "Clients started ahead of a memory reservation\n"
+             "# TYPE xpushare_scheduler_backfill_total counter\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_backfill_total{gpu_uuid=\"%s\",gpu_index="
+               "\"%d\"} %lu\n",
+               ctx->uuid, ctx->gpu_index, ctx->backfill_count);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_host_mem_deferrals_total "
+             "Clients held back to keep host memory above the watermark\n"
+             "# TYPE xpushare_scheduler_host_mem_deferrals_total counter\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_host_mem_deferrals_total{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\"} %lu\n",
+               ctx->uuid, ctx->gpu_index, ctx->host_mem_defer_count);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_priority_preemptions_total "
+             "Holders preempted for a higher priority class\n"
+             "# TYPE xpushare_scheduler_priority_preemptions_total counter\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_priority_preemptions_total{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\"} %lu\n",
+               ctx->uuid, ctx->gpu_index, ctx->priority_preempt_count);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_deadline_preemptions_total "
+             "Holders preempted so that a waiter meets its lock wait SLO\n"
+             "# TYPE xpushare_scheduler_deadline_preemptions_total counter\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_deadline_preemptions_total{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\"} %lu\n",
+               ctx->uuid, ctx->gpu_index, ctx->deadline_preempt_count);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_switch_bandwidth_bytes Fitted swap-in "
+             "bandwidth of a lock switch (bytes/s), 0 until known\n"
+             "# TYPE xpushare_scheduler_switch_bandwidth_bytes gauge\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_switch_bandwidth_bytes{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\"} %.0f\n",
+               ctx->uuid, ctx->gpu_index, ctx->switch_bandwidth);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_switch_overhead_ratio Predicted share "
+             "of GPU time lost to lock switches at the current TQ\n"
+             "# TYPE xpushare_scheduler_switch_overhead_ratio gauge\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    if (ctx->switch_overhead < 0) continue;
+    buf_append(b,
+               "xpushare_scheduler_switch_overhead_ratio{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\"} %.4f\n",
+               ctx->uuid, ctx->gpu_index, ctx->switch_overhead);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_switch_cost_ms_total Measured lock "
+             "switch costs, drain plus reported slowdown (ms)\n"
+             "# TYPE xpushare_scheduler_switch_cost_ms_total counter\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_switch_cost_ms_total{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\"} %lu\n",
+               ctx->uuid, ctx->gpu_index, ctx->switch_cost_total_ms);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_paced_admissions_total Grants held "
+             "back while the client admitted last warmed up\n"
+             "# TYPE xpushare_scheduler_paced_admissions_total counter\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_paced_admissions_total{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\"} %lu\n",
+               ctx->uuid, ctx->gpu_index, ctx->paced_count);
+  }
+
+  buf_append(b,
+             "# HELP xpushare_scheduler_pipelined_switches_total Switches "
+             "prepared with PREPARE_SWAP_OUT/PREPARE_SWAP_IN ahead of the "
+             "TQ end\n"
+             "# TYPE xpushare_scheduler_pipelined_switches_total counter\n");
+  for (int i = 0; i < snap->context_count; i++) {
+    struct context_snapshot* ctx = &snap->contexts[i];
+    buf_append(b,
+               "xpushare_scheduler_pipelined_switches_total{gpu_uuid=\"%s\","
+               "gpu_index=\"%d\"} %lu\n",
+               ctx->uuid, ctx->gpu_index, ctx->prepared_count);
+  }
 }
 
 static void format_event_metrics(struct metrics_buf* b,
@@ -610,8 +1064,13 @@ static void format_event_metrics(struct metrics_buf* b,
                              "MEM_AVAILABLE",
                              "PREPARE_SWAP_OUT",
                              "UPDATE_LIMIT",
-                             "UPDATE_CORE_LIMIT"};
-  for (int i = 1; i < XPUSHARE_MSG_TYPE_COUNT && i < 15; i++) {
+                             "UPDATE_CORE_LIMIT",
+                             "CLIENT_STATS",
+                             "PREPARE_SWAP_IN",
+                             "CLIENT_PROGRESS",
+                             "WSS_UPDATE",
+                             "CANCEL_SWAP_OUT"};
+  for (int i = 1; i < XPUSHARE_MSG_TYPE_COUNT && i < 20; i++) {
     if (msg_names[i]) {
       buf_append(b, "xpushare_scheduler_messages_total{type=\"%s\"} %lu\n",
                  msg_names[i], snap->msg_counts[i]);
@@ -645,6 +1104,47 @@ static void format_event_metrics(struct metrics_buf* b,
       "# TYPE xpushare_scheduler_mem_available_total counter\n"
       "xpushare_scheduler_mem_available_total %lu\n",
       snap->mem_available_count);
+
+  buf_append(
+      b,
+      "# HELP xpushare_scheduler_lease_overdue_total DROP_LOCK leases that "
+      "ran out\n"
+      "# TYPE xpushare_scheduler_lease_overdue_total counter\n"
+      "xpushare_scheduler_lease_overdue_total %lu\n",
+      snap->lease_overdue_count);
+
+  if (snap->host_mem_known) {
+    buf_append(b,
+               "# HELP xpushare_scheduler_host_memory_total_bytes Host memory "
+               "backing Unified Memory (node or cgroup limit)\n"
+               "# TYPE xpushare_scheduler_host_memory_total_bytes gauge\n"
+               "xpushare_scheduler_host_memory_total_bytes %zu\n"
+               "# HELP xpushare_scheduler_host_memory_available_bytes Host "
+               "memory headroom\n"
+               "# TYPE xpushare_scheduler_host_memory_available_bytes gauge\n"
+               "xpushare_scheduler_host_memory_available_bytes %zu\n",
+               snap->host_mem_total, snap->host_mem_available);
+  }
+
+  unsigned long cumulative = 0;
+  buf_append(b,
+             "# HELP xpushare_scheduler_drop_release_latency_ms DROP_LOCK to "
+             "LOCK_RELEASED latency (ms)\n"
+             "# TYPE xpushare_scheduler_drop_release_latency_ms histogram\n");
+  for (int i = 0; i < XPUSHARE_DROP_RELEASE_BUCKETS; i++) {
+    cumulative += snap->drop_release_buckets[i];
+    buf_append(b,
+               "xpushare_scheduler_drop_release_latency_ms_bucket{le=\"%ld\"} "
+               "%lu\n",
+               g_metrics_drop_release_bounds_ms[i], cumulative);
+  }
+  cumulative += snap->drop_release_buckets[XPUSHARE_DROP_RELEASE_BUCKETS];
+  buf_append(b,
+             "xpushare_scheduler_drop_release_latency_ms_bucket{le=\"+Inf\"} "
+             "%lu\n"
+             "xpushare_scheduler_drop_release_latency_ms_sum %lu\n"
+             "xpushare_scheduler_drop_release_latency_ms_count %lu\n",
+             cumulative, snap->drop_release_sum_ms, cumulative);
 }
 
 /* ---- HTTP handling ---- */
@@ -653,13 +1153,11 @@ static void handle_metrics(int client_fd) {
   struct metrics_buf b;
   buf_init(&b, XPUSHARE_METRICS_BUFFER_SIZE);
 
-  /* Take scheduler snapshot under lock */
+  /* Take scheduler snapshot (locks each GPU shard in turn) */
   struct scheduler_snapshot snap;
   memset(&snap, 0, sizeof(snap));
 
-  pthread_mutex_lock(&global_mutex);
   metrics_fill_scheduler_snapshot(&snap);
-  pthread_mutex_unlock(&global_mutex);
 
   /* Format all metrics (outside the lock) */
   format_gpu_metrics(&b);
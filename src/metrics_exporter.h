@@ -12,10 +12,14 @@
 
 /* Default metrics port */
 #define XPUSHARE_DEFAULT_METRICS_PORT 9402
-#define XPUSHARE_METRICS_BUFFER_SIZE (256 * 1024) /* 256 KB output buffer */
+#define XPUSHARE_METRICS_BUFFER_SIZE (256 * 1024) /* Initial, grows as needed */
 #define MAX_SNAPSHOT_CLIENTS 256
 #define MAX_SNAPSHOT_CONTEXTS 16
-#define XPUSHARE_MSG_TYPE_COUNT 16
+#define XPUSHARE_MSG_TYPE_COUNT 20
+/* DROP_LOCK -> LOCK_RELEASED latency histogram, see metrics_exporter.c */
+#define XPUSHARE_DROP_RELEASE_BUCKETS 12
+/* REQ_LOCK -> LOCK_OK wait histograms, kept per client */
+#define XPUSHARE_LOCK_WAIT_BUCKETS 14
 
 /* ---- Snapshot structures for lock-free formatting ---- */
 
@@ -28,11 +32,26 @@ struct client_snapshot {
   pid_t host_pid;
   size_t memory_allocated;
   size_t peak_allocated;
+  size_t predicted_peak; /* Peak of its workload, 0 if unknown */
+  size_t wss;            /* Smoothed working set, 0 if unknown */
   size_t memory_limit;
   int core_limit;
+  int core_request; /* Guaranteed share, core_limit without a request */
+  int namespace_share; /* Of the GPU for its namespace, 0 if not limited */
+  int priority; /* 0 best-effort, 1 standard, 2 latency-critical */
+  int mlfq_level; /* 0 interactive, higher for longer runs */
+  long burst_est_ms; /* Predicted next lock hold */
+  long max_wait_ms; /* Lock wait SLO, 0 = none */
+  unsigned long deadline_miss_count;
+  unsigned long lock_wait_buckets[XPUSHARE_LOCK_WAIT_BUCKETS + 1];
+  unsigned long lock_wait_sum_ms;
   int is_running;
   int is_throttled;
+  long core_borrowed_ms; /* Run past its guarantee, over all windows */
+  long core_lent_ms;     /* Of its unused guarantee, run by others */
   int pending_drop;
+  int lease_overdue;
+  unsigned long lease_overdue_count;
   long run_time_in_window_ms;
   long quota_debt_ms;
   long effective_quota_ms;
@@ -47,9 +66,27 @@ struct context_snapshot {
   int wait_count;
   size_t running_memory;
   size_t peak_memory;
+  size_t unmanaged_memory; /* Outside managed allocations, all clients */
+  size_t process_overhead; /* Learned per client */
   size_t total_memory;
   int memory_reserve_percent;
   int memory_overloaded;
+  unsigned long overload_enter_count;
+  unsigned long overload_exit_count;
+  unsigned long overload_victim_count;
+  int thrashing;
+  unsigned long thrash_enter_count;
+  unsigned long thrash_exit_count;
+  double corun_progress; /* Co-runners in solo runs, < 0 = unknown */
+  unsigned long backfill_count;
+  unsigned long host_mem_defer_count;
+  unsigned long priority_preempt_count;
+  unsigned long deadline_preempt_count;
+  double switch_bandwidth; /* Fitted swap-in bytes/s, 0 until known */
+  double switch_overhead;  /* Predicted switch cost / (TQ + cost), -1 unknown */
+  unsigned long switch_cost_total_ms;
+  unsigned long paced_count;
+  unsigned long prepared_count;
 };
 
 struct scheduler_snapshot {
@@ -62,6 +99,13 @@ struct scheduler_snapshot {
   unsigned long client_disconnect_count;
   unsigned long wait_for_mem_count;
   unsigned long mem_available_count;
+  unsigned long lease_overdue_count;
+  int host_mem_known; /* Host memory below read successfully */
+  size_t host_mem_total;
+  size_t host_mem_available;
+  /* Per bucket, not cumulative; the last one is +Inf */
+  unsigned long drop_release_buckets[XPUSHARE_DROP_RELEASE_BUCKETS + 1];
+  unsigned long drop_release_sum_ms;
 };
 
 /* Metrics configuration */
@@ -97,26 +141,74 @@ extern unsigned long g_metrics_drop_lock_count;
 extern unsigned long g_metrics_client_disconnect_count;
 extern unsigned long g_metrics_wait_for_mem_count;
 extern unsigned long g_metrics_mem_available_count;
+extern unsigned long g_metrics_lease_overdue_count;
+
+/* DROP_LOCK -> LOCK_RELEASED latency histogram */
+extern const long g_metrics_drop_release_bounds_ms[XPUSHARE_DROP_RELEASE_BUCKETS];
+extern unsigned long
+    g_metrics_drop_release_buckets[XPUSHARE_DROP_RELEASE_BUCKETS + 1];
+extern unsigned long g_metrics_drop_release_sum_ms;
+
+extern const long g_metrics_lock_wait_bounds_ms[XPUSHARE_LOCK_WAIT_BUCKETS];
+
+/*
+ * Increment helpers. Counters are bumped from every GPU event loop, so they
+ * are updated atomically (relaxed ordering is enough for statistics).
+ */
+static inline void metrics_add_counter(unsigned long* counter) {
+  __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+static inline unsigned long metrics_load_counter(unsigned long* counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
 
-/* Increment helpers (not atomic, but always called under global_mutex) */
 static inline void metrics_inc_msg(int type) {
   if (type >= 0 && type < XPUSHARE_MSG_TYPE_COUNT) {
-    g_metrics_msg_count[type]++;
+    metrics_add_counter(&g_metrics_msg_count[type]);
   }
 }
 
-static inline void metrics_inc_drop_lock(void) { g_metrics_drop_lock_count++; }
+static inline void metrics_inc_drop_lock(void) {
+  metrics_add_counter(&g_metrics_drop_lock_count);
+}
 
 static inline void metrics_inc_client_disconnect(void) {
-  g_metrics_client_disconnect_count++;
+  metrics_add_counter(&g_metrics_client_disconnect_count);
 }
 
 static inline void metrics_inc_wait_for_mem(void) {
-  g_metrics_wait_for_mem_count++;
+  metrics_add_counter(&g_metrics_wait_for_mem_count);
 }
 
 static inline void metrics_inc_mem_available(void) {
-  g_metrics_mem_available_count++;
+  metrics_add_counter(&g_metrics_mem_available_count);
+}
+
+static inline void metrics_inc_lease_overdue(void) {
+  metrics_add_counter(&g_metrics_lease_overdue_count);
+}
+
+static inline void metrics_observe_drop_release(long latency_ms) {
+  int i = 0;
+
+  if (latency_ms < 0) latency_ms = 0;
+  while (i < XPUSHARE_DROP_RELEASE_BUCKETS &&
+         latency_ms > g_metrics_drop_release_bounds_ms[i])
+    i++;
+  metrics_add_counter(&g_metrics_drop_release_buckets[i]);
+  __atomic_add_fetch(&g_metrics_drop_release_sum_ms, (unsigned long)latency_ms,
+                     __ATOMIC_RELAXED);
+}
+
+/* Bucket of a lock wait, for client_snapshot.lock_wait_buckets */
+static inline int metrics_lock_wait_bucket(long wait_ms) {
+  int i = 0;
+
+  while (i < XPUSHARE_LOCK_WAIT_BUCKETS &&
+         wait_ms > g_metrics_lock_wait_bounds_ms[i])
+    i++;
+  return i;
 }
 
 #endif /* _XPUSHARE_METRICS_EXPORTER_H_ */
@@ -730,6 +730,7 @@ void* nvml_sampler_thread_fn(void* arg __attribute__((unused))) {
         (g_backend_kind == GPU_SAMPLER_BACKEND_NONE) ? 0 : 1;
     g_nvml_snapshot.backend_kind = g_backend_kind;
     memcpy(g_nvml_snapshot.gpus, local_snaps, sizeof(local_snaps));
+    __atomic_add_fetch(&g_nvml_snapshot.generation, 1, __ATOMIC_RELEASE);
     pthread_rwlock_unlock(&g_nvml_snapshot.lock);
 
     sleep_ts.tv_sec = g_interval_ms / 1000;
@@ -51,6 +51,7 @@ struct nvml_snapshot {
   int nvml_available;   /* 1 only when NVML backend is active */
   int sampler_available; /* 1 if any backend is active */
   int backend_kind;     /* enum gpu_sampler_backend_kind */
+  unsigned long generation; /* bumped on every completed sample */
 };
 
 /* Global snapshot instance */
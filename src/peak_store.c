@@ -0,0 +1,235 @@
+/*
+ * Per-workload peak memory store for xpushare-scheduler.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* memrchr() */
+#endif
+
+#include "peak_store.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "utlist.h"
+
+#define PEAK_STORE_BUCKETS 256 /* Power of two */
+
+struct workload_peak {
+  char key[PEAK_STORE_KEY_LEN];
+  size_t peak;
+  struct workload_peak* next;
+};
+
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* One writer at a time, taken before store_mutex */
+static pthread_mutex_t sync_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct workload_peak* buckets[PEAK_STORE_BUCKETS];
+static char* store_path;
+static int dirty;
+static int write_failed; /* Warn once, not on every sync */
+
+/* FNV-1a */
+static struct workload_peak** bucket_of(const char* key) {
+  uint32_t h = 2166136261u;
+
+  for (; *key; key++) h = (h ^ (unsigned char)*key) * 16777619u;
+  return &buckets[h & (PEAK_STORE_BUCKETS - 1)];
+}
+
+static struct workload_peak* find(const char* key) {
+  struct workload_peak* w;
+
+  LL_FOREACH(*bucket_of(key), w) {
+    if (strcmp(w->key, key) == 0) return w;
+  }
+  return NULL;
+}
+
+static struct workload_peak* find_or_add(const char* key) {
+  struct workload_peak* w = find(key);
+
+  if (w != NULL) return w;
+  true_or_exit(w = calloc(1, sizeof(*w)));
+  strlcpy(w->key, key, sizeof(w->key));
+  LL_PREPEND(*bucket_of(key), w);
+  return w;
+}
+
+/* Characters of the random suffixes Kubernetes generates, no vowels */
+static int is_generated(const char* s, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    if (strchr("bcdfghjklmnpqrstvwxz2456789", s[i]) == NULL) return 0;
+  return 1;
+}
+
+static int is_ordinal(const char* s, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    if (s[i] < '0' || s[i] > '9') return 0;
+  return n > 0;
+}
+
+void peak_store_workload_key(const char* ns, const char* pod_name, char* key,
+                             size_t len) {
+  size_t n = strlen(pod_name);
+  const char* dash;
+
+  /* <controller>-<5 random>, <deployment>-<template hash>-<5 random> */
+  dash = memrchr(pod_name, '-', n);
+  if (dash != NULL && dash > pod_name && n - (dash - pod_name) - 1 == 5 &&
+      is_generated(dash + 1, 5)) {
+    n = dash - pod_name;
+    dash = memrchr(pod_name, '-', n);
+    if (dash != NULL && dash > pod_name && n - (dash - pod_name) - 1 >= 6 &&
+        n - (dash - pod_name) - 1 <= 10 &&
+        is_generated(dash + 1, n - (dash - pod_name) - 1))
+      n = dash - pod_name;
+  }
+  /* <statefulset>-<ordinal>, also indexed Jobs */
+  dash = memrchr(pod_name, '-', n);
+  if (dash != NULL && dash > pod_name &&
+      is_ordinal(dash + 1, n - (dash - pod_name) - 1))
+    n = dash - pod_name;
+
+  snprintf(key, len, "%s/%.*s", ns, (int)n, pod_name);
+}
+
+int peak_store_open(const char* path) {
+  char line[PEAK_STORE_KEY_LEN + 32];
+  char key[PEAK_STORE_KEY_LEN];
+  unsigned long long peak;
+  int loaded = 0;
+  FILE* f;
+
+  if (path == NULL) return 0;
+  true_or_exit(pthread_mutex_lock(&store_mutex) == 0);
+  free(store_path);
+  true_or_exit(store_path = strdup(path));
+  f = fopen(path, "r");
+  if (f == NULL) {
+    true_or_exit(pthread_mutex_unlock(&store_mutex) == 0);
+    if (errno == ENOENT) return 0;
+    log_warn("Cannot read peak store %s: %s", path, strerror(errno));
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%511s %llu", key, &peak) != 2) continue; /* KEY_LEN */
+    find_or_add(key)->peak = (size_t)peak;
+    loaded++;
+  }
+  fclose(f);
+  true_or_exit(pthread_mutex_unlock(&store_mutex) == 0);
+
+  log_info("Loaded the peaks of %d workloads from %s", loaded, path);
+  return 0;
+}
+
+size_t peak_store_get(const char* key) {
+  struct workload_peak* w;
+  size_t peak;
+
+  true_or_exit(pthread_mutex_lock(&store_mutex) == 0);
+  w = find(key);
+  peak = w != NULL ? w->peak : 0;
+  true_or_exit(pthread_mutex_unlock(&store_mutex) == 0);
+  return peak;
+}
+
+void peak_store_raise(const char* key, size_t bytes) {
+  struct workload_peak* w;
+
+  if (bytes == 0) return;
+  true_or_exit(pthread_mutex_lock(&store_mutex) == 0);
+  w = find_or_add(key);
+  if (bytes > w->peak) {
+    w->peak = bytes;
+    dirty = 1;
+  }
+  true_or_exit(pthread_mutex_unlock(&store_mutex) == 0);
+}
+
+void peak_store_record(const char* key, size_t run_peak) {
+  struct workload_peak* w;
+
+  /* Never allocated anything: it died early, nothing to learn */
+  if (run_peak == 0) return;
+  true_or_exit(pthread_mutex_lock(&store_mutex) == 0);
+  w = find_or_add(key);
+  if (run_peak >= w->peak)
+    w->peak = run_peak;
+  else
+    w->peak -= (w->peak - run_peak) / 4;
+  dirty = 1;
+  true_or_exit(pthread_mutex_unlock(&store_mutex) == 0);
+}
+
+/*
+ * Write to a temporary file first, so a crash never leaves half a store. The
+ * contents are copied out under store_mutex and written without it, so
+ * lookups never wait for the disk.
+ */
+int peak_store_sync(void) {
+  char tmp_path[PATH_MAX];
+  struct workload_peak* w;
+  char* buf = NULL;
+  size_t len = 0;
+  int ret = 0;
+  FILE* f;
+
+  true_or_exit(pthread_mutex_lock(&sync_mutex) == 0);
+  true_or_exit(pthread_mutex_lock(&store_mutex) == 0);
+  if (store_path == NULL || !dirty) {
+    true_or_exit(pthread_mutex_unlock(&store_mutex) == 0);
+    goto out;
+  }
+  true_or_exit(f = open_memstream(&buf, &len));
+  fprintf(f, "# xpushare workload peaks: <namespace>/<workload> <bytes>\n");
+  for (int i = 0; i < PEAK_STORE_BUCKETS; i++) {
+    LL_FOREACH(buckets[i], w) {
+      fprintf(f, "%s %zu\n", w->key, w->peak);
+    }
+  }
+  true_or_exit(fclose(f) == 0);
+  dirty = 0;
+  true_or_exit(pthread_mutex_unlock(&store_mutex) == 0);
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", store_path);
+  f = fopen(tmp_path, "w");
+  if (f == NULL) {
+    ret = -1;
+    goto fail;
+  }
+  if (fwrite(buf, 1, len, f) != len) ret = -1;
+  if (fflush(f) != 0 || fsync(fileno(f)) != 0) ret = -1;
+  if (fclose(f) != 0) ret = -1;
+  if (ret == 0 && rename(tmp_path, store_path) != 0) ret = -1;
+  if (ret < 0) {
+    int saved_errno = errno;
+    unlink(tmp_path);
+    errno = saved_errno;
+    goto fail;
+  }
+  write_failed = 0;
+  goto out;
+
+fail:
+  if (!write_failed)
+    log_warn("Cannot write peak store %s: %s", store_path, strerror(errno));
+  write_failed = 1;
+  /* Try again on the next sync */
+  true_or_exit(pthread_mutex_lock(&store_mutex) == 0);
+  dirty = 1;
+  true_or_exit(pthread_mutex_unlock(&store_mutex) == 0);
+out:
+  true_or_exit(pthread_mutex_unlock(&sync_mutex) == 0);
+  free(buf);
+  return ret;
+}
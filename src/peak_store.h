@@ -0,0 +1,58 @@
+/*
+ * Per-workload peak memory store for xpushare-scheduler.
+ *
+ * Frameworks allocate lazily, so a client asking for the lock has often not
+ * allocated much yet. The store remembers the peak managed allocation of
+ * every workload (the pods of a Deployment, Job or StatefulSet) across runs
+ * and scheduler restarts, so admission can go by what a client is going to
+ * use. It lives in memory and is written back to a small text file, one
+ * "<namespace>/<workload> <bytes>" line per workload.
+ *
+ * All functions are thread-safe.
+ */
+
+#ifndef _XPUSHARE_PEAK_STORE_H_
+#define _XPUSHARE_PEAK_STORE_H_
+
+#include <stddef.h>
+
+#define PEAK_STORE_KEY_LEN 512
+
+/*
+ * Workload key of a pod: its namespace and name, without the suffixes
+ * Kubernetes generates for the pods of a controller. Those are a random
+ * 5 character suffix, the pod template hash of a ReplicaSet and the ordinal
+ * of a StatefulSet pod.
+ */
+void peak_store_workload_key(const char* ns, const char* pod_name, char* key,
+                             size_t len);
+
+/*
+ * Load the store from path, which is also where peak_store_sync() writes.
+ * A missing file is an empty store. Returns -1 if the file exists but can't
+ * be read; the store then works in memory only. A NULL path disables the
+ * file altogether.
+ */
+int peak_store_open(const char* path);
+
+/* Peak allocation of a workload, 0 if unknown */
+size_t peak_store_get(const char* key);
+
+/* A client of the workload is using this much now: raise the peak to it */
+void peak_store_raise(const char* key, size_t bytes);
+
+/*
+ * A client of the workload is gone, having used at most run_peak. A lower
+ * peak than the stored one pulls it down by a quarter of the difference, so
+ * one unusual run does not stick forever.
+ */
+void peak_store_record(const char* key, size_t run_peak);
+
+/*
+ * Write the store back if it changed. Returns -1 on failure. This does file
+ * I/O and an fsync, so call it from a background thread, not from a path
+ * that serves clients.
+ */
+int peak_store_sync(void);
+
+#endif /* _XPUSHARE_PEAK_STORE_H_ */
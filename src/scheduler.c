@@ -24,23 +24,34 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "comm.h"
 #include "common.h"
+#include "host_mem.h"
 #include "k8s_api.h"
 #include "metrics_exporter.h"
 #include "nvml_sampler.h"
+#include "peak_store.h"
+#include "timer_wheel.h"
+#include "uring.h"
 #include "utlist.h"
 
 #define MEMORY_LIMIT_ANNOTATION "xpushare.com/gpu-memory-limit"
 #define CORE_LIMIT_ANNOTATION "xpushare.com/gpu-core-limit"
+#define CORE_REQUEST_ANNOTATION "xpushare.com/gpu-core-request"
+#define PRIORITY_ANNOTATION "xpushare.com/gpu-priority"
+#define MAX_WAIT_ANNOTATION "xpushare.com/gpu-max-wait-ms"
+/* On the Namespace, not the Pod */
+#define NAMESPACE_WEIGHT_ANNOTATION "xpushare.com/gpu-weight"
 
 #define XPUSHARE_DEFAULT_COMPUTE_WINDOW_MS 2000
 
@@ -51,9 +62,26 @@
 #define XPUSHARE_DEFAULT_SWITCH_TIME_MULTIPLIER 5
 #define XPUSHARE_DEFAULT_FIXED_SWITCH_TIME 60
 #define XPUSHARE_DEFAULT_MAX_RUNTIME_SEC 300 /* 5 minutes */
-#define XPUSHARE_DEFAULT_QUOTA_SAMPLE_INTERVAL_MS 50
 #define XPUSHARE_DEFAULT_QUOTA_CARRYOVER_PERCENT 25
 #define XPUSHARE_DEFAULT_DROP_TAIL_BILLING_PERCENT 70
+#define XPUSHARE_DEFAULT_LOCK_LEASE_MS 10000
+#define XPUSHARE_DEFAULT_MEM_WM_LOW_PERCENT 80
+#define XPUSHARE_DEFAULT_MEM_RECOVERY_DWELL_MS 5000
+#define XPUSHARE_DEFAULT_DRR_QUANTUM_MS 0 /* One TQ */
+#define XPUSHARE_DEFAULT_MLFQ_BOOST_MS 60000
+#define XPUSHARE_DEFAULT_SJF_AGING_FACTOR 4
+#define XPUSHARE_DEFAULT_SWITCH_OVERHEAD_PERCENT 5
+#define XPUSHARE_DEFAULT_ADMISSION_BANDWIDTH_MBPS 12000 /* PCIe 3.0 x16 */
+#define ADMISSION_PACE_MAX_MS 10000
+#define XPUSHARE_DEFAULT_SWAP_PREPARE_MS 0 /* Off */
+#define XPUSHARE_DEFAULT_PEAK_STORE_PATH "/var/lib/xpushare/workload-peaks"
+#define XPUSHARE_DEFAULT_HOST_MEMINFO_PATH "/proc/meminfo"
+#define XPUSHARE_DEFAULT_HOST_MEM_WM_PERCENT 10
+#define HOST_MEM_REFRESH_MS 1000
+#define XPUSHARE_DEFAULT_THRASH_PROGRESS_PERCENT 50
+#define XPUSHARE_DEFAULT_THRASH_PROBE_MS 60000
+#define THRASH_SAMPLE_MAX_AGE_MS 5000
+#define THRASH_BACKOFF_MAX 16 /* Times config.thrash_probe_ms */
 
 /* Globals moved to gpu_context */
 int scheduler_on;
@@ -61,10 +89,42 @@ int tq;
 
 /* Memory-aware scheduling configuration */
 enum switch_time_mode {
-  SWITCH_TIME_AUTO, /* Auto-calculate based on memory usage */
-  SWITCH_TIME_FIXED /* Fixed switch time in seconds */
+  SWITCH_TIME_AUTO,  /* Auto-calculate based on memory usage */
+  SWITCH_TIME_FIXED, /* Fixed switch time in seconds */
+  SWITCH_TIME_MODEL  /* From measured switch costs, see switch_cost_fit() */
 };
 
+/* How the event loops talk to client sockets */
+enum io_engine {
+  IO_ENGINE_EPOLL, /* epoll, one read()/write() per message */
+  IO_ENGINE_URING  /* io_uring, multishot recv/accept and batched sends */
+};
+
+/* Priority classes, from PRIORITY_ANNOTATION. Higher ones go first. */
+enum priority_class {
+  PRIORITY_BEST_EFFORT,
+  PRIORITY_STANDARD,
+  PRIORITY_LATENCY_CRITICAL,
+  NR_PRIORITY_CLASSES
+};
+
+static const char* const priority_class_names[NR_PRIORITY_CLASSES] = {
+    "best-effort", "standard", "latency-critical"};
+
+/* Order in which waiting clients get the lock, see queued_before() */
+enum queue_policy {
+  QUEUE_POLICY_FCFS, /* Arrival order */
+  QUEUE_POLICY_DRR,  /* Least lock time used, weighted by core_limit */
+  QUEUE_POLICY_MLFQ, /* Short bursts first, see mlfq_feedback() */
+  QUEUE_POLICY_SJF   /* Shortest predicted hold first, with aging */
+};
+
+/*
+ * MLFQ levels. Level 0 holds the most interactive clients and has the
+ * shortest quantum, each level below doubles it, up to a full TQ.
+ */
+#define MLFQ_LEVELS 3
+
 /* Scheduling mode for multi-task scenarios */
 enum scheduling_mode {
   SCHED_MODE_AUTO,      /* Smart: concurrent if memory fits, serial otherwise */
@@ -75,29 +135,64 @@ enum scheduling_mode {
 struct scheduler_config {
   enum switch_time_mode mode;
   enum scheduling_mode scheduling_mode;
+  enum queue_policy queue_policy;
   int fixed_switch_time;         /* Fixed switch time in seconds */
   int time_multiplier;           /* Multiplier for auto mode */
+  int switch_overhead_percent;   /* Model mode: switch cost share of GPU time */
+  int admission_pacing;          /* Space out grants by warm-up time */
+  int admission_bandwidth_mbps;  /* Host to device, 0 = measured */
+  int swap_prepare_ms;           /* Switch pipelining lead, 0 = off */
   int memory_reserve_percent;    /* Reserved memory percentage */
   int max_runtime_sec;           /* Max runtime before forced switch */
-  int quota_sample_interval_ms;  /* Quota enforcement sampling interval */
   int compute_window_ms;         /* Compute quota window size */
   int quota_carryover_percent;   /* Over-limit carryover ratio */
   int drop_tail_billing_percent; /* Billing ratio for DROP->RELEASE tail */
+  int lock_lease_ms;             /* DROP->RELEASE bound, 0 = unbounded */
+  int mem_wm_low_percent;        /* Overload ends below this much demand */
+  int mem_recovery_dwell_ms;     /* ... once it stayed there this long */
+  int drr_quantum_ms;            /* DRR lead over waiters, 0 = one TQ */
+  int mlfq_boost_ms;             /* MLFQ: everyone back to level 0 this often */
+  int sjf_aging_factor;          /* SJF: wait (ms) that offsets 1 ms of burst */
+  int class_tq_sec[NR_PRIORITY_CLASSES]; /* 0 = TQ from the switch time */
   size_t default_gpu_memory;     /* Default GPU memory if not detected */
+  const char* peak_store_path;   /* NULL = workload peaks in memory only */
+  const char* host_meminfo_path;
+  const char* host_cgroup_path;  /* cgroup v2 directory, NULL = none */
+  int host_mem_wm_percent;       /* Host RAM kept free, 0 = don't check */
+  int thrash_progress_percent;   /* AUTO: serial below this, 0 = off */
+  int thrash_probe_ms;           /* ... and try co-running again after */
+  enum io_engine io_engine;
 };
 
 static struct scheduler_config config = {
     .mode = SWITCH_TIME_AUTO,
     .scheduling_mode = SCHED_MODE_AUTO,
+    .queue_policy = QUEUE_POLICY_FCFS,
     .fixed_switch_time = XPUSHARE_DEFAULT_FIXED_SWITCH_TIME,
     .time_multiplier = XPUSHARE_DEFAULT_SWITCH_TIME_MULTIPLIER,
+    .switch_overhead_percent = XPUSHARE_DEFAULT_SWITCH_OVERHEAD_PERCENT,
+    .admission_pacing = 0,
+    .admission_bandwidth_mbps = 0,
+    .swap_prepare_ms = XPUSHARE_DEFAULT_SWAP_PREPARE_MS,
     .memory_reserve_percent = XPUSHARE_DEFAULT_MEMORY_RESERVE_PERCENT,
     .max_runtime_sec = XPUSHARE_DEFAULT_MAX_RUNTIME_SEC,
-    .quota_sample_interval_ms = XPUSHARE_DEFAULT_QUOTA_SAMPLE_INTERVAL_MS,
     .compute_window_ms = XPUSHARE_DEFAULT_COMPUTE_WINDOW_MS,
     .quota_carryover_percent = XPUSHARE_DEFAULT_QUOTA_CARRYOVER_PERCENT,
     .drop_tail_billing_percent = XPUSHARE_DEFAULT_DROP_TAIL_BILLING_PERCENT,
-    .default_gpu_memory = XPUSHARE_DEFAULT_GPU_MEMORY};
+    .lock_lease_ms = XPUSHARE_DEFAULT_LOCK_LEASE_MS,
+    .mem_wm_low_percent = XPUSHARE_DEFAULT_MEM_WM_LOW_PERCENT,
+    .mem_recovery_dwell_ms = XPUSHARE_DEFAULT_MEM_RECOVERY_DWELL_MS,
+    .drr_quantum_ms = XPUSHARE_DEFAULT_DRR_QUANTUM_MS,
+    .mlfq_boost_ms = XPUSHARE_DEFAULT_MLFQ_BOOST_MS,
+    .sjf_aging_factor = XPUSHARE_DEFAULT_SJF_AGING_FACTOR,
+    .default_gpu_memory = XPUSHARE_DEFAULT_GPU_MEMORY,
+    .peak_store_path = XPUSHARE_DEFAULT_PEAK_STORE_PATH,
+    .host_meminfo_path = XPUSHARE_DEFAULT_HOST_MEMINFO_PATH,
+    .host_cgroup_path = NULL,
+    .host_mem_wm_percent = XPUSHARE_DEFAULT_HOST_MEM_WM_PERCENT,
+    .thrash_progress_percent = XPUSHARE_DEFAULT_THRASH_PROGRESS_PERCENT,
+    .thrash_probe_ms = XPUSHARE_DEFAULT_THRASH_PROBE_MS,
+    .io_engine = IO_ENGINE_EPOLL};
 
 /* Initialize configuration from environment variables */
 static void init_config(void) {
@@ -107,6 +202,9 @@ static void init_config(void) {
   if (val && strcmp(val, "fixed") == 0) {
     config.mode = SWITCH_TIME_FIXED;
     log_info("Switch time mode: FIXED");
+  } else if (val && strcmp(val, "model") == 0) {
+    config.mode = SWITCH_TIME_MODEL;
+    log_info("Switch time mode: MODEL (from measured switch costs)");
   } else {
     log_info("Switch time mode: AUTO");
   }
@@ -123,6 +221,60 @@ static void init_config(void) {
     log_info("Switch time multiplier: %d", config.time_multiplier);
   }
 
+  val = getenv("XPUSHARE_SWITCH_OVERHEAD_PERCENT");
+  if (val) {
+    config.switch_overhead_percent = atoi(val);
+    if (config.switch_overhead_percent < 1) config.switch_overhead_percent = 1;
+    if (config.switch_overhead_percent > 50) config.switch_overhead_percent = 50;
+    log_info("Switch overhead target: %d%%", config.switch_overhead_percent);
+  }
+
+  val = getenv("XPUSHARE_ADMISSION_PACING");
+  if (val && (strcmp(val, "1") == 0 || strcmp(val, "on") == 0)) {
+    config.admission_pacing = 1;
+    log_info("Admission pacing: ON");
+  }
+  val = getenv("XPUSHARE_ADMISSION_BANDWIDTH_MBPS");
+  if (val) {
+    config.admission_bandwidth_mbps = atoi(val);
+    if (config.admission_bandwidth_mbps < 0) config.admission_bandwidth_mbps = 0;
+    if (config.admission_pacing && config.admission_bandwidth_mbps > 0)
+      log_info("Admission bandwidth: %d MB/s", config.admission_bandwidth_mbps);
+  }
+
+  val = getenv("XPUSHARE_SWAP_PREPARE_MS");
+  if (val) {
+    config.swap_prepare_ms = atoi(val);
+    if (config.swap_prepare_ms < 0) config.swap_prepare_ms = 0;
+    if (config.swap_prepare_ms > 0)
+      log_info("Switch pipelining: prepare %d ms before the TQ ends",
+               config.swap_prepare_ms);
+  }
+
+  val = getenv("XPUSHARE_PEAK_STORE_PATH");
+  if (val) {
+    config.peak_store_path = val[0] != '\0' ? val : NULL;
+    log_info("Workload peak store: %s",
+             config.peak_store_path ? config.peak_store_path : "memory only");
+  }
+
+  /* Unified Memory spills to host RAM, keep some of it free */
+  val = getenv("XPUSHARE_HOST_MEM_WM_PERCENT");
+  if (val) {
+    config.host_mem_wm_percent = atoi(val);
+    if (config.host_mem_wm_percent < 0) config.host_mem_wm_percent = 0;
+    if (config.host_mem_wm_percent > 90) config.host_mem_wm_percent = 90;
+  }
+  val = getenv("XPUSHARE_HOST_MEMINFO_PATH");
+  if (val && val[0] != '\0') config.host_meminfo_path = val;
+  val = getenv("XPUSHARE_HOST_CGROUP_PATH");
+  if (val && val[0] != '\0') config.host_cgroup_path = val;
+  if (config.host_mem_wm_percent > 0)
+    log_info("Host memory watermark: %d%% free (%s%s%s)",
+             config.host_mem_wm_percent, config.host_meminfo_path,
+             config.host_cgroup_path ? ", " : "",
+             config.host_cgroup_path ? config.host_cgroup_path : "");
+
   val = getenv("XPUSHARE_MEMORY_RESERVE_PERCENT");
   if (val) {
     config.memory_reserve_percent = atoi(val);
@@ -153,6 +305,59 @@ static void init_config(void) {
     log_info("Scheduling mode: AUTO (default)");
   }
 
+  /* Queue policy: fcfs or drr */
+  val = getenv("XPUSHARE_QUEUE_POLICY");
+  if (val && strcmp(val, "drr") == 0) {
+    config.queue_policy = QUEUE_POLICY_DRR;
+    log_info("Queue policy: DRR (fair share of lock time by core limit)");
+  } else if (val && strcmp(val, "mlfq") == 0) {
+    config.queue_policy = QUEUE_POLICY_MLFQ;
+    log_info("Queue policy: MLFQ (short bursts ahead of long runs)");
+  } else if (val && strcmp(val, "sjf") == 0) {
+    config.queue_policy = QUEUE_POLICY_SJF;
+    log_info("Queue policy: SJF (shortest predicted lock hold first)");
+  } else {
+    if (val && strcmp(val, "fcfs") != 0)
+      log_warn("Unknown queue policy %s, using fcfs", val);
+    log_info("Queue policy: FCFS");
+  }
+  val = getenv("XPUSHARE_DRR_QUANTUM_MS");
+  if (val) {
+    config.drr_quantum_ms = atoi(val);
+    if (config.drr_quantum_ms < 0) config.drr_quantum_ms = 0;
+  }
+  if (config.queue_policy == QUEUE_POLICY_DRR && config.drr_quantum_ms > 0)
+    log_info("DRR quantum: %d ms", config.drr_quantum_ms);
+  val = getenv("XPUSHARE_MLFQ_BOOST_MS");
+  if (val) {
+    config.mlfq_boost_ms = atoi(val);
+    if (config.mlfq_boost_ms < 0) config.mlfq_boost_ms = 0;
+  }
+  if (config.queue_policy == QUEUE_POLICY_MLFQ)
+    log_info("MLFQ boost period: %d ms", config.mlfq_boost_ms);
+  val = getenv("XPUSHARE_SJF_AGING_FACTOR");
+  if (val) {
+    config.sjf_aging_factor = atoi(val);
+    if (config.sjf_aging_factor < 1) config.sjf_aging_factor = 1;
+  }
+  if (config.queue_policy == QUEUE_POLICY_SJF)
+    log_info("SJF aging factor: %d", config.sjf_aging_factor);
+
+  /* Per priority class TQ */
+  for (int i = 0; i < NR_PRIORITY_CLASSES; i++) {
+    static const char* const env[NR_PRIORITY_CLASSES] = {
+        "XPUSHARE_TQ_SEC_BEST_EFFORT", "XPUSHARE_TQ_SEC_STANDARD",
+        "XPUSHARE_TQ_SEC_LATENCY_CRITICAL"};
+
+    val = getenv(env[i]);
+    if (val == NULL) continue;
+    config.class_tq_sec[i] = atoi(val);
+    if (config.class_tq_sec[i] < 0) config.class_tq_sec[i] = 0;
+    if (config.class_tq_sec[i] > 0)
+      log_info("TQ for %s clients: %d s", priority_class_names[i],
+               config.class_tq_sec[i]);
+  }
+
   /* Maximum runtime before forced switch */
   val = getenv("XPUSHARE_MAX_RUNTIME_SEC");
   if (val) {
@@ -166,20 +371,9 @@ static void init_config(void) {
              config.max_runtime_sec);
   }
 
-  /* Quota enforcement sampling interval */
-  val = getenv("XPUSHARE_QUOTA_SAMPLE_INTERVAL_MS");
-  if (val) {
-    config.quota_sample_interval_ms = atoi(val);
-    if (config.quota_sample_interval_ms < 10) {
-      config.quota_sample_interval_ms = 10;
-    } else if (config.quota_sample_interval_ms > 1000) {
-      config.quota_sample_interval_ms = 1000;
-    }
-    log_info("Quota sampling interval: %d ms", config.quota_sample_interval_ms);
-  } else {
-    log_info("Quota sampling interval: %d ms (default)",
-             config.quota_sample_interval_ms);
-  }
+  /* Quota is enforced by per-client timers now, there is nothing to sample */
+  if (getenv("XPUSHARE_QUOTA_SAMPLE_INTERVAL_MS"))
+    log_warn("XPUSHARE_QUOTA_SAMPLE_INTERVAL_MS is no longer used, ignoring it");
 
   /* Compute quota window size */
   val = getenv("XPUSHARE_COMPUTE_WINDOW_MS");
@@ -223,42 +417,218 @@ static void init_config(void) {
     log_info("Drop-tail billing ratio: %d%% (default)",
              config.drop_tail_billing_percent);
   }
+
+  /*
+   * Recovery from the memory overload fallback. Overload starts above the
+   * safe limit (100 - reserve percent), so the low watermark must be below.
+   */
+  val = getenv("XPUSHARE_MEM_WM_LOW_PERCENT");
+  if (val) config.mem_wm_low_percent = atoi(val);
+  if (config.mem_wm_low_percent < 0) config.mem_wm_low_percent = 0;
+  if (config.mem_wm_low_percent >= 100 - config.memory_reserve_percent) {
+    config.mem_wm_low_percent = 100 - config.memory_reserve_percent - 5;
+    if (config.mem_wm_low_percent < 0) config.mem_wm_low_percent = 0;
+    log_warn("Memory low watermark must be below the safe limit, using %d%%",
+             config.mem_wm_low_percent);
+  }
+  val = getenv("XPUSHARE_MEM_RECOVERY_DWELL_MS");
+  if (val) {
+    config.mem_recovery_dwell_ms = atoi(val);
+    if (config.mem_recovery_dwell_ms < 0) config.mem_recovery_dwell_ms = 0;
+  }
+  log_info("Memory overload recovery: below %d%% for %d ms",
+           config.mem_wm_low_percent, config.mem_recovery_dwell_ms);
+
+  /* AUTO mode: co-runners that page each other to a halt go serial */
+  val = getenv("XPUSHARE_THRASH_PROGRESS_PERCENT");
+  if (val) {
+    config.thrash_progress_percent = atoi(val);
+    if (config.thrash_progress_percent < 0) config.thrash_progress_percent = 0;
+    if (config.thrash_progress_percent > 100)
+      config.thrash_progress_percent = 100;
+  }
+  val = getenv("XPUSHARE_THRASH_PROBE_MS");
+  if (val) {
+    config.thrash_probe_ms = atoi(val);
+    if (config.thrash_probe_ms < 1000) config.thrash_probe_ms = 1000;
+  }
+  if (config.scheduling_mode == SCHED_MODE_AUTO &&
+      config.thrash_progress_percent > 0)
+    log_info("Thrash detection: serial below %d%% progress, probe after %d ms",
+             config.thrash_progress_percent, config.thrash_probe_ms);
+
+  /* How long a client may keep the lock after DROP_LOCK */
+  val = getenv("XPUSHARE_LOCK_LEASE_MS");
+  if (val) {
+    config.lock_lease_ms = atoi(val);
+    if (config.lock_lease_ms < 0) config.lock_lease_ms = 0;
+  }
+  if (config.lock_lease_ms > 0)
+    log_info("Lock lease after DROP_LOCK: %d ms", config.lock_lease_ms);
+  else
+    log_info("Lock lease after DROP_LOCK: unbounded");
+
+  /* Socket I/O engine, io_uring needs Linux 6.0+ */
+  val = getenv("XPUSHARE_IO_ENGINE");
+  if (val && strcmp(val, "io_uring") == 0) {
+    if (uring_supported()) {
+      config.io_engine = IO_ENGINE_URING;
+      log_info("I/O engine: io_uring");
+    } else {
+      log_warn("io_uring is not usable on this kernel, falling back to epoll");
+    }
+  } else {
+    if (val && strcmp(val, "epoll") != 0)
+      log_warn("Unknown I/O engine %s, using epoll", val);
+    log_info("I/O engine: epoll");
+  }
 }
 /*
  * Making scheduling_round global is problematic if used for uniqueness checks
  * per GPU. Moving to gpu_context.
  */
 
-struct message out_msg = {0};
-
 char nvscheduler_socket_path[XPUSHARE_SOCK_PATH_MAX];
 
+/*
+ * Locking
+ *
+ * Every GPU context is a shard with its own lock, epoll set and event loop
+ * thread. A registered client's socket lives in the epoll set of its GPU, so
+ * lock handoffs on one GPU never wait behind traffic on another.
+ *
+ * global_mutex only protects the client id table, the `gpu_contexts` list
+ * and the scheduler-wide settings (scheduler_on, tq). It is never held across
+ * socket I/O. The per-GPU client list and lock queues belong to ctx->lock.
+ *
+ * Lock order: gpu_context.lock -> global_mutex, and gpu_context.lock ->
+ * namespace_weights_mutex (see update_namespace_shares()). Neither is ever
+ * held when taking a gpu_context.lock.
+ */
 pthread_mutex_t global_mutex;
 
-/* File descriptor for epoll */
+/* File descriptor for the control epoll set (listening socket + clients that
+ * have not registered yet) */
 int epoll_fd;
 
+/*
+ * With the io_uring engine, every event loop owns a ring instead of an epoll
+ * set. A client's socket has a multishot recv armed on the ring of its GPU
+ * and at most one send in flight, so messages go out in order. Requests are
+ * queued under ctx->lock and reach the kernel in one batch when the loop goes
+ * back to waiting; other threads submit theirs right away.
+ *
+ * The user_data of a request is the object it belongs to, tagged with the
+ * kind of request in the low bits.
+ */
+enum io_op { IO_OP_ACCEPT = 1, IO_OP_TIMER, IO_OP_RECV, IO_OP_SEND };
+#define IO_OP_MASK 7ULL
+#define IO_DATA(ptr, op) ((uint64_t)(uintptr_t)(ptr) | (op))
+#define IO_PTR(data) ((void*)(uintptr_t)((data) & ~IO_OP_MASK))
+
+/* Reads per wakeup of a registered client's socket, see drain_client() */
+#define RX_CHUNK_SIZE 8192
+#define RX_MAX_CHUNKS 4
+
+#define URING_ENTRIES 256
+#define URING_NR_BUFS 64 /* Power of two */
+#define URING_BUF_SIZE 4096
+
+/* Ring of the control loop, see control_loop_uring() */
+static struct uring ctl_ring;
+
+/* The lock queue a client currently sits in, see struct gpu_context */
+enum client_queue {
+  QUEUE_NONE = 0,
+  QUEUE_REQUESTS, /* Pending requests waiting to run */
+  QUEUE_RUNNING,  /* Currently running tasks */
+  QUEUE_WAIT,     /* Processes waiting for memory */
+  NR_QUEUES
+};
+
 /* Manages state for a single physical GPU */
 struct gpu_context {
   char uuid[XPUSHARE_GPU_UUID_LEN];
-  struct xpushare_request* requests;     /* Pending requests waiting to run */
-  struct xpushare_request* running_list; /* Currently running tasks */
+  pthread_mutex_t lock; /* Protects this context and its clients */
+  int epoll_fd;         /* Sockets of clients registered on this GPU */
+  struct uring ring;    /* Instead of epoll_fd, with IO_ENGINE_URING */
+  int dispatching;      /* The loop is handling completions, defer submits */
+  uint64_t timer_expirations; /* Read buffer for timer_fd */
+  struct xpushare_client* tx_pending; /* epoll: clients with queued messages */
+  pthread_t loop_tid;   /* Event loop thread for this GPU */
+  struct xpushare_client* clients; /* Clients registered on this GPU */
+  /*
+   * Lock queues, indexed by enum client_queue. Clients are linked in directly
+   * (through q_prev/q_next), so moving one between queues is O(1).
+   */
+  struct xpushare_client* queues[NR_QUEUES];
+  int queue_len[NR_QUEUES];
+  int quota_sum;          /* Sum of the guarantees of quota-limited clients */
+  int nr_running_limited; /* Running clients with core_guarantee() < 100 */
+  struct namespace_share* ns_shares; /* Scratch of update_namespace_shares() */
+  int ns_shares_cap;
+  int nr_overdue;         /* Running clients past their lease */
   int lock_held;
-  int must_reset_timer;
   unsigned int scheduling_round;
-  pthread_cond_t timer_cv;
-  pthread_cond_t sched_cv; /* Wakes up scheduler (try_schedule) */
-  pthread_t timer_tid;
+  unsigned long req_seq;       /* Stamps lock requests in arrival order */
+  long drr_vtime; /* DRR: pass of the client served last, see queued_before() */
+  long mlfq_boost_ms; /* MLFQ: last time every client went back to level 0 */
+  long tq_start_ms;   /* When the TQ running now started */
+  unsigned long backfill_count; /* Started ahead of a reservation */
+  unsigned long host_mem_defer_count; /* Held back for host RAM */
+  unsigned long priority_preempt_count; /* Holders dropped for a higher class */
+  unsigned long deadline_preempt_count; /* Holders dropped for a lock wait SLO */
+  long drop_release_ewma_ms; /* DROP_LOCK -> LOCK_RELEASED, see deadline_timer */
+  /*
+   * TQ, window and quota deadlines. The wheel is driven by timer_fd, which
+   * sits in epoll_fd and is armed for the earliest pending deadline.
+   */
+  struct timer_wheel timers;
+  int timer_fd;
+  uint64_t timer_fd_expiry; /* TIMER_WHEEL_NEVER when disarmed */
+  struct timer_wheel_timer tq_timer;
+  struct timer_wheel_timer window_timer;
+  struct timer_wheel_timer deadline_timer; /* EDF, see arm_deadline_timer() */
+  /* Admission pacing: no new grant before this, see try_schedule() */
+  long admit_after_ms;
+  struct timer_wheel_timer pace_timer;
+  unsigned long paced_count;
+  /* Switch pipelining, see prepare_timer_fn() */
+  struct timer_wheel_timer prepare_timer;
+  unsigned long prepared_count;
   struct gpu_context* next;
   /* Memory-aware scheduling fields */
   size_t total_memory;         /* Total GPU memory in bytes */
   size_t available_memory;     /* Available memory in bytes */
   size_t running_memory_usage; /* Memory used by running processes */
   size_t peak_memory_usage;    /* Peak memory usage for diagnostics */
+  size_t process_overhead;     /* Learned, see unmanaged_memory() */
+  size_t unmanaged;            /* Cached result of unmanaged_memory() */
+  unsigned long nvml_generation; /* NVML sample it was computed from */
+  int unmanaged_stale;         /* Clients changed since */
   int memory_overloaded;       /* Set to 1 when memory overload detected */
-  struct xpushare_request* wait_queue; /* Processes waiting for memory */
+  long overload_low_since_ms;  /* Demand below the low watermark since */
+  struct timer_wheel_timer recovery_timer; /* Ends the overload fallback */
+  unsigned long overload_enter_count, overload_exit_count;
+  unsigned long overload_victim_count;
+  /* Thrash detection, see check_thrash() */
+  long running_changed_ms; /* Last time a client started or stopped running */
+  int thrashing;           /* Serial until thrash_timer fires */
+  int thrash_probing;      /* Co-running again, not proven safe yet */
+  long thrash_backoff_ms;
+  double corun_progress; /* Of the last check, in solo runs, < 0 = none */
+  struct timer_wheel_timer thrash_timer;
+  unsigned long thrash_enter_count, thrash_exit_count;
   /* Compute limit fields */
   long window_start_ms; /* Start time of current compute window (ms) */
+  /*
+   * Switch cost model: cost (ms) = fixed + GiB to swap in * ms per GiB,
+   * least squares over exponentially decayed samples, see
+   * observe_switch_cost().
+   */
+  long last_drain_ms; /* DROP_LOCK -> LOCK_RELEASED, < 0 = no switch due */
+  double cost_n, cost_sx, cost_sy, cost_sxx, cost_sxy;
+  unsigned long switch_cost_total_ms;
 };
 
 /* Necessary information for identifying an xpushare client */
@@ -268,10 +638,17 @@ struct xpushare_client {
   char pod_name[POD_NAME_LEN_MAX];
   char pod_namespace[POD_NAMESPACE_LEN_MAX];
   struct gpu_context* context; /* The GPU this client is assigned to */
-  struct xpushare_client* next;
+  struct xpushare_client *ctx_prev, *ctx_next; /* context->clients */
+  struct xpushare_client *q_prev, *q_next;     /* context->queues[queue] */
+  enum client_queue queue;
+  struct xpushare_client* hnext; /* Chain in client_table */
   /* Memory-aware scheduling fields */
   size_t memory_allocated;    /* Current allocated memory in bytes */
   size_t peak_allocated;      /* Lifetime peak managed allocation */
+  size_t nvml_used;           /* Device memory NVML sees, 0 until it does */
+  size_t predicted_peak;      /* Peak of its workload, see peak_store.h */
+  size_t wss;                 /* Smoothed working set, 0 until reported */
+  int host_mem_deferred;      /* Held back for host RAM since its request */
   int is_running;             /* Whether running on GPU */
   time_t last_scheduled_time; /* Last time this client was scheduled */
   /* Dynamic memory limit from pod annotation */
@@ -280,35 +657,148 @@ struct xpushare_client {
   pid_t host_pid;
   /* Compute limit fields */
   int core_limit;             /* 1-100, default 100 */
+  int core_request;           /* Guaranteed share, 0 = core_limit */
+  /*
+   * Weight of its namespace as last looked up, only for refresh_pod_limits()
+   * to notice a change. The shares read the namespace cache instead.
+   */
+  int ns_weight;
+  /* See update_namespace_shares(), for quota-limited clients only */
+  int ns_demand;   /* Sum of the guarantees in its namespace */
+  int ns_entitled; /* What its namespace gets of the GPU */
+  enum priority_class priority;
   long run_time_in_window_ms; /* Runtime in current window (ms) */
   long current_run_start_ms;  /* Start time of current run (ms) */
+  long lock_granted_ms;       /* When it got the lock this time (ms) */
+  long switch_drain_ms;       /* Of the holder it replaced, < 0 = none */
+  long last_hold_ms;          /* How long it held the lock last time (ms) */
+  unsigned long req_seq;      /* Arrival order of its pending request */
+  long drr_pass;              /* DRR: lock time used, times 100 / core_limit */
+  struct timer_wheel_timer share_timer; /* DRR: fires when quantum is used */
+  int mlfq_level;             /* MLFQ: 0 (interactive) .. MLFQ_LEVELS - 1 */
+  long burst_est_ms;          /* EWMA of its lock holds, 0 until the first */
+  long sjf_key;               /* SJF: see queued_before() */
+  /* Lock wait SLO from MAX_WAIT_ANNOTATION, 0 = none, see queued_before() */
+  long max_wait_ms;
+  long requested_ms; /* When its pending request came in (ms) */
+  long deadline_ms;  /* requested_ms + max_wait_ms, LONG_MAX without SLO */
+  unsigned long deadline_miss_count;
+  unsigned long lock_wait_buckets[XPUSHARE_LOCK_WAIT_BUCKETS + 1];
+  unsigned long lock_wait_sum_ms;
   int is_throttled;           /* Set to 1 if quota exceeded */
+  int borrowing;              /* Holding the lock past its guarantee */
+  long borrowed_ms;           /* Run past its guarantee, over all windows */
+  long lent_ms;               /* Of its unused guarantee, run by borrowers */
   int pending_drop;           /* DROP sent, awaiting LOCK_RELEASED */
   int drop_concurrency;       /* Concurrency snapshot when DROP_LOCK sent */
   long last_drop_sent_ms;     /* Last DROP_LOCK send timestamp (ms) */
+  int swap_prepared; /* PREPARE_SWAP_OUT/IN sent this hold, or this wait */
+  /* CLIENT_PROGRESS, in kernels per ms, see check_thrash() */
+  long progress_since_ms; /* Start of the next sample */
+  double solo_rate;       /* EWMA while running alone, 0 until known */
+  double corun_rate;      /* Last sample next to others */
+  long corun_ms;          /* When corun_rate came in, 0 = never */
   long quota_debt_ms;         /* Billed overage carried to next window (ms) */
+  struct timer_wheel_timer quota_timer; /* Fires when quota runs out */
+  /*
+   * Lease: once DROP_LOCK is sent, the client has config.lock_lease_ms to
+   * answer. Past that it is overdue, billed in full, and no longer keeps
+   * waiters out, see lease_timer_fn().
+   */
+  struct timer_wheel_timer lease_timer;
+  int lease_overdue;
+  unsigned long lease_overdue_count;
+  /* Socket buffers, see consume_rx() and send_message() */
+  struct message rx_msg; /* Message being received */
+  size_t rx_len;
+  char* tx_buf; /* Queued messages */
+  size_t tx_len, tx_cap;
+  size_t tx_head;  /* epoll: bytes of tx_buf already written */
+  int tx_blocked;  /* epoll: socket full, waiting for EPOLLOUT */
+  int tx_queued;   /* epoll: on context->tx_pending */
+  struct xpushare_client *tx_prev, *tx_next;
+  char* tx_out; /* io_uring: the send in flight */
+  size_t tx_out_len, tx_out_cap, tx_out_sent;
+  /*
+   * Requests in flight and loops in the middle of handling the client. A
+   * deleted client is freed when this drops to zero.
+   */
+  int refs;
+  int dead;
 };
 
 static int send_update_limit(struct xpushare_client* client, size_t new_limit);
 static int send_update_core_limit(struct xpushare_client* client,
                                   int new_core_limit);
+static void queue_limits_lookup(struct xpushare_client* client);
 static long current_time_ms(void);
 
 struct gpu_context* gpu_contexts = NULL;
 
-/* Holds the requests for the GPU lock, which we serve in an FCFS manner */
-struct xpushare_request {
-  struct xpushare_client* client;
-  struct xpushare_request* next;
-};
+/* Registered clients, hashed by id. Protected by global_mutex. */
+#define CLIENT_TABLE_SIZE 1024 /* Power of two */
+static struct xpushare_client* client_table[CLIENT_TABLE_SIZE];
+
+/* Client ids are random, so the low bits make a fine hash */
+static struct xpushare_client** client_table_bucket(uint64_t id) {
+  return &client_table[id & (CLIENT_TABLE_SIZE - 1)];
+}
+
+static struct xpushare_client* client_table_find(uint64_t id) {
+  struct xpushare_client* c;
+
+  for (c = *client_table_bucket(id); c != NULL; c = c->hnext)
+    if (c->id == id) return c;
+  return NULL;
+}
 
-struct xpushare_client* clients = NULL;
-/* requests is now per-context */
+static void client_table_insert(struct xpushare_client* client) {
+  struct xpushare_client** bucket = client_table_bucket(client->id);
 
-struct xpushare_request* requests = NULL;
-/* requests is now per-context */
+  client->hnext = *bucket;
+  *bucket = client;
+}
+
+static void client_table_remove(struct xpushare_client* client) {
+  struct xpushare_client** pp;
+
+  for (pp = client_table_bucket(client->id); *pp != NULL; pp = &(*pp)->hnext) {
+    if (*pp == client) {
+      *pp = client->hnext;
+      client->hnext = NULL;
+      return;
+    }
+  }
+}
 
-void* timer_thr_fn(void* arg);
+void* gpu_loop_fn(void* arg);
+static void tq_timer_fn(struct timer_wheel_timer* timer);
+static void window_timer_fn(struct timer_wheel_timer* timer);
+static void quota_timer_fn(struct timer_wheel_timer* timer);
+static void lease_timer_fn(struct timer_wheel_timer* timer);
+static void share_timer_fn(struct timer_wheel_timer* timer);
+static void deadline_timer_fn(struct timer_wheel_timer* timer);
+static void pace_timer_fn(struct timer_wheel_timer* timer);
+static void prepare_timer_fn(struct timer_wheel_timer* timer);
+static long warmup_ms(struct gpu_context* ctx, struct xpushare_client* c);
+static void recovery_timer_fn(struct timer_wheel_timer* timer);
+static void thrash_timer_fn(struct timer_wheel_timer* timer);
+static void check_overload_recovery(struct gpu_context* ctx);
+static size_t demanded_memory(struct gpu_context* ctx);
+static size_t resident_memory(const struct xpushare_client* c);
+static int within_guarantee(struct gpu_context* ctx,
+                            struct xpushare_client* c);
+static void arm_tq_timer(struct gpu_context* ctx);
+static void arm_prepare_timer(struct gpu_context* ctx);
+static long tq_length_ms(struct gpu_context* ctx);
+static void arm_window_timer(struct gpu_context* ctx);
+static void rearm_quota_timers(struct gpu_context* ctx);
+static void arm_share_timers(struct gpu_context* ctx);
+static void arm_deadline_timer(struct gpu_context* ctx);
+static long drr_quantum(struct gpu_context* ctx);
+static void mlfq_request(struct xpushare_client* c);
+static void mlfq_feedback(struct xpushare_client* c);
+static void mlfq_boost(struct gpu_context* ctx);
 static void refresh_context_total_memory(struct gpu_context* ctx);
 
 static int parse_gpu_index_token(const char* token, int* out_index) {
@@ -388,8 +878,93 @@ static void refresh_context_total_memory(struct gpu_context* ctx) {
   }
 }
 
+/*
+ * Device memory held by the clients of a GPU outside of memory_allocated:
+ * CUDA context, library workspaces and other non-pageable memory. NVML does
+ * not count managed memory against processes, so what it reports for the
+ * process of a client (matched by host_pid) is exactly that. Clients it has
+ * not reported yet are assumed to need the mean of those it has, learned in
+ * ctx->process_overhead. Everyone counts, running or not: this memory stays
+ * on the GPU across switches.
+ *
+ * The sum is cached in ctx->unmanaged and only recomputed once per NVML
+ * sample or when a client attaches or detaches, so the admission loops can
+ * call this freely.
+ *
+ * Must be called with ctx->lock held.
+ */
+static size_t unmanaged_memory(struct gpu_context* ctx) {
+  struct xpushare_client* c;
+  size_t measured = 0;
+  int n_measured = 0, n_unmeasured = 0;
+  unsigned long generation =
+      __atomic_load_n(&g_nvml_snapshot.generation, __ATOMIC_ACQUIRE);
+
+  if (!ctx->unmanaged_stale && ctx->nvml_generation == generation) {
+    return ctx->unmanaged;
+  }
+
+  if (ctx->nvml_generation != generation) {
+    pthread_rwlock_rdlock(&g_nvml_snapshot.lock);
+    for (int i = 0; i < g_nvml_snapshot.gpu_count; i++) {
+      struct nvml_gpu_snapshot* snap = &g_nvml_snapshot.gpus[i];
+      if (!snap->valid || !uuid_matches_gpu_snapshot(ctx->uuid, snap)) {
+        continue;
+      }
+
+      DL_FOREACH2(ctx->clients, c, ctx_next) {
+        if (c->host_pid <= 0) continue;
+        for (int p = 0; p < snap->process_count; p++) {
+          if (snap->processes[p].pid == c->host_pid) {
+            c->nvml_used = snap->processes[p].used_memory;
+            break;
+          }
+        }
+      }
+      break;
+    }
+    generation = g_nvml_snapshot.generation;
+    pthread_rwlock_unlock(&g_nvml_snapshot.lock);
+    ctx->nvml_generation = generation;
+  }
+
+  DL_FOREACH2(ctx->clients, c, ctx_next) {
+    if (c->nvml_used > 0) {
+      measured += c->nvml_used;
+      n_measured++;
+    } else {
+      n_unmeasured++;
+    }
+  }
+  if (n_measured > 0) ctx->process_overhead = measured / n_measured;
+  ctx->unmanaged = measured + (size_t)n_unmeasured * ctx->process_overhead;
+  ctx->unmanaged_stale = 0;
+  return ctx->unmanaged;
+}
+
+/*
+ * What the running set may use: the total minus the reserve and the memory
+ * nobody accounts for in memory_allocated.
+ *
+ * Must be called with ctx->lock held.
+ */
+static size_t safe_memory_limit(struct gpu_context* ctx) {
+  size_t safe_limit =
+      ctx->total_memory * (100 - config.memory_reserve_percent) / 100;
+  size_t unmanaged = unmanaged_memory(ctx);
+
+  return unmanaged < safe_limit ? safe_limit - unmanaged : 0;
+}
+
+/*
+ * Look up the context of a GPU, creating it (and its event loop thread) on
+ * first use. Contexts are never freed.
+ *
+ * Must be called with global_mutex held.
+ */
 static struct gpu_context* get_or_create_gpu_context(const char* uuid) {
   struct gpu_context* ctx;
+  struct epoll_event event;
   LL_FOREACH(gpu_contexts, ctx) {
     if (strncmp(ctx->uuid, uuid, XPUSHARE_GPU_UUID_LEN) == 0) return ctx;
   }
@@ -397,28 +972,98 @@ static struct gpu_context* get_or_create_gpu_context(const char* uuid) {
   /* Create new context */
   true_or_exit(ctx = malloc(sizeof(*ctx)));
   strlcpy(ctx->uuid, uuid, XPUSHARE_GPU_UUID_LEN);
-  ctx->requests = NULL;
-  ctx->running_list = NULL;
+  true_or_exit(pthread_mutex_init(&ctx->lock, NULL) == 0);
+  ctx->epoll_fd = -1;
+  ctx->dispatching = 0;
+  ctx->tx_pending = NULL;
+  if (config.io_engine == IO_ENGINE_URING) {
+    true_or_exit(uring_init(&ctx->ring, URING_ENTRIES) == 0);
+    true_or_exit(uring_setup_buffers(&ctx->ring, 0, URING_NR_BUFS,
+                                     URING_BUF_SIZE) == 0);
+  } else {
+    true_or_exit((ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) >= 0);
+  }
+  ctx->clients = NULL;
+  for (int q = 0; q < NR_QUEUES; q++) {
+    ctx->queues[q] = NULL;
+    ctx->queue_len[q] = 0;
+  }
+  ctx->quota_sum = 0;
+  ctx->nr_running_limited = 0;
+  ctx->nr_overdue = 0;
   ctx->lock_held = 0;
-  ctx->must_reset_timer = 0;
   ctx->next = NULL;
   /* Initialize memory-aware scheduling fields */
   ctx->total_memory = config.default_gpu_memory;
   ctx->available_memory = ctx->total_memory;
   ctx->running_memory_usage = 0;
   ctx->peak_memory_usage = 0;
+  ctx->process_overhead = 0;
+  ctx->unmanaged = 0;
+  ctx->nvml_generation = 0;
+  ctx->unmanaged_stale = 1;
   ctx->memory_overloaded = 0;
-  ctx->wait_queue = NULL;
-  true_or_exit(pthread_cond_init(&ctx->timer_cv, NULL) == 0);
-  true_or_exit(pthread_cond_init(&ctx->sched_cv, NULL) == 0);
+  ctx->overload_low_since_ms = 0;
+  ctx->overload_enter_count = 0;
+  ctx->overload_exit_count = 0;
+  ctx->overload_victim_count = 0;
+  ctx->running_changed_ms = 0;
+  ctx->thrashing = 0;
+  ctx->thrash_probing = 0;
+  ctx->thrash_backoff_ms = config.thrash_probe_ms;
+  ctx->corun_progress = -1;
+  ctx->thrash_enter_count = 0;
+  ctx->thrash_exit_count = 0;
+  ctx->req_seq = 0;
+  ctx->drr_vtime = 0;
+  ctx->mlfq_boost_ms = 0;
+  ctx->tq_start_ms = 0;
+  ctx->backfill_count = 0;
+  ctx->host_mem_defer_count = 0;
+  ctx->priority_preempt_count = 0;
+  ctx->deadline_preempt_count = 0;
+  ctx->drop_release_ewma_ms = 0;
 
   /* Initialize quota window */
   ctx->window_start_ms = 0;
 
-  /* Spawn timer thread for this context */
-  true_or_exit(pthread_create(&ctx->timer_tid, NULL, timer_thr_fn, ctx) == 0);
+  ctx->last_drain_ms = -1;
+  ctx->ns_shares = NULL;
+  ctx->ns_shares_cap = 0;
+  ctx->cost_n = ctx->cost_sx = ctx->cost_sy = 0;
+  ctx->cost_sxx = ctx->cost_sxy = 0;
+  ctx->switch_cost_total_ms = 0;
+  ctx->admit_after_ms = 0;
+  ctx->paced_count = 0;
+  ctx->prepared_count = 0;
+
+  /* Timers, driven by the event loop through a monotonic timerfd */
+  timer_wheel_init(&ctx->timers, (uint64_t)current_time_ms());
+  timer_wheel_timer_init(&ctx->tq_timer, tq_timer_fn, ctx);
+  timer_wheel_timer_init(&ctx->window_timer, window_timer_fn, ctx);
+  timer_wheel_timer_init(&ctx->recovery_timer, recovery_timer_fn, ctx);
+  timer_wheel_timer_init(&ctx->thrash_timer, thrash_timer_fn, ctx);
+  timer_wheel_timer_init(&ctx->deadline_timer, deadline_timer_fn, ctx);
+  timer_wheel_timer_init(&ctx->pace_timer, pace_timer_fn, ctx);
+  timer_wheel_timer_init(&ctx->prepare_timer, prepare_timer_fn, ctx);
+  true_or_exit((ctx->timer_fd = timerfd_create(
+                    CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) >= 0);
+  ctx->timer_fd_expiry = TIMER_WHEEL_NEVER;
+  if (config.io_engine == IO_ENGINE_URING) {
+    uring_prep_read(&ctx->ring, ctx->timer_fd, &ctx->timer_expirations,
+                    sizeof(ctx->timer_expirations), IO_DATA(ctx, IO_OP_TIMER));
+  } else {
+    event.data.ptr = ctx;
+    event.events = EPOLLIN;
+    true_or_exit(
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->timer_fd, &event) == 0);
+  }
+
   refresh_context_total_memory(ctx);
 
+  /* Spawn the event loop thread for this context */
+  true_or_exit(pthread_create(&ctx->loop_tid, NULL, gpu_loop_fn, ctx) == 0);
+
   LL_APPEND(gpu_contexts, ctx);
   log_info("Created new GPU context for UUID %s (memory: %zu MB)", uuid,
            ctx->total_memory / (1024 * 1024));
@@ -427,8 +1072,6 @@ static struct gpu_context* get_or_create_gpu_context(const char* uuid) {
 
 static void bcast_status(void);
 static int send_message(struct xpushare_client* client, struct message* msg_p);
-static int receive_message(struct xpushare_client* client,
-                           struct message* msg_p);
 static void try_schedule(struct gpu_context* ctx);
 static int register_client(struct xpushare_client* client,
                            const struct message* in_msg);
@@ -453,191 +1096,904 @@ static void client_id_as_string(char* buf, size_t buflen, uint64_t id) {
     snprintf(buf, buflen, "%016" PRIx64, id);
 }
 
-static void delete_client(struct xpushare_client* client) {
-  int cfd = client->fd;
-  char id_str[HEX_STR_LEN(client->id)];
-  struct xpushare_client *tmp, *c;
+/* Where its peak memory is kept, see peak_store.h */
+static void client_workload_key(const struct xpushare_client* client,
+                                char key[PEAK_STORE_KEY_LEN]) {
+  peak_store_workload_key(client->pod_namespace, client->pod_name, key,
+                          PEAK_STORE_KEY_LEN);
+}
 
-  client_id_as_string(id_str, sizeof(id_str), client->id);
-  log_info("Removing client %s", id_str);
-  metrics_inc_client_disconnect();
-  remove_req(client);
+#define PEAK_STORE_SYNC_INTERVAL_SEC 10
 
-  /* Remove from clients list */
-  LL_FOREACH_SAFE(clients, c, tmp) {
-    if (c->fd == client->fd) {
-      LL_DELETE(clients, c);
-      free(c);
+/*
+ * Writes the peak store back every PEAK_STORE_SYNC_INTERVAL_SEC, off the
+ * event loops, and a last time on SIGTERM or SIGINT. Those are blocked in
+ * every thread (see main()), so this one receives them.
+ */
+static void* peak_store_sync_thread_fn(void* arg) {
+  sigset_t* signals = arg;
+  struct timespec interval = {.tv_sec = PEAK_STORE_SYNC_INTERVAL_SEC};
+  int sig;
+
+  for (;;) {
+    sig = sigtimedwait(signals, NULL, &interval);
+    peak_store_sync();
+    if (sig > 0) {
+      log_info("Received signal %d, peak store written, exiting", sig);
+      exit(EXIT_SUCCESS);
     }
   }
-
-  true_or_exit(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, cfd, NULL) == 0);
-  /* See man close(2) for EINTR behavior on Linux */
-  if (close(cfd) < 0 && errno != EINTR)
-    log_fatal_errno("Failed to close FD %d", cfd);
+  return NULL;
 }
 
-static void insert_req(struct xpushare_client* client) {
-  struct xpushare_request* r;
-  struct gpu_context* ctx = client->context;
-  if (!ctx) return;
+/* Program the timerfd of a GPU for an absolute CLOCK_MONOTONIC time (ms) */
+static void set_timer_fd(struct gpu_context* ctx, uint64_t expires_ms) {
+  struct itimerspec its = {0};
 
-  LL_FOREACH(ctx->requests, r) {
-    if (r->client->fd == client->fd) {
-      log_warn("Client %016" PRIx64
-               " has already requested"
-               " the lock",
-               r->client->id);
-      return;
-    }
+  if (expires_ms != TIMER_WHEEL_NEVER) {
+    its.it_value.tv_sec = expires_ms / 1000;
+    its.it_value.tv_nsec = (expires_ms % 1000) * 1000000;
   }
-  true_or_exit(r = malloc(sizeof *r));
-  r->next = NULL;
-  r->client = client;
-  LL_APPEND(ctx->requests, r);
+  true_or_exit(timerfd_settime(ctx->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) ==
+               0);
+  ctx->timer_fd_expiry = expires_ms;
 }
 
-static int can_run(struct gpu_context* ctx, struct xpushare_client* client);
-static void check_wait_queue(struct gpu_context* ctx);
-
-static void remove_req(struct xpushare_client* client) {
-  struct xpushare_request *tmp, *r;
-  struct gpu_context* ctx = client->context;
-  int removed_from_running = 0;
-  if (!ctx) return;
+/*
+ * Arm one of the timers of a GPU. The timerfd is only moved earlier here;
+ * the event loop re-syncs it with the wheel whenever it fires.
+ *
+ * Must be called with ctx->lock held.
+ */
+static void arm_timer(struct gpu_context* ctx, struct timer_wheel_timer* timer,
+                      long expires_ms) {
+  timer_wheel_add(&ctx->timers, timer, (uint64_t)expires_ms);
+  if ((uint64_t)expires_ms < ctx->timer_fd_expiry)
+    set_timer_fd(ctx, (uint64_t)expires_ms);
+}
 
-  /* Check if this client is in the running_list */
-  LL_FOREACH_SAFE(ctx->running_list, r, tmp) {
-    if (r->client->fd == client->fd) {
-      /* Always update memory tracking when removing from running_list */
-      size_t mem_to_free = client->memory_allocated;
-      if (ctx->running_memory_usage >= mem_to_free) {
-        ctx->running_memory_usage -= mem_to_free;
-      } else {
-        log_warn("Memory accounting mismatch: running=%zu, freeing=%zu",
-                 ctx->running_memory_usage, mem_to_free);
-        ctx->running_memory_usage = 0;
-      }
+/*
+ * Whether a gets the lock before b. Higher priority classes go first, then
+ * earliest deadline: clients with a lock wait SLO before those without. Then
+ * the queue policy decides. FCFS goes by arrival. DRR goes by deficit, the
+ * lock time a client is owed: ctx->drr_vtime - drr_pass, so the largest
+ * deficit is the smallest pass, arrival breaking ties. MLFQ goes by level,
+ * then arrival. SJF goes by predicted hold, aged by the time spent waiting:
+ * burst_est_ms - waited / factor. Between two waiters the current time
+ * cancels out, leaving the fixed sjf_key = requested_ms + factor *
+ * burst_est_ms. A waiter is passed by at most those predicted to be shorter
+ * by more than its wait / factor, so nobody starves.
+ */
+static int queued_before(const struct xpushare_client* a,
+                         const struct xpushare_client* b) {
+  if (a->priority != b->priority) return a->priority > b->priority;
+  if (a->deadline_ms != b->deadline_ms) return a->deadline_ms < b->deadline_ms;
+  if (config.queue_policy == QUEUE_POLICY_DRR && a->drr_pass != b->drr_pass)
+    return a->drr_pass < b->drr_pass;
+  if (config.queue_policy == QUEUE_POLICY_MLFQ && a->mlfq_level != b->mlfq_level)
+    return a->mlfq_level < b->mlfq_level;
+  if (config.queue_policy == QUEUE_POLICY_SJF && a->sjf_key != b->sjf_key)
+    return a->sjf_key < b->sjf_key;
+  return a->req_seq < b->req_seq;
+}
 
-      /* Update compute usage */
-      long now_ms = current_time_ms();
-      accrue_running_usage(ctx, now_ms, client);
-      long duration = now_ms - client->current_run_start_ms;
-      if (duration > 0) {
-        long billed_duration;
+/*
+ * The compute share a client is guaranteed: its request, if below its limit.
+ * Between the two it only runs on capacity nobody else is owed.
+ */
+static int core_guarantee(const struct xpushare_client* c) {
+  if (c->core_request > 0 && c->core_request < c->core_limit)
+    return c->core_request;
+  return c->core_limit;
+}
 
-        if (client->pending_drop) {
-          int drop_n =
-              client->drop_concurrency > 0 ? client->drop_concurrency : 1;
-          long raw_billed = duration / drop_n;
-          billed_duration = raw_billed * config.drop_tail_billing_percent / 100;
-          log_debug("Drop-tail billing: client %016" PRIx64
-                    " wall %ld ms / %d = %ld ms raw, ratio=%d%%, billed=%ld ms",
-                    client->id, duration, drop_n, raw_billed,
-                    config.drop_tail_billing_percent, billed_duration);
-        } else {
-          int n_running = count_running_clients(ctx);
-          billed_duration = duration / n_running;
-          log_debug(
-              "Weighted billing: wall %ld ms / %d concurrent = %ld ms billed",
-              duration, n_running, billed_duration);
-        }
+/*
+ * Namespace weights, cached so that the clients of a namespace cost one API
+ * request per ANNOTATION_CHECK_INTERVAL_SEC between them. Never freed, there
+ * are only so many namespaces.
+ */
+struct namespace_weight {
+  char ns[POD_NAMESPACE_LEN_MAX];
+  int weight;
+  time_t fetched;
+  struct namespace_weight* next;
+};
 
-        client->run_time_in_window_ms += billed_duration;
-      }
+static pthread_mutex_t namespace_weights_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct namespace_weight* namespace_weights = NULL;
 
-      if (client->last_drop_sent_ms > 0) {
-        log_debug("drop_to_release latency for client %016" PRIx64 " is %ld ms",
-                  client->id, now_ms - client->last_drop_sent_ms);
-        client->last_drop_sent_ms = 0;
-      }
+/* Must be called with namespace_weights_mutex held */
+static struct namespace_weight* find_namespace_weight(const char* ns) {
+  struct namespace_weight* w;
 
-      client->pending_drop = 0;
-      client->drop_concurrency = 1;
-      client->is_running = 0;
-      log_info("Client %016" PRIx64
-               " released from running_list (ran for %ld ms). Mem: %zu MB",
-               client->id, duration, ctx->running_memory_usage / (1024 * 1024));
-      LL_DELETE(ctx->running_list, r);
-      free(r);
-      removed_from_running = 1;
-      break;
-    }
+  LL_FOREACH(namespace_weights, w) {
+    if (strcmp(w->ns, ns) == 0) return w;
   }
+  return NULL;
+}
 
-  if (removed_from_running) {
-    /* Running set changed; wake timer to re-sample concurrency immediately. */
-    pthread_cond_broadcast(&ctx->timer_cv);
-  }
+struct namespace_share {
+  const char* ns;
+  int weight;
+  int demand;   /* Sum of the guarantees of its quota-limited clients */
+  int entitled; /* Its part of the GPU, in percent, -1 until settled */
+};
 
-  /* Update lock_held based on whether any tasks are still running */
-  if (ctx->running_list == NULL) {
-    ctx->lock_held = 0;
-    /* Check if we can schedule waiting processes */
-    check_wait_queue(ctx);
-    try_schedule(ctx);
+/*
+ * Two-level quotas: a GPU is divided among namespaces by weight, and the part
+ * of a namespace among its clients by their guarantee. A namespace asking for
+ * less than its part gets what it asks, the rest goes to the others by weight
+ * (water-filling). Guarantees are only scaled down within a namespace that
+ * asks for more than its part, see get_effective_quota_ms().
+ *
+ * Weights come from the namespace cache, see lookup_namespace_weight(). Call
+ * whenever the guarantees, weights or clients of a GPU change, with ctx->lock
+ * held.
+ */
+static void update_namespace_shares(struct gpu_context* ctx) {
+  struct namespace_share* shares;
+  struct namespace_share* share;
+  struct xpushare_client* c;
+  int n = 0, nr_clients, capacity = 100, weights = 0, settled;
+
+  DL_COUNT2(ctx->clients, c, nr_clients, ctx_next);
+  if (nr_clients == 0) return;
+  /* Kept across calls, it only grows with the number of clients */
+  if (nr_clients > ctx->ns_shares_cap) {
+    true_or_exit(ctx->ns_shares = realloc(
+                     ctx->ns_shares, nr_clients * sizeof(*ctx->ns_shares)));
+    ctx->ns_shares_cap = nr_clients;
   }
-
-  /* Remove from requests list (pending requests) */
-  LL_FOREACH_SAFE(ctx->requests, r, tmp) {
-    if (r->client->fd == client->fd) {
-      LL_DELETE(ctx->requests, r);
-      free(r);
+  shares = ctx->ns_shares;
+
+  true_or_exit(pthread_mutex_lock(&namespace_weights_mutex) == 0);
+  DL_FOREACH2(ctx->clients, c, ctx_next) {
+    if (core_guarantee(c) >= 100) continue;
+    for (share = shares; share < shares + n; share++)
+      if (strcmp(share->ns, c->pod_namespace) == 0) break;
+    if (share == shares + n) {
+      struct namespace_weight* w = find_namespace_weight(c->pod_namespace);
+
+      share->ns = c->pod_namespace;
+      share->weight = w != NULL ? w->weight : 1;
+      share->demand = 0;
+      share->entitled = -1;
+      weights += share->weight;
+      n++;
     }
+    share->demand += core_guarantee(c);
   }
-
-  /* Also remove from wait_queue if present */
-  LL_FOREACH_SAFE(ctx->wait_queue, r, tmp) {
-    if (r->client->fd == client->fd) {
-      log_info("Removing client %016" PRIx64 " from wait queue", client->id);
-      LL_DELETE(ctx->wait_queue, r);
-      free(r);
+  true_or_exit(pthread_mutex_unlock(&namespace_weights_mutex) == 0);
+
+  /* Settle those asking for less than their part until none is left */
+  do {
+    settled = 0;
+    for (share = shares; share < shares + n; share++) {
+      if (share->entitled >= 0 ||
+          share->demand * weights > capacity * share->weight)
+        continue;
+      share->entitled = share->demand;
+      capacity -= share->demand;
+      weights -= share->weight;
+      settled = 1;
     }
+  } while (settled && weights > 0);
+  for (share = shares; share < shares + n; share++)
+    if (share->entitled < 0)
+      share->entitled = capacity * share->weight / weights;
+
+  DL_FOREACH2(ctx->clients, c, ctx_next) {
+    c->ns_demand = c->ns_entitled = 0;
+    if (core_guarantee(c) >= 100) continue;
+    share = shares;
+    while (strcmp(share->ns, c->pod_namespace) != 0) share++;
+    c->ns_demand = share->demand;
+    c->ns_entitled = share->entitled;
   }
 }
 
 /*
- * Force preemption of all running tasks on this GPU.
- * Called when memory overload is detected to fall back to serial mode.
+ * Move a client to one of its GPU's lock queues, or out of all of them with
+ * QUEUE_NONE. The requests and wait queues are kept in queued_before() order,
+ * the running queue in the order clients got the lock.
+ *
+ * Must be called with ctx->lock held.
  */
-static void force_preemption(struct gpu_context* ctx) {
-  struct xpushare_request *r, *tmp;
-  struct message msg = {0};
-  msg.type = DROP_LOCK;
-
-  log_warn(
-      "Forcing preemption on GPU %s due to memory overload (running: %zu MB, "
-      "limit: %zu MB)",
-      ctx->uuid, ctx->running_memory_usage / (1024 * 1024),
-      ctx->total_memory * (100 - config.memory_reserve_percent) / 100 /
-          (1024 * 1024));
-
-  LL_FOREACH_SAFE(ctx->running_list, r, tmp) {
-    if (send_message(r->client, &msg) >= 0) {
-      r->client->last_drop_sent_ms = current_time_ms();
-      metrics_inc_drop_lock();
-      log_info("Sent DROP_LOCK to client %016" PRIx64
-               " for fallback to serial mode",
-               r->client->id);
+static void queue_move(struct xpushare_client* client,
+                       enum client_queue queue) {
+  struct gpu_context* ctx = client->context;
+  struct xpushare_client* next;
+
+  /* Progress samples taken across this don't tell co-running from solo */
+  if ((client->queue == QUEUE_RUNNING) != (queue == QUEUE_RUNNING))
+    ctx->running_changed_ms = current_time_ms();
+
+  if (client->queue != QUEUE_NONE) {
+    DL_DELETE2(ctx->queues[client->queue], client, q_prev, q_next);
+    ctx->queue_len[client->queue]--;
+    if (client->queue == QUEUE_RUNNING) {
+      if (core_guarantee(client) < 100) ctx->nr_running_limited--;
+      if (client->lease_overdue) ctx->nr_overdue--;
+      client->lease_overdue = 0;
+      timer_wheel_del(&ctx->timers, &client->quota_timer);
+      timer_wheel_del(&ctx->timers, &client->lease_timer);
+      timer_wheel_del(&ctx->timers, &client->share_timer);
     }
   }
-}
 
-/* Check if client can run with current memory usage and scheduling mode */
-static int can_run_with_memory(struct gpu_context* ctx,
-                               struct xpushare_client* client) {
-  refresh_context_total_memory(ctx);
-  size_t safe_limit =
-      ctx->total_memory * (100 - config.memory_reserve_percent) / 100;
+  client->queue = queue;
+  if (queue == QUEUE_NONE) return;
 
-  /* If memory overload was detected, fall back to serial mode */
-  if (ctx->memory_overloaded) {
-    if (ctx->lock_held) {
-      log_debug("Overload fallback: GPU %s using serial mode", ctx->uuid);
-      return 0;
+  ctx->queue_len[queue]++;
+  if (queue == QUEUE_RUNNING) {
+    DL_APPEND2(ctx->queues[queue], client, q_prev, q_next);
+    if (core_guarantee(client) < 100) ctx->nr_running_limited++;
+    return;
+  }
+  DL_FOREACH2(ctx->queues[queue], next, q_next) {
+    if (queued_before(client, next)) {
+      DL_PREPEND_ELEM2(ctx->queues[queue], next, client, q_prev, q_next);
+      return;
     }
-    /* Allow task to start if no one is running (serial behavior) */
-    return 1;
+  }
+  DL_APPEND2(ctx->queues[queue], client, q_prev, q_next);
+}
+
+/* Add a client to its GPU's client list. ctx->lock must be held. */
+static void attach_client(struct xpushare_client* client) {
+  struct gpu_context* ctx = client->context;
+
+  DL_APPEND2(ctx->clients, client, ctx_prev, ctx_next);
+  ctx->unmanaged_stale = 1;
+  if (core_guarantee(client) < 100) {
+    ctx->quota_sum += core_guarantee(client);
+    update_namespace_shares(ctx);
+    /* Effective quotas of the running clients shrink */
+    arm_window_timer(ctx);
+    rearm_quota_timers(ctx);
+  }
+}
+
+/* Undo attach_client(), for a client no longer in any queue */
+static void detach_client(struct xpushare_client* client) {
+  struct gpu_context* ctx = client->context;
+
+  DL_DELETE2(ctx->clients, client, ctx_prev, ctx_next);
+  ctx->unmanaged_stale = 1;
+  if (core_guarantee(client) < 100) {
+    ctx->quota_sum -= core_guarantee(client);
+    update_namespace_shares(ctx);
+    rearm_quota_timers(ctx);
+  }
+  /* Its memory no longer counts against the overload */
+  check_overload_recovery(ctx);
+}
+
+/*
+ * Change the compute request and limit of an attached client. ctx->lock must
+ * be held.
+ */
+static void set_core_limit(struct xpushare_client* client, int core_request,
+                           int core_limit) {
+  struct gpu_context* ctx = client->context;
+  int old_guarantee = core_guarantee(client);
+  int was_limited = old_guarantee < 100;
+  int limited;
+
+  client->core_request = core_request;
+  client->core_limit = core_limit;
+  limited = core_guarantee(client) < 100;
+  if (was_limited) ctx->quota_sum -= old_guarantee;
+  if (limited) ctx->quota_sum += core_guarantee(client);
+  if (client->queue == QUEUE_RUNNING)
+    ctx->nr_running_limited += limited - was_limited;
+  update_namespace_shares(ctx);
+  arm_window_timer(ctx);
+  rearm_quota_timers(ctx);
+}
+
+/* Change the namespace weight of an attached client. ctx->lock must be held. */
+static void set_namespace_weight(struct xpushare_client* client, int weight) {
+  client->ns_weight = weight;
+  update_namespace_shares(client->context);
+  rearm_quota_timers(client->context);
+}
+
+/* Close the connection of a client and free it */
+static void free_client(struct xpushare_client* client) {
+  /* See man close(2) for EINTR behavior on Linux */
+  if (close(client->fd) < 0 && errno != EINTR)
+    log_fatal_errno("Failed to close FD %d", client->fd);
+  free(client->tx_buf);
+  free(client->tx_out);
+  free(client);
+}
+
+/* Drop a reference taken on a client, see struct xpushare_client */
+static void put_client(struct xpushare_client* client) {
+  if (--client->refs == 0 && client->dead) free_client(client);
+}
+
+/*
+ * Remove a client and close its connection.
+ *
+ * Only the thread that owns the client's socket may call this: the GPU event
+ * loop (with ctx->lock held) for registered clients, the control loop for
+ * the rest. Other threads shut the socket down instead and let the owner
+ * notice the hangup.
+ */
+static void delete_client(struct xpushare_client* client) {
+  int cfd = client->fd;
+  int owner_epoll_fd = client->context ? client->context->epoll_fd : epoll_fd;
+  char id_str[HEX_STR_LEN(client->id)];
+
+  client_id_as_string(id_str, sizeof(id_str), client->id);
+  log_info("Removing client %s", id_str);
+  metrics_inc_client_disconnect();
+  if (client->context) {
+    remove_req(client);
+    detach_client(client);
+  }
+  if (has_registered(client)) {
+    char workload[PEAK_STORE_KEY_LEN];
+
+    true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
+    client_table_remove(client);
+    true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
+
+    /* Its run is over, remember how much it needed */
+    client_workload_key(client, workload);
+    peak_store_record(workload, client->peak_allocated);
+  }
+
+  if (client->tx_queued) {
+    DL_DELETE2(client->context->tx_pending, client, tx_prev, tx_next);
+    client->tx_queued = 0;
+  }
+
+  if (config.io_engine == IO_ENGINE_URING) {
+    /*
+     * Requests in flight still point at the client. Shutting the socket down
+     * completes them.
+     */
+    shutdown(cfd, SHUT_RDWR);
+  } else {
+    true_or_exit(epoll_ctl(owner_epoll_fd, EPOLL_CTL_DEL, cfd, NULL) == 0);
+  }
+
+  /* Whoever holds the last reference frees it */
+  client->dead = 1;
+  if (client->refs == 0) free_client(client);
+}
+
+/*
+ * Ask a running client to give the lock back, and start its lease: if
+ * LOCK_RELEASED does not come within config.lock_lease_ms, lease_timer_fn()
+ * stops waiting for it. A repeated DROP_LOCK does not extend the lease.
+ *
+ * Must be called with ctx->lock held.
+ */
+static int send_drop_lock(struct xpushare_client* c, long now_ms) {
+  struct gpu_context* ctx = c->context;
+  struct message drop_msg = {0};
+
+  drop_msg.id = 1337;
+  drop_msg.type = DROP_LOCK;
+  c->last_drop_sent_ms = now_ms;
+  if (send_message(c, &drop_msg) < 0) return -1;
+  metrics_inc_drop_lock();
+
+  if (config.lock_lease_ms > 0 && !c->lease_overdue &&
+      !timer_wheel_pending(&c->lease_timer))
+    arm_timer(ctx, &c->lease_timer, now_ms + config.lock_lease_ms);
+  return 0;
+}
+
+/* Preempt a running client: DROP_LOCK, and bill the tail as such */
+static void preempt_client(struct xpushare_client* c, long now_ms) {
+  int n_running = count_running_clients(c->context);
+
+  c->pending_drop = 1;
+  c->drop_concurrency = n_running > 0 ? n_running : 1;
+  timer_wheel_del(&c->context->timers, &c->quota_timer);
+  send_drop_lock(c, now_ms);
+}
+
+/* What the DROP->RELEASE tail of a run is billed, see remove_req() */
+static long drop_tail_billed(struct xpushare_client* client, long duration) {
+  int drop_n = client->drop_concurrency > 0 ? client->drop_concurrency : 1;
+  long raw_billed = duration / drop_n;
+  long billed = raw_billed * config.drop_tail_billing_percent / 100;
+
+  log_debug("Drop-tail billing: client %016" PRIx64
+            " wall %ld ms / %d = %ld ms raw, ratio=%d%%, billed=%ld ms",
+            client->id, duration, drop_n, raw_billed,
+            config.drop_tail_billing_percent, billed);
+  return billed;
+}
+
+static void insert_req(struct xpushare_client* client) {
+  struct gpu_context* ctx = client->context;
+  struct message msg = {0};
+  if (!ctx) return;
+
+  switch (client->queue) {
+    case QUEUE_NONE:
+      client->req_seq = ++ctx->req_seq;
+      client->requested_ms = current_time_ms();
+      client->deadline_ms = client->max_wait_ms > 0
+                                ? client->requested_ms + client->max_wait_ms
+                                : LONG_MAX;
+      if (config.queue_policy == QUEUE_POLICY_DRR) {
+        /* Time spent idle earns at most one quantum of deficit */
+        if (client->drr_pass < ctx->drr_vtime - drr_quantum(ctx))
+          client->drr_pass = ctx->drr_vtime - drr_quantum(ctx);
+      }
+      if (config.queue_policy == QUEUE_POLICY_MLFQ) mlfq_request(client);
+      client->sjf_key = client->requested_ms +
+                        (long)config.sjf_aging_factor * client->burst_est_ms;
+      client->swap_prepared = 0;
+      queue_move(client, QUEUE_REQUESTS);
+      if (config.queue_policy == QUEUE_POLICY_MLFQ && ctx->lock_held) {
+        /* It may cut the TQ of lower level holders short */
+        arm_timer(ctx, &ctx->tq_timer, ctx->tq_start_ms + tq_length_ms(ctx));
+      }
+      /* Past the prepare point already, the timer fires right away */
+      if (ctx->lock_held) arm_prepare_timer(ctx);
+      arm_share_timers(ctx);
+      arm_deadline_timer(ctx);
+      break;
+    case QUEUE_RUNNING:
+      /* It missed our LOCK_OK somehow; repeat it, nothing else changes */
+      log_warn("Client %016" PRIx64 " requested the lock while holding it",
+               client->id);
+      msg.type = LOCK_OK;
+      send_message(client, &msg);
+      break;
+    default:
+      log_warn("Client %016" PRIx64
+               " has already requested"
+               " the lock",
+               client->id);
+      break;
+  }
+}
+
+static int can_run(struct gpu_context* ctx, struct xpushare_client* client);
+static void check_wait_queue(struct gpu_context* ctx);
+
+static void remove_req(struct xpushare_client* client) {
+  struct gpu_context* ctx = client->context;
+  if (!ctx) return;
+
+  switch (client->queue) {
+    case QUEUE_REQUESTS:
+      queue_move(client, QUEUE_NONE);
+      break;
+    case QUEUE_WAIT:
+      log_info("Removing client %016" PRIx64 " from wait queue", client->id);
+      queue_move(client, QUEUE_NONE);
+      break;
+    case QUEUE_RUNNING: {
+      /* Always update memory tracking when removing from running_list */
+      size_t mem_to_free = client->memory_allocated;
+      if (ctx->running_memory_usage >= mem_to_free) {
+        ctx->running_memory_usage -= mem_to_free;
+      } else {
+        log_warn("Memory accounting mismatch: running=%zu, freeing=%zu",
+                 ctx->running_memory_usage, mem_to_free);
+        ctx->running_memory_usage = 0;
+      }
+
+      /* Update compute usage */
+      long now_ms = current_time_ms();
+      accrue_running_usage(ctx, now_ms, client);
+      client->last_hold_ms = now_ms - client->lock_granted_ms;
+      client->drr_pass += client->last_hold_ms * 100 / client->core_limit;
+      if (config.queue_policy == QUEUE_POLICY_MLFQ) mlfq_feedback(client);
+      /* Next burst predicted as half the last one, half the history */
+      if (client->burst_est_ms == 0)
+        client->burst_est_ms = client->last_hold_ms;
+      else
+        client->burst_est_ms = (client->burst_est_ms + client->last_hold_ms) / 2;
+      long duration = now_ms - client->current_run_start_ms;
+      if (duration > 0) {
+        long billed_duration;
+
+        if (client->lease_overdue) {
+          /* Past the lease nobody shares the blame, bill the wall time */
+          billed_duration = duration;
+          log_debug("Overdue billing: client %016" PRIx64 " billed %ld ms",
+                    client->id, billed_duration);
+        } else if (client->pending_drop) {
+          billed_duration = drop_tail_billed(client, duration);
+        } else {
+          int n_running = count_running_clients(ctx);
+          billed_duration = duration / n_running;
+          log_debug(
+              "Weighted billing: wall %ld ms / %d concurrent = %ld ms billed",
+              duration, n_running, billed_duration);
+        }
+
+        client->run_time_in_window_ms += billed_duration;
+      }
+
+      /* Only a switch if someone is waiting to take over */
+      ctx->last_drain_ms = ctx->queues[QUEUE_REQUESTS] != NULL ||
+                                   ctx->queues[QUEUE_WAIT] != NULL
+                               ? 0
+                               : -1;
+      if (client->last_drop_sent_ms > 0) {
+        log_debug("drop_to_release latency for client %016" PRIx64 " is %ld ms",
+                  client->id, now_ms - client->last_drop_sent_ms);
+        metrics_observe_drop_release(now_ms - client->last_drop_sent_ms);
+        ctx->drop_release_ewma_ms +=
+            (now_ms - client->last_drop_sent_ms - ctx->drop_release_ewma_ms) / 8;
+        if (ctx->last_drain_ms == 0)
+          ctx->last_drain_ms = now_ms - client->last_drop_sent_ms;
+        client->last_drop_sent_ms = 0;
+      }
+
+      client->pending_drop = 0;
+      client->drop_concurrency = 1;
+      client->borrowing = 0;
+      client->is_running = 0;
+      log_info("Client %016" PRIx64
+               " released from running_list (ran for %ld ms). Mem: %zu MB",
+               client->id, duration, ctx->running_memory_usage / (1024 * 1024));
+      queue_move(client, QUEUE_NONE);
+
+      /* Concurrency changed, so did everyone's quota deadline */
+      rearm_quota_timers(ctx);
+      break;
+    }
+    default: /* QUEUE_NONE */
+      break;
+  }
+
+  /* Update lock_held based on whether any tasks are still running */
+  if (ctx->queues[QUEUE_RUNNING] == NULL) {
+    ctx->lock_held = 0;
+    /* Check if we can schedule waiting processes */
+    check_wait_queue(ctx);
+    try_schedule(ctx);
+  } else if (ctx->nr_overdue == ctx->queue_len[QUEUE_RUNNING]) {
+    /* Only overdue holders left, they don't keep waiters out */
+    check_wait_queue(ctx);
+    try_schedule(ctx);
+  }
+  arm_share_timers(ctx);
+  arm_deadline_timer(ctx);
+}
+
+/*
+ * Bring the running set of a GPU back under its safe memory limit by
+ * preempting as few clients as possible, rather than all of them.
+ *
+ * The client whose growth crossed the limit goes if that alone is enough.
+ * Otherwise victims are picked greedily: the smallest client that covers the
+ * remaining excess (cheapest to swap out), or else the largest one. Clients
+ * already asked to drop the lock count as gone. The last runner is never
+ * preempted, it has the GPU to itself in serial mode anyway.
+ *
+ * Must be called with ctx->lock held.
+ */
+static void preempt_for_memory(struct gpu_context* ctx,
+                               struct xpushare_client* grown,
+                               size_t safe_limit) {
+  struct xpushare_client *c, *victim;
+  size_t staying_memory = 0;
+  size_t excess;
+  int staying = 0;
+
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+    if (c->last_drop_sent_ms > 0) continue;
+    staying_memory += resident_memory(c);
+    staying++;
+  }
+  if (staying_memory <= safe_limit) return;
+  excess = staying_memory - safe_limit;
+
+  while (excess > 0 && staying > 1) {
+    victim = NULL;
+    if (grown->queue == QUEUE_RUNNING && grown->last_drop_sent_ms == 0 &&
+        resident_memory(grown) >= excess) {
+      victim = grown;
+    } else {
+      DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+        if (c->last_drop_sent_ms > 0) continue;
+        if (victim == NULL) {
+          victim = c;
+        } else if ((resident_memory(c) >= excess) !=
+                   (resident_memory(victim) >= excess)) {
+          if (resident_memory(c) >= excess) victim = c;
+        } else if (resident_memory(c) >= excess
+                       ? resident_memory(c) < resident_memory(victim)
+                       : resident_memory(c) > resident_memory(victim)) {
+          victim = c;
+        }
+      }
+    }
+    if (victim == NULL || resident_memory(victim) == 0) break;
+
+    log_info("Preempting client %016" PRIx64
+             " (%zu MB) to relieve memory overload on GPU %s (%zu MB over)",
+             victim->id, resident_memory(victim) / (1024 * 1024), ctx->uuid,
+             excess / (1024 * 1024));
+    /* Marks it as leaving, even if the send fails */
+    send_drop_lock(victim, current_time_ms());
+    ctx->overload_victim_count++;
+    excess -= resident_memory(victim) < excess ? resident_memory(victim)
+                                               : excess;
+    staying--;
+  }
+}
+
+/*
+ * A waiting client does not wait behind holders of a lower priority class:
+ * they are all asked to drop the lock at once, whatever their TQ.
+ *
+ * Must be called with ctx->lock held.
+ */
+static void preempt_lower_classes(struct gpu_context* ctx,
+                                  struct xpushare_client* waiter) {
+  struct xpushare_client* c;
+  long now_ms = current_time_ms();
+
+  if (waiter->queue != QUEUE_REQUESTS && waiter->queue != QUEUE_WAIT) return;
+
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+    if (c->priority >= waiter->priority || c->last_drop_sent_ms > 0) continue;
+    log_info("Preempting %s client %016" PRIx64 " for %s client %016" PRIx64,
+             priority_class_names[c->priority], c->id,
+             priority_class_names[waiter->priority], waiter->id);
+    preempt_client(c, now_ms);
+    ctx->priority_preempt_count++;
+  }
+}
+
+/* Change the priority class of a client. ctx->lock must be held. */
+static void set_priority(struct xpushare_client* client,
+                         enum priority_class priority) {
+  client->priority = priority;
+  /* Re-queue it in its new place */
+  if (client->queue == QUEUE_REQUESTS || client->queue == QUEUE_WAIT) {
+    queue_move(client, client->queue);
+    preempt_lower_classes(client->context, client);
+  }
+}
+
+/* Change the lock wait SLO of a client. ctx->lock must be held. */
+static void set_max_wait(struct xpushare_client* client, long max_wait_ms) {
+  client->max_wait_ms = max_wait_ms;
+  if (client->queue == QUEUE_REQUESTS || client->queue == QUEUE_WAIT) {
+    client->deadline_ms =
+        max_wait_ms > 0 ? client->requested_ms + max_wait_ms : LONG_MAX;
+    queue_move(client, client->queue);
+    arm_deadline_timer(client->context);
+  }
+}
+
+/* The waiting client with the earliest lock wait deadline, or NULL */
+static struct xpushare_client* earliest_deadline(struct gpu_context* ctx) {
+  struct xpushare_client *c, *best = NULL;
+
+  /* Throttled clients could not take the lock anyway */
+  DL_FOREACH2(ctx->queues[QUEUE_REQUESTS], c, q_next) {
+    if (!c->is_throttled && c->deadline_ms != LONG_MAX &&
+        (!best || c->deadline_ms < best->deadline_ms))
+      best = c;
+  }
+  DL_FOREACH2(ctx->queues[QUEUE_WAIT], c, q_next) {
+    if (c->deadline_ms != LONG_MAX &&
+        (!best || c->deadline_ms < best->deadline_ms))
+      best = c;
+  }
+  return best;
+}
+
+/*
+ * EDF: a waiter with a lock wait SLO should get the lock by its deadline. The
+ * holders have to be asked early enough for their release to land in time,
+ * so deadline_timer fires that long before it, going by the recent
+ * DROP_LOCK -> LOCK_RELEASED latencies.
+ *
+ * Must be called with ctx->lock held.
+ */
+static void arm_deadline_timer(struct gpu_context* ctx) {
+  struct xpushare_client* waiter = earliest_deadline(ctx);
+
+  if (waiter == NULL || ctx->queues[QUEUE_RUNNING] == NULL) {
+    timer_wheel_del(&ctx->timers, &ctx->deadline_timer);
+    return;
+  }
+  arm_timer(ctx, &ctx->deadline_timer,
+            waiter->deadline_ms - ctx->drop_release_ewma_ms);
+}
+
+/*
+ * Preempt the holders standing between the earliest-deadline waiter and its
+ * deadline. Higher classes keep the lock, and so do holders with an SLO of
+ * their own for as long as it is: they have slack only once they held the
+ * lock max_wait_ms, since they'd have waited that long otherwise.
+ */
+static void deadline_timer_fn(struct timer_wheel_timer* timer) {
+  struct gpu_context* ctx = timer->data;
+  struct xpushare_client *waiter = earliest_deadline(ctx), *c;
+  long now_ms = current_time_ms();
+
+  if (waiter == NULL) return;
+  if (now_ms < waiter->deadline_ms - ctx->drop_release_ewma_ms) {
+    arm_deadline_timer(ctx);
+    return;
+  }
+
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+    if (c->priority > waiter->priority || c->last_drop_sent_ms > 0) continue;
+    if (c->max_wait_ms > 0 &&
+        c->lock_granted_ms + c->max_wait_ms > waiter->deadline_ms)
+      continue;
+    log_info("Preempting client %016" PRIx64 " so that client %016" PRIx64
+             " makes its deadline in %ld ms",
+             c->id, waiter->id, waiter->deadline_ms - now_ms);
+    preempt_client(c, now_ms);
+    ctx->deadline_preempt_count++;
+  }
+}
+
+/*
+ * What a client keeps on the GPU while it runs. In AUTO mode that is its
+ * working set once it has reported one (WSS_UPDATE): the rest of its
+ * allocations can stay in host memory through Unified Memory without
+ * slowing it down. Otherwise, all of its allocations.
+ */
+static size_t resident_memory(const struct xpushare_client* c) {
+  if (config.scheduling_mode == SCHED_MODE_AUTO && c->wss > 0 &&
+      c->wss < c->memory_allocated)
+    return c->wss;
+  return c->memory_allocated;
+}
+
+/*
+ * What admission counts for a client: frameworks allocate lazily, so until
+ * it gets there, what it is resident with plus the growth to the peak its
+ * workload reached before.
+ */
+static size_t admission_memory(const struct xpushare_client* c) {
+  size_t growth = c->predicted_peak > c->memory_allocated
+                      ? c->predicted_peak - c->memory_allocated
+                      : 0;
+
+  return resident_memory(c) + growth;
+}
+
+/* What the running clients keep on the GPU, see resident_memory() */
+static size_t running_resident_memory(struct gpu_context* ctx) {
+  struct xpushare_client* c;
+  size_t total = 0;
+
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) total +=
+      resident_memory(c);
+  return total;
+}
+
+/*
+ * A working set sample. It is taken over one quantum, which may not have
+ * touched everything the client uses each iteration, so the estimate goes
+ * up at once and down by a quarter of the difference.
+ */
+static void observe_wss(struct xpushare_client* c, size_t sample) {
+  if (sample >= c->wss)
+    c->wss = sample;
+  else
+    c->wss -= (c->wss - sample) / 4;
+}
+
+static size_t running_admission_memory(struct gpu_context* ctx) {
+  struct xpushare_client* c;
+  size_t total = 0;
+
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+    if (c->last_drop_sent_ms > 0) {
+      total += resident_memory(c); /* On its way out */
+      continue;
+    }
+    total += admission_memory(c);
+  }
+  return total;
+}
+
+/* Host memory headroom, read at most every HOST_MEM_REFRESH_MS */
+static pthread_mutex_t host_mem_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct host_mem host_mem;
+static int host_mem_known;
+static long host_mem_read_ms;
+
+static int current_host_mem(struct host_mem* hm) {
+  long now_ms = current_time_ms();
+  int known;
+
+  true_or_exit(pthread_mutex_lock(&host_mem_mutex) == 0);
+  if (host_mem_read_ms == 0 || now_ms - host_mem_read_ms >= HOST_MEM_REFRESH_MS) {
+    host_mem_known = host_mem_read(config.host_meminfo_path,
+                                   config.host_cgroup_path, &host_mem) == 0;
+    host_mem_read_ms = now_ms;
+  }
+  known = host_mem_known;
+  *hm = host_mem;
+  true_or_exit(pthread_mutex_unlock(&host_mem_mutex) == 0);
+  return known;
+}
+
+/*
+ * Whether the host can back what admitting client would push out of the
+ * GPU. Once it runs, the client grows to what admission counts for it; if
+ * the clients of the GPU no longer fit then, that much ends up in host RAM
+ * on the next switches. It must leave config.host_mem_wm_percent of the
+ * host free, or the kernel starts reclaiming under every tenant.
+ */
+static int host_mem_admits(struct gpu_context* ctx,
+                           struct xpushare_client* client, size_t wanted,
+                           size_t safe_limit) {
+  size_t growth, demand, spill, floor;
+  struct host_mem hm;
+
+  if (config.host_mem_wm_percent == 0) return 1;
+  growth = wanted > resident_memory(client) ? wanted - resident_memory(client)
+                                            : 0;
+  demand = demanded_memory(ctx) + growth;
+  if (growth == 0 || demand <= safe_limit) return 1;
+  spill = demand - safe_limit < growth ? demand - safe_limit : growth;
+
+  if (!current_host_mem(&hm)) return 1;
+  floor = hm.total / 100 * config.host_mem_wm_percent;
+  if (hm.available >= floor && hm.available - floor >= spill) return 1;
+
+  if (!client->host_mem_deferred) {
+    client->host_mem_deferred = 1;
+    ctx->host_mem_defer_count++;
+    log_info("Client %016" PRIx64 " waits for host memory: %zu MB to spill, "
+             "%zu MB available, %zu MB to keep free",
+             client->id, spill / (1024 * 1024), hm.available / (1024 * 1024),
+             floor / (1024 * 1024));
+  }
+  return 0;
+}
+
+/* Check if client can run with current memory usage and scheduling mode */
+static int can_run_with_memory(struct gpu_context* ctx,
+                               struct xpushare_client* client) {
+  refresh_context_total_memory(ctx);
+  size_t safe_limit = safe_memory_limit(ctx);
+  size_t running = running_admission_memory(ctx);
+  size_t wanted = admission_memory(client);
+
+  /*
+   * Holders that overran their lease don't get to keep the GPU to
+   * themselves: whatever the mode, admit the next waiter next to them as
+   * long as it fits in memory.
+   */
+  if (ctx->nr_overdue > 0 && ctx->nr_overdue == ctx->queue_len[QUEUE_RUNNING])
+    return running + wanted <= safe_limit &&
+           host_mem_admits(ctx, client, wanted, safe_limit);
+
+  /* If memory overload was detected, fall back to serial mode */
+  if (ctx->memory_overloaded) {
+    if (ctx->lock_held) {
+      log_debug("Overload fallback: GPU %s using serial mode", ctx->uuid);
+      return 0;
+    }
+    /* Allow task to start if no one is running (serial behavior) */
+    return 1;
+  }
+
+  /* Co-running thrashed, serial until the next probe, see check_thrash() */
+  if (ctx->thrashing) {
+    if (ctx->lock_held) {
+      log_debug("Thrash fallback: GPU %s using serial mode", ctx->uuid);
+      return 0;
+    }
+    return 1;
   }
 
   /* Serial mode: only one task at a time per GPU */
@@ -654,24 +2010,25 @@ static int can_run_with_memory(struct gpu_context* ctx,
   /* Concurrent mode: use original logic (allow multiple tasks) */
   if (config.scheduling_mode == SCHED_MODE_CONCURRENT) {
     /* Always allow if running memory is 0 (first process) to avoid deadlocks */
-    if (ctx->running_memory_usage == 0) return 1;
-    return (ctx->running_memory_usage + client->memory_allocated) <= safe_limit;
+    if (running == 0) return 1;
+    return (running + wanted) <= safe_limit &&
+           host_mem_admits(ctx, client, wanted, safe_limit);
   }
 
   /* AUTO mode (smart): serial if memory would exceed limit, concurrent
    * otherwise */
   /* Always allow if this is the first task */
-  if (ctx->running_memory_usage == 0) return 1;
+  if (running == 0) return 1;
 
   /* Check if adding this task would exceed memory limit */
-  size_t needed = ctx->running_memory_usage + client->memory_allocated;
+  size_t needed = running + wanted;
   if (needed <= safe_limit) {
     /* Memory fits, allow concurrent */
     log_debug(
         "Auto mode: memory fits (%zu + %zu <= %zu MB), allowing concurrent",
-        ctx->running_memory_usage / (1024 * 1024),
-        client->memory_allocated / (1024 * 1024), safe_limit / (1024 * 1024));
-    return 1;
+        running / (1024 * 1024), wanted / (1024 * 1024),
+        safe_limit / (1024 * 1024));
+    return host_mem_admits(ctx, client, wanted, safe_limit);
   }
 
   /* Memory would exceed limit, switch to serial behavior */
@@ -686,87 +2043,202 @@ static int can_run_with_memory(struct gpu_context* ctx,
   return 1;
 }
 
-static void move_to_wait_queue(struct gpu_context* ctx,
-                               struct xpushare_request* req) {
-  struct xpushare_request* w_req;
-
-  /* Check if already in wait queue (paranoid) */
-  LL_FOREACH(ctx->wait_queue, w_req) {
-    if (w_req->client == req->client) return;
-  }
+static void move_to_wait_queue(struct xpushare_client* client) {
+  if (client->queue == QUEUE_WAIT) return;
 
-  LL_DELETE(ctx->requests, req);
-  LL_APPEND(ctx->wait_queue, req);
+  queue_move(client, QUEUE_WAIT);
+  arm_window_timer(client->context);
 
   /* Inform client to wait */
   /* Only send WAIT_FOR_MEM if not throttled (i.e. waiting for memory) */
-  if (req->client->core_limit < 100 && req->client->is_throttled) {
+  if (core_guarantee(client) < 100 && client->is_throttled) {
     log_debug("Client %016" PRIx64 " moved to wait queue (throttled)",
-              req->client->id);
+              client->id);
   } else {
-    out_msg.type = WAIT_FOR_MEM;
-    send_message(req->client, &out_msg);
+    struct message msg = {0};
+    msg.type = WAIT_FOR_MEM;
+    send_message(client, &msg);
     metrics_inc_wait_for_mem();
     log_info("Client %016" PRIx64 " moved to wait queue (wait for mem)",
-             req->client->id);
+             client->id);
   }
 }
 
-static void check_wait_queue(struct gpu_context* ctx) {
-  struct xpushare_request *r, *tmp;
+/*
+ * EASY backfilling. The first client waiting for memory holds a reservation:
+ * the moment enough running clients are predicted to have released the lock
+ * for it to fit. Clients queued behind it may start before that only if they
+ * are predicted to be done by then, or fit in the memory left over once the
+ * reserved client runs. Predictions go by how long each client held the lock
+ * last time, and never past the TQ, which drops every holder.
+ */
+struct reservation {
+  struct xpushare_client* client; /* NULL if nobody is blocked on memory */
+  long due_ms;
+  size_t spare; /* Memory still free next to the reserved client */
+};
 
-  LL_FOREACH_SAFE(ctx->wait_queue, r, tmp) {
-    if (can_run(ctx, r->client)) {
-      LL_DELETE(ctx->wait_queue, r);
-      /* Prepend to requests queue to prioritize it */
-      LL_PREPEND(ctx->requests, r);
+/* When the running TQ asks every holder to drop the lock */
+static long tq_deadline_ms(struct gpu_context* ctx, long now_ms) {
+  if (timer_wheel_pending(&ctx->tq_timer)) return (long)ctx->tq_timer.expires;
+  return now_ms + tq_length_ms(ctx);
+}
 
-      log_info("Client %016" PRIx64 " promoted from wait queue", r->client->id);
+/* When a client that got the lock at start_ms is expected to release it */
+static long predicted_release_ms(struct gpu_context* ctx,
+                                 struct xpushare_client* c, long start_ms,
+                                 long now_ms) {
+  long tq_end = tq_deadline_ms(ctx, now_ms);
+  long end = start_ms + c->last_hold_ms;
+
+  if (c->last_drop_sent_ms > 0) return now_ms;
+  /* Unless it is already running longer than last time */
+  if (c->last_hold_ms > 0 && end > now_ms && end < tq_end) return end;
+  return tq_end;
+}
 
-      /* Inform client memory is available */
-      out_msg.type = MEM_AVAILABLE;
-      send_message(r->client, &out_msg);
-      metrics_inc_mem_available();
+/*
+ * Reserve memory for head, given promised bytes handed to clients that have
+ * not started yet. Those are assumed to keep their memory until the last
+ * runner is gone.
+ */
+static void reserve_for(struct gpu_context* ctx, struct xpushare_client* head,
+                        size_t promised, long now_ms,
+                        struct reservation* resv) {
+  size_t safe_limit = safe_memory_limit(ctx);
+  size_t used = running_admission_memory(ctx) + promised;
+  size_t free_now = used < safe_limit ? safe_limit - used : 0;
+  struct xpushare_client *r, *s;
+  long latest = now_ms;
+  int found = 0;
+
+  resv->client = head;
+  resv->spare = 0;
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], r, q_next) {
+    long t = predicted_release_ms(ctx, r, r->lock_granted_ms, now_ms);
+    size_t freed = 0;
+
+    if (t > latest) latest = t;
+    if (found && t >= resv->due_ms) continue;
+    DL_FOREACH2(ctx->queues[QUEUE_RUNNING], s, q_next) {
+      if (predicted_release_ms(ctx, s, s->lock_granted_ms, now_ms) <= t)
+        freed += admission_memory(s);
+    }
+    if (free_now + freed < admission_memory(head)) continue;
+    found = 1;
+    resv->due_ms = t;
+    resv->spare = free_now + freed - admission_memory(head);
+  }
+  /* Too big to share the GPU, it runs once everyone is gone */
+  if (!found) resv->due_ms = latest;
+}
 
-      /* Only promote one at a time for simplicity in FCFS flow,
-       * try_schedule will pick it up */
-      return;
+/* Whether c can start now without pushing the reservation back */
+static int backfill_ok(struct gpu_context* ctx, struct xpushare_client* c,
+                       struct reservation* resv, long now_ms) {
+  /* The reserved client itself, and anyone queued ahead of it */
+  if (resv->client == NULL || c == resv->client ||
+      queued_before(c, resv->client))
+    return 1;
+
+  if (predicted_release_ms(ctx, c, now_ms, now_ms) <= resv->due_ms) return 1;
+  if (admission_memory(c) <= resv->spare) {
+    resv->spare -= admission_memory(c);
+    return 1;
+  }
+  log_debug("Client %016" PRIx64 " may not backfill ahead of %016" PRIx64,
+            c->id, resv->client->id);
+  return 0;
+}
+
+/* The reservation of the first client waiting for memory, if any */
+static void current_reservation(struct gpu_context* ctx, long now_ms,
+                                struct reservation* resv) {
+  struct xpushare_client* c;
+
+  resv->client = NULL;
+  /* Nothing runs next to a holder there, so nothing can jump ahead */
+  if (config.scheduling_mode == SCHED_MODE_SERIAL || ctx->memory_overloaded ||
+      ctx->thrashing)
+    return;
+
+  DL_FOREACH2(ctx->queues[QUEUE_WAIT], c, q_next) {
+    if (!within_guarantee(ctx, c)) continue; /* Nothing is held for it */
+    if (!can_run_with_memory(ctx, c)) reserve_for(ctx, c, 0, now_ms, resv);
+    return;
+  }
+}
+
+/*
+ * Promote every waiter that can run now, in queue order, for try_schedule() to
+ * pick up. The first one that cannot gets the reservation, and those behind
+ * it only go if backfill_ok() says so.
+ */
+static void check_wait_queue(struct gpu_context* ctx) {
+  struct xpushare_client *c, *tmp, *last = NULL;
+  struct reservation resv = {0};
+  size_t safe_limit = safe_memory_limit(ctx);
+  size_t promised = 0;
+  long now_ms = current_time_ms();
+  int shared = config.scheduling_mode != SCHED_MODE_SERIAL &&
+               !ctx->memory_overloaded && !ctx->thrashing;
+
+  DL_FOREACH_SAFE2(ctx->queues[QUEUE_WAIT], c, tmp, q_next) {
+    int fits = can_run(ctx, c);
+
+    /* Next to those promoted already, it has to fit in memory as well */
+    if (fits && last != NULL)
+      fits = shared && running_admission_memory(ctx) + promised +
+                               admission_memory(c) <= safe_limit;
+    if (!fits) {
+      if (resv.client == NULL && shared && within_guarantee(ctx, c))
+        reserve_for(ctx, c, promised, now_ms, &resv);
+      continue;
     }
+    if (!backfill_ok(ctx, c, &resv, now_ms)) continue;
+
+    queue_move(c, QUEUE_REQUESTS);
+    last = c;
+    promised += admission_memory(c);
+
+    log_info("Client %016" PRIx64 " promoted from wait queue", c->id);
+
+    /* Inform client memory is available */
+    struct message msg = {0};
+    msg.type = MEM_AVAILABLE;
+    send_message(c, &msg);
+    metrics_inc_mem_available();
   }
 }
 
+/*
+ * Register a client that connected through the control loop and hand its
+ * socket over to the event loop of the GPU it runs on.
+ *
+ * Called from the control loop without any lock held. The client starts with
+ * the default limits; its Pod annotations are looked up in the background and
+ * applied once the API server answers, see queue_limits_lookup().
+ */
 static int register_client(struct xpushare_client* client,
                            const struct message* in_msg) {
   int ret;
-  struct xpushare_client* c;
   uint64_t xpushare_client_id;
   struct gpu_context* ctx;
+  struct message out_msg = {0};
+  struct epoll_event event;
+  char workload[PEAK_STORE_KEY_LEN];
 
   if (has_registered(client)) {
     log_warn("Client %016" PRIx64 " is already registered", client->id);
     return -1;
   }
 
-again:
-  xpushare_client_id = xpushare_generate_id();
-  if (xpushare_client_id == XPUSHARE_UNREGISTERED_ID) /* Tough luck */
-    goto again;
-  LL_FOREACH(clients, c) {
-    if (c->id == xpushare_client_id) { /* ID clash */
-      goto again;
-    }
-  }
-
-  /*
-   * Store the rest of the client information.
-   */
-  client->id = xpushare_client_id;
-  strlcpy(client->pod_name, in_msg->pod_name, sizeof(client->pod_name));
-  strlcpy(client->pod_namespace, in_msg->pod_namespace,
-          sizeof(client->pod_namespace));
-
   /* Map context */
+  true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
   ctx = get_or_create_gpu_context(in_msg->gpu_uuid);
+  true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
+
+  true_or_exit(pthread_mutex_lock(&ctx->lock) == 0);
   refresh_context_total_memory(ctx);
   client->context = ctx;
 
@@ -790,32 +2262,103 @@ again:
     }
   }
   client->peak_allocated = 0;
+  client->nvml_used = 0;
+  client->predicted_peak = 0;
+  client->wss = 0;
+  client->host_mem_deferred = 0;
 
   /* Initialize compute limit fields BEFORE sending SCHED_ON */
   client->core_limit = 100;
+  client->core_request = 0;
+  client->ns_weight = 1;
+  client->ns_demand = 0;
+  client->ns_entitled = 0;
+  client->priority = PRIORITY_STANDARD;
   client->run_time_in_window_ms = 0;
   client->current_run_start_ms = 0;
+  client->lock_granted_ms = 0;
+  client->last_hold_ms = 0;
+  client->req_seq = 0;
+  client->drr_pass = 0;
+  client->mlfq_level = 0;
+  client->burst_est_ms = 0;
+  client->sjf_key = 0;
+  client->max_wait_ms = 0;
+  client->requested_ms = 0;
+  client->deadline_ms = LONG_MAX;
+  client->deadline_miss_count = 0;
+  memset(client->lock_wait_buckets, 0, sizeof(client->lock_wait_buckets));
+  client->lock_wait_sum_ms = 0;
   client->is_throttled = 0;
+  client->borrowing = 0;
+  client->borrowed_ms = 0;
+  client->lent_ms = 0;
   client->pending_drop = 0;
   client->drop_concurrency = 1;
   client->last_drop_sent_ms = 0;
+  client->swap_prepared = 0;
+  client->switch_drain_ms = -1;
   client->quota_debt_ms = 0;
+  client->queue = QUEUE_NONE;
+  timer_wheel_timer_init(&client->quota_timer, quota_timer_fn, client);
+  timer_wheel_timer_init(&client->lease_timer, lease_timer_fn, client);
+  timer_wheel_timer_init(&client->share_timer, share_timer_fn, client);
+  client->lease_overdue = 0;
+  client->lease_overdue_count = 0;
+  strlcpy(client->pod_name, in_msg->pod_name, sizeof(client->pod_name));
+  strlcpy(client->pod_namespace, in_msg->pod_namespace,
+          sizeof(client->pod_namespace));
+  client_workload_key(client, workload);
+  client->predicted_peak = peak_store_get(workload);
+  if (client->predicted_peak > 0)
+    log_info("Workload %s predicted to use %zu MB", workload,
+             client->predicted_peak / (1024 * 1024));
 
-  /* Check for compute limit annotation */
-  char* core_limit_str = k8s_get_pod_annotation(
-      client->pod_namespace, client->pod_name, CORE_LIMIT_ANNOTATION);
-  if (core_limit_str) {
-    int new_limit = atoi(core_limit_str);
-    if (new_limit >= 1 && new_limit <= 100) {
-      client->core_limit = new_limit;
-      log_info("Applying initial compute limit for %s/%s: %d%%",
-               client->pod_namespace, client->pod_name, new_limit);
-    } else {
-      log_warn("Invalid compute limit for %s/%s: %d (must be 1-100)",
-               client->pod_namespace, client->pod_name, new_limit);
+  /*
+   * Publish the client. From here on the metrics exporter and the annotation
+   * watcher can see it, under ctx->lock.
+   */
+  attach_client(client);
+  true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
+again:
+  xpushare_client_id = xpushare_generate_id();
+  if (xpushare_client_id == XPUSHARE_UNREGISTERED_ID) /* Tough luck */
+    goto again;
+  if (client_table_find(xpushare_client_id) != NULL) /* ID clash */
+    goto again;
+  client->id = xpushare_client_id;
+  client_table_insert(client);
+  out_msg.type = scheduler_on ? SCHED_ON : SCHED_OFF;
+  true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
+
+  /*
+   * Move the socket from the control loop to the GPU's event loop. From here
+   * on that loop owns it, and notices if any of the sends below fail.
+   */
+  if (config.io_engine == IO_ENGINE_URING) {
+    /* The control loop has no request left on it, see control_loop_uring() */
+    client->refs++;
+    uring_prep_recv_multishot(&ctx->ring, client->fd,
+                              IO_DATA(client, IO_OP_RECV));
+  } else {
+    true_or_exit(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL) == 0);
+    event.data.ptr = client;
+    event.events = EPOLLIN;
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, client->fd, &event) < 0) {
+      log_warn("Couldn't add %d to the epoll interest list of GPU %s",
+               client->fd, ctx->uuid);
+      /* Let the control loop tear it down as an unregistered client */
+      true_or_exit(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &event) ==
+                   0);
+      ret = -1;
+      goto out_unlock;
     }
-    free(core_limit_str);
   }
+  ret = 0;
+  log_info("Registered client %016" PRIx64
+           " on GPU %s with Pod"
+           " name = %s, Pod namespace = %s",
+           client->id, ctx->uuid, client->pod_name, client->pod_namespace);
 
   /*
    * Inform the client of the current status of our current status, as
@@ -825,100 +2368,199 @@ again:
    */
   true_or_exit(
       snprintf(out_msg.data, 16 + 1, "%016" PRIx64, xpushare_client_id) == 16);
-  out_msg.type = scheduler_on ? SCHED_ON : SCHED_OFF;
   out_msg.core_limit = client->core_limit; /* NEW: Send core_limit to client */
-  if ((ret = send_message(client, &out_msg)) < 0) goto out_with_msg;
-
-  /* Check for memory limit annotation immediately to prevent race condition */
-  char* limit_str = k8s_get_pod_annotation(
-      client->pod_namespace, client->pod_name, MEMORY_LIMIT_ANNOTATION);
-  if (limit_str) {
-    size_t new_limit = parse_memory_size(limit_str);
-    if (new_limit > 0) {
-      log_info("Applying initial memory limit for %s/%s: %zu bytes",
-               client->pod_namespace, client->pod_name, new_limit);
-      client->memory_limit = new_limit;
-      send_update_limit(client, new_limit);
-    }
-    free(limit_str);
-  }
+  send_message(client, &out_msg);
 
-out_with_msg:
-  /* out_msg is global, so make sure we've zeroed it out */
-  memset(&out_msg.data, 0, sizeof(out_msg.data));
+  queue_limits_lookup(client);
 
+out_unlock:
+  /* On failure the socket stays with the control loop, which deletes it */
+  if (ret < 0) {
+    detach_client(client);
+    client->context = NULL;
+  }
+  true_or_exit(pthread_mutex_unlock(&ctx->lock) == 0);
   return ret;
 }
 
+/*
+ * Broadcast the scheduler status to every registered client.
+ *
+ * Called from the control loop with no lock held. A client we fail to reach
+ * is shut down, so that the event loop owning it removes it.
+ */
 static void bcast_status(void) {
-  struct xpushare_client *tmp, *c;
-  LL_FOREACH_SAFE(clients, c, tmp) {
-    if (!has_registered(c)) continue;
+  struct xpushare_client* c;
+  struct gpu_context* ctx;
+  struct message msg = {0};
 
-    out_msg.type = scheduler_on ? SCHED_ON : SCHED_OFF;
-    if (send_message(c, &out_msg) < 0) delete_client(c);
+  true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
+  msg.type = scheduler_on ? SCHED_ON : SCHED_OFF;
+  ctx = gpu_contexts;
+  true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
+
+  /* Contexts are only ever appended, by this (control) thread */
+  for (; ctx != NULL; ctx = ctx->next) {
+    true_or_exit(pthread_mutex_lock(&ctx->lock) == 0);
+    DL_FOREACH2(ctx->clients, c, ctx_next) {
+      if (send_message(c, &msg) < 0) shutdown(c->fd, SHUT_RDWR);
+    }
+    true_or_exit(pthread_mutex_unlock(&ctx->lock) == 0);
+  }
+}
+
+/* Append a message to the transmit queue of a client */
+static void queue_message(struct xpushare_client* client,
+                          const struct message* msg_p) {
+  size_t need = client->tx_len + sizeof(*msg_p);
+
+  /* Reclaim what has been written already before growing */
+  if (client->tx_head > 0 && need > client->tx_cap) {
+    memmove(client->tx_buf, client->tx_buf + client->tx_head,
+            client->tx_len - client->tx_head);
+    client->tx_len -= client->tx_head;
+    client->tx_head = 0;
+    need = client->tx_len + sizeof(*msg_p);
+  }
+  if (need > client->tx_cap) {
+    while (need > client->tx_cap)
+      client->tx_cap = client->tx_cap ? 2 * client->tx_cap : 4 * sizeof(*msg_p);
+    true_or_exit(client->tx_buf = realloc(client->tx_buf, client->tx_cap));
   }
+  memcpy(client->tx_buf + client->tx_len, msg_p, sizeof(*msg_p));
+  client->tx_len += sizeof(*msg_p);
 }
 
 /*
- * Send a given message to a given client.
+ * Write out the queued messages of a client in one go, as far as its socket
+ * takes them. If it fills up, the rest waits for EPOLLOUT.
  *
- * We are particularly strict and consider the client dead if we encounter any
- * (even possibly recoverable if we were more lenient) error.
+ * Must be called with ctx->lock held. Returns -1 if the client is dead to us.
  */
-static int send_message(struct xpushare_client* client, struct message* msg_p) {
+static int flush_client(struct xpushare_client* client) {
+  struct gpu_context* ctx = client->context;
+  struct epoll_event event;
   ssize_t ret;
-  char id_str[HEX_STR_LEN(client->id)];
+  int blocked;
+
+  while (client->tx_head < client->tx_len) {
+    ret = RETRY_INTR(send(client->fd, client->tx_buf + client->tx_head,
+                          client->tx_len - client->tx_head, MSG_NOSIGNAL));
+    if (ret < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      if (errno == ECONNRESET || errno == EPIPE) {
+        log_info("Failed to send message to client %016" PRIx64, client->id);
+        return -1;
+      }
+      log_fatal("send() failed unrecoverably");
+    }
+    client->tx_head += ret;
+  }
+  if (client->tx_head == client->tx_len) client->tx_head = client->tx_len = 0;
+
+  blocked = client->tx_len > 0;
+  if (blocked != client->tx_blocked) {
+    event.data.ptr = client;
+    event.events = blocked ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    true_or_exit(
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, client->fd, &event) == 0);
+    client->tx_blocked = blocked;
+  }
+  return 0;
+}
 
-  client_id_as_string(id_str, sizeof(id_str), client->id);
+/*
+ * Start sending the queued messages of a client, if it has nothing in flight.
+ *
+ * Must be called with ctx->lock held.
+ */
+static void start_send_uring(struct xpushare_client* client) {
+  struct gpu_context* ctx = client->context;
+  char* buf;
+  size_t cap;
+
+  if (client->tx_out_len > 0 || client->tx_len == 0) return;
+
+  buf = client->tx_out;
+  cap = client->tx_out_cap;
+  client->tx_out = client->tx_buf;
+  client->tx_out_cap = client->tx_cap;
+  client->tx_out_len = client->tx_len;
+  client->tx_out_sent = 0;
+  client->tx_buf = buf;
+  client->tx_cap = cap;
+  client->tx_len = 0;
+
+  client->refs++;
+  uring_prep_send(&ctx->ring, client->fd, client->tx_out, client->tx_out_len,
+                  MSG_NOSIGNAL | MSG_WAITALL, IO_DATA(client, IO_OP_SEND));
+}
 
-  ret = xpushare_send_noblock(client->fd, msg_p, sizeof(*msg_p));
+/*
+ * Send a given message to a given registered client.
+ *
+ * Messages are queued per client. The GPU's event loop writes out everything
+ * queued while it handles a batch of events at the end of it; other threads
+ * flush right away. A full socket is waited out, but otherwise we are
+ * particularly strict and consider the client dead on any error. Errors the
+ * event loop runs into are dealt with there; other threads shut the socket
+ * down, so that the loop notices.
+ *
+ * Must be called with ctx->lock held.
+ */
+static int send_message(struct xpushare_client* client, struct message* msg_p) {
+  struct gpu_context* ctx = client->context;
+  char id_str[HEX_STR_LEN(client->id)];
 
-  if (ret >= 0 && (size_t)ret < sizeof(*msg_p)) /* Partial send */
+  client_id_as_string(id_str, sizeof(id_str), client->id);
+  if (client->dead) return -1;
+
+  queue_message(client, msg_p);
+  if (config.io_engine == IO_ENGINE_URING) {
+    start_send_uring(client);
+    if (!ctx->dispatching) uring_submit(&ctx->ring);
+  } else if (client->tx_blocked) {
+    /* Goes out with the rest on EPOLLOUT */
+  } else if (ctx->dispatching) {
+    if (!client->tx_queued) {
+      DL_APPEND2(ctx->tx_pending, client, tx_prev, tx_next);
+      client->tx_queued = 1;
+    }
+  } else if (flush_client(client) < 0) {
+    shutdown(client->fd, SHUT_RDWR);
     return -1;
-  else if (ret < 0) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNRESET ||
-        errno == EPIPE) { /* Recoverable errors, but we're strict */
-      log_info("Failed to send message to client %s", id_str);
-      return -1;
-    } else
-      log_fatal("xpushare_send_noblock() failed unrecoverably");
-  } else { /* ret == 0 */
-    log_info("Sent %s to client %s", message_type_string[msg_p->type], id_str);
   }
+
+  log_info("Sent %s to client %s", message_type_string[msg_p->type], id_str);
   return 0;
 }
 
 /*
- * Send a given message to a given client.
+ * Read whatever a client has sent us, up to len bytes.
  *
- * We are particularly strict and consider the client dead if we encounter any
- * (even possibly recoverable if we were more lenient) error.
+ * Returns the number of bytes read, 0 if there is nothing to read, or -1 if
+ * the client is gone. Again, any error kills the client.
  */
-static int receive_message(struct xpushare_client* client,
-                           struct message* msg_p) {
+static ssize_t receive_bytes(struct xpushare_client* client, void* buf,
+                             size_t len) {
   ssize_t ret;
   char id_str[HEX_STR_LEN(client->id)];
 
-  client_id_as_string(id_str, sizeof(id_str), client->id);
-
-  ret = xpushare_receive_noblock(client->fd, msg_p, sizeof(*msg_p));
+  ret = RETRY_INTR(read(client->fd, buf, len));
+  if (ret > 0) return ret;
 
+  client_id_as_string(id_str, sizeof(id_str), client->id);
   if (ret == 0) { /* Client closed the other end of the connection */
-    errno = ENOTCONN;
     log_debug("Client %s has closed the connection", id_str);
     return -1;
-  } else if (ret > 0 && (size_t)ret < sizeof(*msg_p)) { /* Partial receive */
+  }
+  if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+  if (errno == ECONNRESET || errno == EPIPE) {
+    log_info("Failed to receive message from client %s", id_str);
     return -1;
-  } else if (ret < 0) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNRESET ||
-        errno == EPIPE) {
-      log_info("Failed to receive message from client %s", id_str);
-      return -1;
-    } else
-      log_fatal("xpushare_receive_noblock() failed unrecoverably");
   }
-  return 0;
+  log_fatal("read() failed unrecoverably");
+  return -1;
 }
 
 /* Helper: Get current time in milliseconds (monotonic) */
@@ -928,33 +2570,12 @@ static long current_time_ms(void) {
   return (ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
 }
 
-/* Helper: Calculate total quota of all active clients on this GPU */
-static int calculate_total_quota(struct gpu_context* ctx) {
-  int total = 0;
-  struct xpushare_client* c;
-  LL_FOREACH(clients, c) {
-    if (c->context == ctx && c->core_limit < 100) {
-      total += c->core_limit;
-    }
-  }
-  /* If no limited clients or total is 0, return 100 (no scaling needed) */
-  return total > 0 ? total : 100;
-}
-
 /* Helper: Count currently running quota-limited clients on this GPU.
  * This is used for weighted billing and must reflect runtime concurrency,
  * not total registered clients, otherwise solo periods get under-billed.
  */
 static int count_running_clients(struct gpu_context* ctx) {
-  int count = 0;
-  struct xpushare_request* req;
-
-  LL_FOREACH(ctx->running_list, req) {
-    if (req->client->core_limit < 100) {
-      count++;
-    }
-  }
-  return count > 0 ? count : 1;
+  return ctx->nr_running_limited > 0 ? ctx->nr_running_limited : 1;
 }
 
 /* Settle billed usage for currently running quota-limited clients up to now.
@@ -963,12 +2584,11 @@ static int count_running_clients(struct gpu_context* ctx) {
 static void accrue_running_usage(struct gpu_context* ctx, long now_ms,
                                  struct xpushare_client* exclude_client) {
   int n_running = count_running_clients(ctx);
-  struct xpushare_request* req;
+  struct xpushare_client* c;
 
-  LL_FOREACH(ctx->running_list, req) {
-    struct xpushare_client* c = req->client;
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
     if (c == exclude_client) continue;
-    if (c->core_limit >= 100) continue;
+    if (core_guarantee(c) >= 100) continue;
     if (c->pending_drop) continue;
     if (c->current_run_start_ms <= 0) continue;
 
@@ -981,24 +2601,125 @@ static void accrue_running_usage(struct gpu_context* ctx, long now_ms,
   }
 }
 
-/* Helper: Get effective quota with proportional scaling for oversubscription */
+/*
+ * Helper: Get effective quota, scaled down when the namespace of the client is
+ * oversubscribed, see update_namespace_shares()
+ */
 static long get_effective_quota_ms(struct gpu_context* ctx,
                                    struct xpushare_client* c) {
-  int total_quota = calculate_total_quota(ctx);
-  long base_quota_ms = (long)config.compute_window_ms * c->core_limit / 100;
+  long base_quota_ms =
+      (long)config.compute_window_ms * core_guarantee(c) / 100;
 
-  if (total_quota <= 100) {
+  if (c->ns_entitled >= c->ns_demand) {
     return base_quota_ms; /* No oversubscription, return original */
   }
 
-  /* Oversubscribed: scale down proportionally */
-  long scaled = base_quota_ms * 100 / total_quota;
+  /* Oversubscribed: scale down to the part of its namespace */
+  long scaled = base_quota_ms * c->ns_entitled / c->ns_demand;
   log_debug("Quota scaling: client %016" PRIx64
-            " limit %d%%, total %d%%, base %ld ms -> scaled %ld ms",
-            c->id, c->core_limit, total_quota, base_quota_ms, scaled);
+            " limit %d%%, namespace %s gets %d%% of %d%% on GPU %s, base %ld "
+            "ms -> scaled %ld ms",
+            c->id, core_guarantee(c), c->pod_namespace, c->ns_entitled,
+            c->ns_demand, ctx->uuid, base_quota_ms, scaled);
   return scaled;
 }
 
+/*
+ * How far into a window a client may run on lent capacity: its limit, never
+ * scaled, as only what nobody else is owed gets lent. Equal to the quota for
+ * clients without a request below their limit.
+ */
+static long borrow_ceiling_ms(struct gpu_context* ctx,
+                              struct xpushare_client* c) {
+  if (c->core_limit <= core_guarantee(c))
+    return get_effective_quota_ms(ctx, c);
+  return (long)config.compute_window_ms * c->core_limit / 100;
+}
+
+/* Whether a client is owed the lock: not throttled, within its guarantee */
+static int within_guarantee(struct gpu_context* ctx,
+                            struct xpushare_client* c) {
+  if (core_guarantee(c) >= 100) return 1;
+  return !c->is_throttled &&
+         c->run_time_in_window_ms < get_effective_quota_ms(ctx, c);
+}
+
+/*
+ * Whether a client past its guarantee may run on lent capacity: it is below
+ * its limit, and nobody within their guarantee waits for the lock.
+ */
+static int may_borrow(struct gpu_context* ctx, struct xpushare_client* c) {
+  struct xpushare_client* w;
+
+  if (c->core_limit <= core_guarantee(c)) return 0;
+  if (c->run_time_in_window_ms >= borrow_ceiling_ms(ctx, c)) return 0;
+  DL_FOREACH2(ctx->queues[QUEUE_REQUESTS], w, q_next) {
+    if (w != c && within_guarantee(ctx, w)) return 0;
+  }
+  DL_FOREACH2(ctx->queues[QUEUE_WAIT], w, q_next) {
+    if (w != c && within_guarantee(ctx, w)) return 0;
+  }
+  return 1;
+}
+
+/*
+ * At the end of a window, bill what ran past its guarantee as borrowed, and
+ * the same amount as lent to those who left theirs unused, in proportion to
+ * what they left. What is left over came from capacity nobody reserved.
+ */
+static void settle_lending(struct gpu_context* ctx) {
+  struct xpushare_client* c;
+  long borrowed = 0, unused = 0;
+
+  DL_FOREACH2(ctx->clients, c, ctx_next) {
+    if (core_guarantee(c) >= 100) continue;
+    long quota_ms = get_effective_quota_ms(ctx, c);
+    long ceiling_ms = borrow_ceiling_ms(ctx, c);
+
+    if (c->run_time_in_window_ms < quota_ms) {
+      unused += quota_ms - c->run_time_in_window_ms;
+    } else if (ceiling_ms > quota_ms) {
+      long over = c->run_time_in_window_ms < ceiling_ms
+                      ? c->run_time_in_window_ms - quota_ms
+                      : ceiling_ms - quota_ms;
+      c->borrowed_ms += over;
+      borrowed += over;
+    }
+  }
+  if (borrowed == 0 || unused == 0) return;
+
+  DL_FOREACH2(ctx->clients, c, ctx_next) {
+    if (core_guarantee(c) >= 100) continue;
+    long left = get_effective_quota_ms(ctx, c) - c->run_time_in_window_ms;
+
+    if (left <= 0) continue;
+    c->lent_ms += borrowed >= unused ? left : left * borrowed / unused;
+  }
+}
+
+/*
+ * Lent capacity is taken back the moment a client within its guarantee has
+ * to wait for it: every borrower is asked to drop the lock.
+ *
+ * Must be called with ctx->lock held.
+ */
+static void reclaim_lent(struct gpu_context* ctx,
+                         struct xpushare_client* waiter) {
+  struct xpushare_client* c;
+  long now_ms = current_time_ms();
+
+  if (waiter->queue != QUEUE_REQUESTS && waiter->queue != QUEUE_WAIT) return;
+  if (!within_guarantee(ctx, waiter)) return;
+
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+    if (!c->borrowing || c->last_drop_sent_ms > 0) continue;
+    log_info("Reclaiming lent capacity from client %016" PRIx64
+             " for client %016" PRIx64,
+             c->id, waiter->id);
+    preempt_client(c, now_ms);
+  }
+}
+
 /* Helper: Check and reset compute limits window */
 static int check_and_reset_window(struct gpu_context* ctx) {
   struct xpushare_client* c;
@@ -1013,36 +2734,37 @@ static int check_and_reset_window(struct gpu_context* ctx) {
 
     /* Settle running usage up to the window boundary before reset. */
     accrue_running_usage(ctx, now_ms, NULL);
+    settle_lending(ctx);
 
     /* Reset all clients on this GPU */
-    LL_FOREACH(clients, c) {
-      if (c->context == ctx) {
-        if (c->core_limit < 100) {
-          long limit_ms = get_effective_quota_ms(ctx, c);
-          long carry_ms = 0;
-
-          if (c->run_time_in_window_ms > limit_ms) {
-            long over_limit_ms = c->run_time_in_window_ms - limit_ms;
-            carry_ms = over_limit_ms * config.quota_carryover_percent / 100;
-          }
-
-          c->quota_debt_ms = carry_ms;
-          c->run_time_in_window_ms = carry_ms;
-        } else {
-          c->quota_debt_ms = 0;
-          c->run_time_in_window_ms = 0;
+    DL_FOREACH2(ctx->clients, c, ctx_next) {
+      if (core_guarantee(c) < 100) {
+        /* Borrowing up to the limit is no overrun */
+        long limit_ms = borrow_ceiling_ms(ctx, c);
+        long carry_ms = 0;
+
+        if (c->run_time_in_window_ms > limit_ms) {
+          long over_limit_ms = c->run_time_in_window_ms - limit_ms;
+          carry_ms = over_limit_ms * config.quota_carryover_percent / 100;
         }
-        c->is_throttled = 0;
-        /* Do NOT reset current_run_start_ms here - it must track the actual
-         * lock acquisition time, not the window boundary. Resetting it causes
-         * time measurement to restart every 2 seconds, allowing clients to
-         * hold locks far beyond their quota. */
+
+        c->quota_debt_ms = carry_ms;
+        c->run_time_in_window_ms = carry_ms;
+      } else {
+        c->quota_debt_ms = 0;
+        c->run_time_in_window_ms = 0;
       }
+      c->is_throttled = 0;
+      c->borrowing = 0;
+      /* Do NOT reset current_run_start_ms here - it must track the actual
+       * lock acquisition time, not the window boundary. Resetting it causes
+       * time measurement to restart every 2 seconds, allowing clients to
+       * hold locks far beyond their quota. */
     }
     log_debug("Reset quota window for GPU %s after %ld ms", ctx->uuid,
               elapsed_ms);
-    /* Signal try_schedule in case we are called from timer thread */
-    pthread_cond_signal(&ctx->sched_cv);
+    arm_window_timer(ctx);
+    rearm_quota_timers(ctx);
     reset_occured = 1;
   }
   return reset_occured;
@@ -1054,13 +2776,13 @@ static int can_run(struct gpu_context* ctx, struct xpushare_client* client) {
   check_and_reset_window(ctx);
 
   /* Check compute quota (with proportional scaling for oversubscription) */
-  if (client->core_limit < 100) {
+  if (core_guarantee(client) < 100) {
     if (client->is_throttled) {
       log_debug("can_run: client %016" PRIx64 " is throttled", client->id);
       return 0;
     }
     long limit_ms = get_effective_quota_ms(ctx, client);
-    if (client->run_time_in_window_ms >= limit_ms) {
+    if (client->run_time_in_window_ms >= limit_ms && !may_borrow(ctx, client)) {
       log_info("can_run: client %016" PRIx64 " quota exceeded (%ld/%ld ms)",
                client->id, client->run_time_in_window_ms, limit_ms);
       return 0;
@@ -1077,7 +2799,8 @@ static int can_run(struct gpu_context* ctx, struct xpushare_client* client) {
 }
 
 /*
- * Try to assign the GPU lock to a client in the requests list in FCFS order.
+ * Try to assign the GPU lock to a client in the requests list, in the order
+ * of the queue policy.
  *
  * In SERIAL mode: schedules at most one client.
  * In CONCURRENT/AUTO mode: continues scheduling as long as memory permits.
@@ -1085,16 +2808,22 @@ static int can_run(struct gpu_context* ctx, struct xpushare_client* client) {
 static void try_schedule(struct gpu_context* ctx) {
   int ret;
   struct xpushare_client* scheduled_client;
-  struct xpushare_request* req;
   int scheduled_count = 0;
+  int backfilled;
+  long waited_ms;
+  long now_ms;
+  struct reservation resv;
+  struct message msg = {0};
+
+  if (config.queue_policy == QUEUE_POLICY_MLFQ) mlfq_boost(ctx);
 
 try_again:
-  if (ctx->requests == NULL) {
+  if (ctx->queues[QUEUE_REQUESTS] == NULL) {
     /* If requests empty, try to see if anyone in wait queue fits now
      * (e.g. if memory checks changed or logic permits)
      */
     check_wait_queue(ctx);
-    if (ctx->requests == NULL) {
+    if (ctx->queues[QUEUE_REQUESTS] == NULL) {
       if (scheduled_count == 0) {
         log_debug("try_schedule() called with no pending requests for UUID %s",
                   ctx->uuid);
@@ -1104,44 +2833,81 @@ try_again:
   }
 
   /* Check admission control for the head of the queue */
-  req = ctx->requests;
-  scheduled_client = req->client;
+  scheduled_client = ctx->queues[QUEUE_REQUESTS];
+  now_ms = current_time_ms();
+  current_reservation(ctx, now_ms, &resv);
 
-  if (!can_run(ctx, scheduled_client)) {
+  if (!can_run(ctx, scheduled_client) ||
+      !backfill_ok(ctx, scheduled_client, &resv, now_ms)) {
     /* Cannot run, move to wait queue */
-    move_to_wait_queue(ctx, req);
+    move_to_wait_queue(scheduled_client);
     /* Recursively try next request */
     goto try_again;
   }
 
+  /*
+   * Pacing: the client admitted last gets to migrate most of its pages
+   * before the next one competes with it for the host link.
+   */
+  if (config.admission_pacing && ctx->queues[QUEUE_RUNNING] != NULL &&
+      now_ms < ctx->admit_after_ms) {
+    if (!timer_wheel_pending(&ctx->pace_timer)) ctx->paced_count++;
+    arm_timer(ctx, &ctx->pace_timer, ctx->admit_after_ms);
+    log_debug("Pacing client %016" PRIx64 " for %ld ms", scheduled_client->id,
+              ctx->admit_after_ms - now_ms);
+    return;
+  }
+
   /* Pass admission control, schedule it */
-  out_msg.type = LOCK_OK;
-  /* FCFS, use head of requests list */
-  ret = send_message(scheduled_client, &out_msg);
+  msg.type = LOCK_OK;
+  /* Head of the requests list, see queued_before() */
+  ret = send_message(scheduled_client, &msg);
   if (ret < 0) { /* Client's dead to us */
     delete_client(scheduled_client);
     goto try_again;
   }
 
   /* Settle current runners before changing concurrency. */
-  if (ctx->running_list != NULL) {
-    long now_ms = current_time_ms();
+  if (ctx->queues[QUEUE_RUNNING] != NULL)
     accrue_running_usage(ctx, now_ms, NULL);
-  }
 
   /* Move the scheduled request from requests list to running_list */
-  LL_DELETE(ctx->requests, req);
-  LL_APPEND(ctx->running_list, req);
+  queue_move(scheduled_client, QUEUE_RUNNING);
 
   ctx->lock_held = 1;
-  ctx->must_reset_timer = 1;
 
   /* Mark client as running and update memory tracking */
   scheduled_client->is_running = 1;
   scheduled_client->pending_drop = 0;
   scheduled_client->drop_concurrency = 1;
+  /* can_run() let it past its guarantee */
+  scheduled_client->borrowing =
+      core_guarantee(scheduled_client) < 100 &&
+      scheduled_client->run_time_in_window_ms >=
+          get_effective_quota_ms(ctx, scheduled_client);
+  scheduled_client->swap_prepared = 0;
+  /* The first one in after a release takes over the switch */
+  scheduled_client->switch_drain_ms = ctx->last_drain_ms;
+  ctx->last_drain_ms = -1;
+  scheduled_client->host_mem_deferred = 0;
   scheduled_client->current_run_start_ms = current_time_ms();
+  scheduled_client->lock_granted_ms = scheduled_client->current_run_start_ms;
+  scheduled_client->progress_since_ms = scheduled_client->lock_granted_ms;
+  if (scheduled_client->drr_pass > ctx->drr_vtime)
+    ctx->drr_vtime = scheduled_client->drr_pass;
   scheduled_client->last_scheduled_time = time(NULL);
+  if (config.admission_pacing)
+    ctx->admit_after_ms =
+        scheduled_client->lock_granted_ms + warmup_ms(ctx, scheduled_client);
+  waited_ms = scheduled_client->lock_granted_ms - scheduled_client->requested_ms;
+  scheduled_client->lock_wait_buckets[metrics_lock_wait_bucket(waited_ms)]++;
+  scheduled_client->lock_wait_sum_ms += waited_ms;
+  if (scheduled_client->lock_granted_ms > scheduled_client->deadline_ms) {
+    scheduled_client->deadline_miss_count++;
+    log_info("Client %016" PRIx64 " waited %ld ms, %ld ms past its deadline",
+             scheduled_client->id, waited_ms,
+             scheduled_client->lock_granted_ms - scheduled_client->deadline_ms);
+  }
   ctx->running_memory_usage += scheduled_client->memory_allocated;
   scheduled_count++;
   log_info(
@@ -1149,7 +2915,24 @@ try_again:
       scheduled_client->id, scheduled_client->memory_allocated / (1024 * 1024),
       ctx->running_memory_usage / (1024 * 1024));
 
-  pthread_cond_broadcast(&ctx->timer_cv);
+  /*
+   * A new holder restarts the TQ, unless it jumped ahead of a reservation:
+   * the TQ bounds how long the reserved client waits.
+   */
+  backfilled = resv.client != NULL && scheduled_client != resv.client &&
+               !queued_before(scheduled_client, resv.client);
+  if (backfilled) {
+    ctx->backfill_count++;
+    log_info("Client %016" PRIx64 " backfilled ahead of %016" PRIx64
+             " (due in %ld ms)",
+             scheduled_client->id, resv.client->id,
+             resv.due_ms - scheduled_client->lock_granted_ms);
+  }
+  if (!backfilled || !timer_wheel_pending(&ctx->tq_timer)) arm_tq_timer(ctx);
+  /* Concurrency changed for the quotas */
+  rearm_quota_timers(ctx);
+  arm_share_timers(ctx);
+  arm_deadline_timer(ctx);
 
   /* In non-serial modes, continue trying to schedule more tasks */
   if (config.scheduling_mode != SCHED_MODE_SERIAL) {
@@ -1157,10 +2940,100 @@ try_again:
   }
 }
 
+#define SWITCH_COST_DECAY 0.95 /* Weight left to a sample by the next one */
+#define SWITCH_COST_MIN_SAMPLES 4
+
+/*
+ * A switch costs the outgoing holder's drain, DROP_LOCK -> LOCK_RELEASED,
+ * plus the slowdown of the incoming one while its memory comes back, which
+ * it reports with CLIENT_STATS.
+ */
+static void observe_switch_cost(struct gpu_context* ctx, size_t resident,
+                                long cost_ms) {
+  double x = (double)resident / (1024 * 1024 * 1024);
+  double y = (double)cost_ms;
+
+  ctx->cost_n = ctx->cost_n * SWITCH_COST_DECAY + 1;
+  ctx->cost_sx = ctx->cost_sx * SWITCH_COST_DECAY + x;
+  ctx->cost_sy = ctx->cost_sy * SWITCH_COST_DECAY + y;
+  ctx->cost_sxx = ctx->cost_sxx * SWITCH_COST_DECAY + x * x;
+  ctx->cost_sxy = ctx->cost_sxy * SWITCH_COST_DECAY + x * y;
+  ctx->switch_cost_total_ms += cost_ms;
+}
+
+/*
+ * Fitted fixed cost of a switch (ms) and cost per GiB swapped in (ms), the
+ * inverse of the effective bandwidth. Returns 0 until there are enough
+ * samples. Without spread in the sizes seen, it is all fixed cost.
+ */
+static int switch_cost_fit(struct gpu_context* ctx, double* fixed_ms,
+                           double* ms_per_gib) {
+  double n = ctx->cost_n;
+  double det = n * ctx->cost_sxx - ctx->cost_sx * ctx->cost_sx;
+
+  if (n < SWITCH_COST_MIN_SAMPLES) return 0;
+  *ms_per_gib = 0;
+  if (det > 1e-9 * n * n)
+    *ms_per_gib = (n * ctx->cost_sxy - ctx->cost_sx * ctx->cost_sy) / det;
+  if (*ms_per_gib < 0) *ms_per_gib = 0;
+  *fixed_ms = (ctx->cost_sy - *ms_per_gib * ctx->cost_sx) / n;
+  if (*fixed_ms < 0) *fixed_ms = 0;
+  return 1;
+}
+
+/* Predicted cost of switching in the running memory (ms), -1 if unknown */
+static long predicted_switch_cost_ms(struct gpu_context* ctx) {
+  double fixed_ms, ms_per_gib;
+
+  if (!switch_cost_fit(ctx, &fixed_ms, &ms_per_gib)) return -1;
+  return (long)(fixed_ms + ms_per_gib * (double)ctx->running_memory_usage /
+                               (1024 * 1024 * 1024));
+}
+
+/*
+ * Time for a client's memory to come over the host link: its allocation at
+ * the configured bandwidth, else the one the switch cost model measured,
+ * else a PCIe 3.0 x16 guess.
+ */
+static long warmup_ms(struct gpu_context* ctx, struct xpushare_client* c) {
+  double fixed_ms, ms_per_gib;
+  double mib = (double)c->memory_allocated / (1024 * 1024);
+  long ms;
+
+  if (config.admission_bandwidth_mbps > 0)
+    ms = (long)(mib * 1000 / config.admission_bandwidth_mbps);
+  else if (switch_cost_fit(ctx, &fixed_ms, &ms_per_gib) && ms_per_gib > 0)
+    ms = (long)(mib / 1024 * ms_per_gib);
+  else
+    ms = (long)(mib * 1000 / XPUSHARE_DEFAULT_ADMISSION_BANDWIDTH_MBPS);
+  return ms < ADMISSION_PACE_MAX_MS ? ms : ADMISSION_PACE_MAX_MS;
+}
+
+static void pace_timer_fn(struct timer_wheel_timer* timer) {
+  try_schedule(timer->data);
+}
+
 static int calculate_switch_time(struct gpu_context* ctx) {
   if (config.mode == SWITCH_TIME_FIXED) {
     return config.fixed_switch_time;
   }
+  if (config.mode == SWITCH_TIME_MODEL) {
+    long cost_ms = predicted_switch_cost_ms(ctx);
+
+    /*
+     * Long enough for cost / (TQ + cost) to stay within the target. Until
+     * the model has samples, fall back to auto mode.
+     */
+    if (cost_ms >= 0) {
+      long tq_ms = cost_ms * (100 - config.switch_overhead_percent) /
+                   config.switch_overhead_percent;
+      long tq_sec = (tq_ms + 999) / 1000;
+
+      if (tq_sec < 1) tq_sec = 1;
+      if (tq_sec > 300) tq_sec = 300;
+      return (int)tq_sec;
+    }
+  }
   /* Auto mode: calculated based on memory usage */
   size_t mem_gb = ctx->running_memory_usage / (1024 * 1024 * 1024);
   int swap_time = (int)(mem_gb > 0 ? mem_gb : 1);
@@ -1174,206 +3047,594 @@ static int calculate_switch_time(struct gpu_context* ctx) {
 }
 
 /*
- * The timer thread's sole responsibility is to implement the Time Quantum
- * (TQ) notion of xpushare.
+ * Timers implement the Time Quantum (TQ) notion of xpushare and the compute
+ * limits. They run from the GPU's event loop, with ctx->lock held:
  *
- * It uses dynamic TQ based on memory usage, and only preempts if there
- * are other clients waiting.
+ * 1. tq_timer: TQ for fair scheduling, restarted whenever the lock is
+ *    granted. It only preempts if there are other clients waiting.
+ * 2. window_timer: resets the compute window and retries the wait queue,
+ *    while quota-limited clients are registered or anyone is waiting.
+ * 3. quota_timer: per running client, set for the moment its quota runs out
+ *    at the current concurrency (weighted billing).
  */
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
-
 /*
- * The timer thread implements the Time Quantum (TQ) and Compute Limits.
- *
- * It manages:
- * 1. Global TQ for fair scheduling.
- * 2. Per-client compute quota enforcement (window-based).
- * 3. Concurrent accounting for multiple running clients.
+ * TQ is dynamic, based on memory usage, unless the priority class of a
+ * client has its own. With MLFQ, that is the TQ of the lowest level.
  */
-void* timer_thr_fn(void* arg) {
-  struct gpu_context* ctx = (struct gpu_context*)arg;
-  struct message drop_msg = {0};
-  drop_msg.id = 1337;
-  drop_msg.type = DROP_LOCK;
+static long client_tq_ms(struct gpu_context* ctx,
+                         const struct xpushare_client* c) {
+  long tq_ms = (long)config.class_tq_sec[c->priority] * 1000;
+
+  if (tq_ms == 0) tq_ms = (long)calculate_switch_time(ctx) * 1000;
+  if (config.queue_policy == QUEUE_POLICY_MLFQ)
+    tq_ms >>= MLFQ_LEVELS - 1 - c->mlfq_level;
+  return tq_ms;
+}
 
-  struct timespec ts;
-  struct xpushare_request *req, *tmp;
-  long now_ms;
-  long min_sleep_ms;
-  long window_remaining_ms;
-  int default_tq_ms;
+/*
+ * The shortest TQ among the holders applies. With MLFQ, a waiter on a higher
+ * level than the holders cuts their TQ down to its own quantum, so a burst
+ * does not wait for a long run to finish.
+ */
+static long tq_length_ms(struct gpu_context* ctx) {
+  long tq_ms = LONG_MAX;
+  struct xpushare_client* c;
 
-  true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+    long c_ms = client_tq_ms(ctx, c);
+    if (c_ms < tq_ms) tq_ms = c_ms;
+  }
+  if (tq_ms == LONG_MAX) return (long)calculate_switch_time(ctx) * 1000;
 
-  while (1) {
-    /* 1. Reset window if expired */
-    if (check_and_reset_window(ctx)) {
-      /*
-       * Window reset occurred! This means throttled clients might be able
-       * to run now. Attempt to schedule them immediately.
-       * Since we hold global_mutex, we can safely call try_schedule.
-       */
-      /*
-       * IMPORTANT: In concurrent mode, we should NOT disturb running tasks
-       * unnecessarily. try_schedule will pick up finding tasks from waiting
-       * lists.
-       */
-      try_schedule(ctx);
+  if (config.queue_policy == QUEUE_POLICY_MLFQ) {
+    DL_FOREACH2(ctx->queues[QUEUE_REQUESTS], c, q_next) {
+      long c_ms = client_tq_ms(ctx, c);
+      if (c_ms < tq_ms) tq_ms = c_ms;
     }
-
-    /* 2. Calculate next sleep duration */
-    /* Base TQ is either fixed or auto-calculated */
-    int current_tq_sec = calculate_switch_time(ctx);
-    default_tq_ms = current_tq_sec * 1000;
-    min_sleep_ms = default_tq_ms;
-
-    /* Get current time for dynamic calculation */
-    now_ms = current_time_ms();
-
-    /* Never sleep past current compute-window boundary. */
-    window_remaining_ms = config.compute_window_ms;
-    if (ctx->window_start_ms > 0) {
-      long elapsed_in_window_ms = now_ms - ctx->window_start_ms;
-      window_remaining_ms = config.compute_window_ms - elapsed_in_window_ms;
-      if (window_remaining_ms < 0) {
-        window_remaining_ms = 0;
-      }
+    DL_FOREACH2(ctx->queues[QUEUE_WAIT], c, q_next) {
+      long c_ms = client_tq_ms(ctx, c);
+      if (c_ms < tq_ms) tq_ms = c_ms;
     }
+  }
+  return tq_ms;
+}
 
-    min_sleep_ms = MIN(min_sleep_ms, window_remaining_ms);
+static void arm_tq_timer(struct gpu_context* ctx) {
+  ctx->tq_start_ms = current_time_ms();
+  arm_timer(ctx, &ctx->tq_timer, ctx->tq_start_ms + tq_length_ms(ctx));
+  arm_prepare_timer(ctx);
+}
 
-    /* Check remaining quota for all running clients */
-    int n_running = count_running_clients(ctx);
-    LL_FOREACH(ctx->running_list, req) {
-      struct xpushare_client* c = req->client;
-      if (c->core_limit < 100) {
-        long limit_ms = get_effective_quota_ms(ctx, c);
+/*
+ * Switch pipelining: config.swap_prepare_ms before the TQ ends, but no
+ * earlier than half way into it.
+ */
+static void arm_prepare_timer(struct gpu_context* ctx) {
+  long tq_end_ms, lead_ms;
 
-        /* Use weighted billing: current wall time divided by concurrent count
-         */
-        long pending_wall_time = now_ms - c->current_run_start_ms;
-        long pending_billed = pending_wall_time / n_running;
-        long current_usage = c->run_time_in_window_ms + pending_billed;
-        long remaining = limit_ms - current_usage;
+  if (config.swap_prepare_ms == 0 || !timer_wheel_pending(&ctx->tq_timer)) {
+    timer_wheel_del(&ctx->timers, &ctx->prepare_timer);
+    return;
+  }
+  tq_end_ms = (long)ctx->tq_timer.expires;
+  lead_ms = config.swap_prepare_ms;
+  if (lead_ms > (tq_end_ms - ctx->tq_start_ms) / 2)
+    lead_ms = (tq_end_ms - ctx->tq_start_ms) / 2;
+  arm_timer(ctx, &ctx->prepare_timer, tq_end_ms - lead_ms);
+}
 
-        if (remaining <= 0) {
-          min_sleep_ms = 0; /* Already exceeded, process immediately */
-        } else {
-          /* Scale remaining time back to wall time for sleep calculation */
-          min_sleep_ms = MIN(min_sleep_ms, remaining * n_running);
-        }
-      }
-    }
+static void arm_window_timer(struct gpu_context* ctx) {
+  /* Idle unless there is a quota to enforce or someone to retry */
+  if (ctx->quota_sum == 0 && ctx->queues[QUEUE_WAIT] == NULL) {
+    timer_wheel_del(&ctx->timers, &ctx->window_timer);
+    return;
+  }
+  if (ctx->window_start_ms == 0) ctx->window_start_ms = current_time_ms();
+  arm_timer(ctx, &ctx->window_timer,
+            ctx->window_start_ms + config.compute_window_ms);
+}
 
-    /* With quota-limited running clients, sample more frequently than the
-     * switch interval so we can react quickly to running-set changes. */
-    if (config.quota_sample_interval_ms > 0) {
-      int has_quota_running = 0;
-      LL_FOREACH(ctx->running_list, req) {
-        if (req->client->core_limit < 100) {
-          has_quota_running = 1;
-          break;
-        }
-      }
-      if (has_quota_running) {
-        min_sleep_ms = MIN(min_sleep_ms, config.quota_sample_interval_ms);
-      }
-    }
+static void arm_quota_timer(struct gpu_context* ctx, struct xpushare_client* c,
+                            long now_ms) {
+  if (core_guarantee(c) >= 100 || c->is_throttled || c->pending_drop) {
+    timer_wheel_del(&ctx->timers, &c->quota_timer);
+    return;
+  }
 
-    /* Cap sleep to window size to ensure timely window resets */
-    if (min_sleep_ms > config.compute_window_ms) {
-      min_sleep_ms = config.compute_window_ms;
-    }
+  int n_running = count_running_clients(ctx);
+  long limit_ms = c->borrowing ? borrow_ceiling_ms(ctx, c)
+                               : get_effective_quota_ms(ctx, c);
+  long pending_billed = (now_ms - c->current_run_start_ms) / n_running;
+  long remaining = limit_ms - (c->run_time_in_window_ms + pending_billed);
+
+  /* Scale remaining time back to wall time */
+  arm_timer(ctx, &c->quota_timer,
+            now_ms + (remaining > 0 ? remaining * n_running : 0));
+}
+
+/* Call whenever concurrency, quotas or billed usage of a GPU change */
+static void rearm_quota_timers(struct gpu_context* ctx) {
+  struct xpushare_client* c;
+  long now_ms = current_time_ms();
+
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+    arm_quota_timer(ctx, c, now_ms);
+  }
+}
+
+/* DRR quantum, in pass units: how far a holder may get ahead of waiters */
+static long drr_quantum(struct gpu_context* ctx) {
+  if (config.drr_quantum_ms > 0) return config.drr_quantum_ms;
+  return tq_length_ms(ctx);
+}
+
+/* Smallest pass among clients waiting for the lock, LONG_MAX if none */
+static long min_waiting_pass(struct gpu_context* ctx) {
+  long pass = LONG_MAX;
+
+  /* Both queues are sorted, see queued_before() */
+  if (ctx->queues[QUEUE_REQUESTS] != NULL)
+    pass = ctx->queues[QUEUE_REQUESTS]->drr_pass;
+  if (ctx->queues[QUEUE_WAIT] != NULL &&
+      ctx->queues[QUEUE_WAIT]->drr_pass < pass)
+    pass = ctx->queues[QUEUE_WAIT]->drr_pass;
+  return pass;
+}
 
-    /* Avoid busy loop, but preserve sub-10ms sleeps near window boundary. */
-    if (min_sleep_ms > 0 && min_sleep_ms < 10 && window_remaining_ms > 10) {
-      min_sleep_ms = 10;
+/*
+ * DRR: a holder may run until its pass is a quantum ahead of the client owed
+ * the most lock time, then share_timer asks it to drop the lock. Call
+ * whenever the running or waiting clients of a GPU change.
+ */
+static void arm_share_timers(struct gpu_context* ctx) {
+  struct xpushare_client* c;
+  long waiting;
+
+  if (config.queue_policy != QUEUE_POLICY_DRR) return;
+
+  waiting = min_waiting_pass(ctx);
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+    if (waiting == LONG_MAX || c->last_drop_sent_ms > 0) {
+      timer_wheel_del(&ctx->timers, &c->share_timer);
+      continue;
     }
+    long left = waiting + drr_quantum(ctx) - c->drr_pass;
+    arm_timer(ctx, &c->share_timer,
+              c->lock_granted_ms + (left > 0 ? left * c->core_limit / 100 : 0));
+  }
+}
+
+static void share_timer_fn(struct timer_wheel_timer* timer) {
+  struct xpushare_client* c = timer->data;
+  struct gpu_context* ctx = c->context;
+  long now_ms = current_time_ms();
+  long waiting = min_waiting_pass(ctx);
+  long pass = c->drr_pass + (now_ms - c->lock_granted_ms) * 100 / c->core_limit;
+
+  if (waiting == LONG_MAX || c->last_drop_sent_ms > 0) return;
+  if (pass < waiting + drr_quantum(ctx)) { /* Rounding */
+    arm_share_timers(ctx);
+    return;
+  }
+
+  log_info("Client %016" PRIx64 " used its DRR quantum, dropping its lock",
+           c->id);
+  preempt_client(c, now_ms);
+}
+
+/*
+ * MLFQ: clients are classified by how they use the lock, no annotation
+ * needed. Everyone starts on level 0. Using up the quantum of a level moves
+ * a client down one, where the quantum is twice as long; giving the lock
+ * back within half of it, or asking for it again only after a pause longer
+ * than it, moves a client up one.
+ */
+static void mlfq_set_level(struct xpushare_client* c, int level,
+                           const char* why) {
+  log_info("Client %016" PRIx64 " %s, MLFQ level %d -> %d", c->id, why,
+           c->mlfq_level, level);
+  c->mlfq_level = level;
+}
+
+/* On a new lock request, before the client is queued */
+static void mlfq_request(struct xpushare_client* c) {
+  long released_ms = c->lock_granted_ms + c->last_hold_ms;
+
+  if (c->mlfq_level == 0 || c->lock_granted_ms == 0) return;
+  if (current_time_ms() - released_ms >= client_tq_ms(c->context, c))
+    mlfq_set_level(c, c->mlfq_level - 1, "was idle");
+}
+
+/* On a release, with last_hold_ms and last_drop_sent_ms still up to date */
+static void mlfq_feedback(struct xpushare_client* c) {
+  long quantum_ms = client_tq_ms(c->context, c);
+
+  if (c->last_hold_ms >= quantum_ms) {
+    if (c->mlfq_level < MLFQ_LEVELS - 1)
+      mlfq_set_level(c, c->mlfq_level + 1, "used its quantum");
+  } else if (c->last_drop_sent_ms == 0 && c->last_hold_ms < quantum_ms / 2) {
+    if (c->mlfq_level > 0)
+      mlfq_set_level(c, c->mlfq_level - 1, "released early");
+  }
+}
+
+/* Put the clients of a queue back in queued_before() order */
+static void resort_queue(struct gpu_context* ctx, enum client_queue queue) {
+  struct xpushare_client *list = ctx->queues[queue], *c;
+
+  ctx->queues[queue] = NULL;
+  ctx->queue_len[queue] = 0;
+  while ((c = list) != NULL) {
+    DL_DELETE2(list, c, q_prev, q_next);
+    c->queue = QUEUE_NONE;
+    queue_move(c, queue);
+  }
+}
+
+/*
+ * Every config.mlfq_boost_ms, all clients go back to level 0, so that long
+ * runs are not starved by a steady stream of bursts, and clients that
+ * changed their ways get reclassified.
+ */
+static void mlfq_boost(struct gpu_context* ctx) {
+  struct xpushare_client* c;
+  long now_ms = current_time_ms();
+
+  if (config.mlfq_boost_ms == 0 ||
+      now_ms - ctx->mlfq_boost_ms < config.mlfq_boost_ms)
+    return;
+  ctx->mlfq_boost_ms = now_ms;
+
+  DL_FOREACH2(ctx->clients, c, ctx_next) {
+    c->mlfq_level = 0;
+  }
+  resort_queue(ctx, QUEUE_REQUESTS);
+  resort_queue(ctx, QUEUE_WAIT);
+}
+
+/*
+ * Shortly before the TQ ends, tell the holders that will be preempted to
+ * start writing back (PREPARE_SWAP_OUT), and the client next in line to
+ * start prefetching (PREPARE_SWAP_IN). The LOCK_OK that follows the drain
+ * then finds most of its pages on the GPU already.
+ */
+static void prepare_timer_fn(struct timer_wheel_timer* timer) {
+  struct gpu_context* ctx = timer->data;
+  struct xpushare_client *c, *next;
+  struct message msg = {0};
+  int sent = 0;
+
+  next = ctx->queues[QUEUE_REQUESTS] != NULL ? ctx->queues[QUEUE_REQUESTS]
+                                             : ctx->queues[QUEUE_WAIT];
+  if (next == NULL || ctx->queues[QUEUE_RUNNING] == NULL) return;
+
+  /* A dead client is noticed by the event loop, as with DROP_LOCK */
+  msg.type = PREPARE_SWAP_OUT;
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+    /* Same as tq_timer_fn(): the rest keep the lock */
+    if (c->is_throttled || c->last_drop_sent_ms > 0 || c->swap_prepared)
+      continue;
+    c->swap_prepared = 1;
+    send_message(c, &msg);
+    sent = 1;
+  }
+  if (!next->swap_prepared) {
+    msg.type = PREPARE_SWAP_IN;
+    next->swap_prepared = 1;
+    send_message(next, &msg);
+    sent = 1;
+  }
+
+  if (sent) {
+    ctx->prepared_count++;
+    log_debug("Prepared switch to client %016" PRIx64, next->id);
+  }
+}
 
-    /* 3. Sleep */
-    clock_gettime(CLOCK_REALTIME, &ts);
+static void tq_timer_fn(struct timer_wheel_timer* timer) {
+  struct gpu_context* ctx = timer->data;
+  struct xpushare_client* c;
+  struct message msg = {0};
 
-    long sec = min_sleep_ms / 1000;
-    long nsec = (min_sleep_ms % 1000) * 1000000;
-    ts.tv_sec += sec;
-    ts.tv_nsec += nsec;
-    if (ts.tv_nsec >= 1000000000) {
-      ts.tv_sec++;
-      ts.tv_nsec -= 1000000000;
+  /* Logic for global rotation if multiple tasks are waiting */
+  if (ctx->queues[QUEUE_REQUESTS] != NULL || ctx->queues[QUEUE_WAIT] != NULL) {
+    /* Send DROP_LOCK to all running clients to force rotation */
+    /* Note: This simplistic approach complements targeted throttling */
+    long now_ms = current_time_ms();
+    DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+      if (!c->is_throttled && c->last_drop_sent_ms == 0)
+        preempt_client(c, now_ms);
+    }
+  } else {
+    /* The waiters left since PREPARE_SWAP_OUT, take it back */
+    msg.type = CANCEL_SWAP_OUT;
+    DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+      if (!c->swap_prepared) continue;
+      c->swap_prepared = 0;
+      send_message(c, &msg);
     }
+  }
 
-    int ret = pthread_cond_timedwait(&ctx->timer_cv, &global_mutex, &ts);
+  if (ctx->lock_held) arm_tq_timer(ctx);
+}
 
-    /* 4. Update Usage (Full Accounting) - REMOVED */
-    /* We now update usage on remove_req for precise accounting. */
-    now_ms = current_time_ms();
+static void window_timer_fn(struct timer_wheel_timer* timer) {
+  struct gpu_context* ctx = timer->data;
 
-    /* 5. Enforce Limits (Targeted Throttling) with weighted billing */
-    int n_running_now = count_running_clients(ctx);
-    LL_FOREACH_SAFE(ctx->running_list, req, tmp) {
-      struct xpushare_client* c = req->client;
-      if (c->core_limit < 100 && !c->is_throttled && !c->pending_drop) {
-        long limit_ms = get_effective_quota_ms(ctx, c);
+  if (check_and_reset_window(ctx)) {
+    /*
+     * Throttled clients might be able to run now. In concurrent mode we
+     * don't disturb running tasks, try_schedule only looks at the queues.
+     */
+    try_schedule(ctx);
+  } else {
+    /* The window was restarted elsewhere, follow it */
+    arm_window_timer(ctx);
+  }
+}
 
-        /* Dynamic check with weighted billing: accumulated + weighted pending
-         */
-        long pending_wall_time = now_ms - c->current_run_start_ms;
-        long pending_billed = pending_wall_time / n_running_now;
-        long current_usage = c->run_time_in_window_ms + pending_billed;
-
-        if (current_usage >= limit_ms) {
-          log_info("Throttling client %016" PRIx64
-                   " (Used: %ld/%ld ms, weighted, wall=%ld, billed=%ld, "
-                   "concurrent=%d)",
-                   c->id, current_usage, limit_ms, pending_wall_time,
-                   pending_billed, n_running_now);
-          c->is_throttled = 1;
-          c->pending_drop = 1;
-          c->drop_concurrency = n_running_now > 0 ? n_running_now : 1;
-          /* Update stored usage with weighted billing */
-          c->run_time_in_window_ms += pending_billed;
-          c->current_run_start_ms = now_ms; /* Start tail accounting */
-          c->last_drop_sent_ms = now_ms;
-
-          send_message(c, &drop_msg);
-          metrics_inc_drop_lock();
-          /*
-           * We don't remove from running_list here. Client will
-           * reply with LOCK_RELEASED, which triggers removal.
-           */
-        }
-      }
+static void quota_timer_fn(struct timer_wheel_timer* timer) {
+  struct xpushare_client* c = timer->data;
+  struct gpu_context* ctx = c->context;
+  long now_ms = current_time_ms();
+  int n_running_now = count_running_clients(ctx);
+  long limit_ms = c->borrowing ? borrow_ceiling_ms(ctx, c)
+                               : get_effective_quota_ms(ctx, c);
+
+  /* Dynamic check with weighted billing: accumulated + weighted pending */
+  long pending_wall_time = now_ms - c->current_run_start_ms;
+  long pending_billed = pending_wall_time / n_running_now;
+  long current_usage = c->run_time_in_window_ms + pending_billed;
+
+  if (current_usage < limit_ms) { /* Rounding, not quite there yet */
+    arm_quota_timer(ctx, c, now_ms);
+    return;
+  }
+
+  if (!c->borrowing && c->core_limit > core_guarantee(c)) {
+    c->run_time_in_window_ms += pending_billed;
+    c->current_run_start_ms = now_ms;
+    if (may_borrow(ctx, c)) {
+      log_info("Client %016" PRIx64
+               " used its guarantee (%ld ms), borrowing up to %ld ms",
+               c->id, limit_ms, borrow_ceiling_ms(ctx, c));
+      c->borrowing = 1;
+      arm_quota_timer(ctx, c, now_ms);
+    } else {
+      /* Others are owed the GPU, but it may borrow once they are done */
+      log_info("Client %016" PRIx64
+               " used its guarantee (%ld ms), making way for waiters",
+               c->id, limit_ms);
+      preempt_client(c, now_ms);
     }
+    return;
+  }
 
-    /* 6. Enforce Global Preemption (if TQ elapsed) */
-    if (ret == ETIMEDOUT && min_sleep_ms >= default_tq_ms) {
-      /* If we slept for the full TQ, check if we need to preempt everyone */
-      /* Logic for global rotation if multiple tasks are waiting */
-      if (ctx->requests != NULL || ctx->wait_queue != NULL) {
-        /* Send DROP_LOCK to all running clients to force rotation */
-        /* Note: This simplistic approach complements targeted throttling */
-        now_ms = current_time_ms();
-        int n_running_global = count_running_clients(ctx);
-        LL_FOREACH(ctx->running_list, req) {
-          if (!req->client->is_throttled &&
-              req->client->last_drop_sent_ms == 0) {
-            req->client->pending_drop = 1;
-            req->client->drop_concurrency =
-                n_running_global > 0 ? n_running_global : 1;
-            req->client->last_drop_sent_ms = now_ms;
-            send_message(req->client, &drop_msg);
-            metrics_inc_drop_lock();
-          }
-        }
-      }
+  log_info("Throttling client %016" PRIx64
+           " (Used: %ld/%ld ms, weighted, wall=%ld, billed=%ld, "
+           "concurrent=%d)",
+           c->id, current_usage, limit_ms, pending_wall_time, pending_billed,
+           n_running_now);
+  c->is_throttled = 1;
+  c->pending_drop = 1;
+  c->drop_concurrency = n_running_now > 0 ? n_running_now : 1;
+  /* Update stored usage with weighted billing */
+  c->run_time_in_window_ms += pending_billed;
+  c->current_run_start_ms = now_ms; /* Start tail accounting */
+
+  send_drop_lock(c, now_ms);
+  /*
+   * We don't remove from running_list here. Client will
+   * reply with LOCK_RELEASED, which triggers removal, or overrun its lease.
+   */
+}
+
+static void lease_timer_fn(struct timer_wheel_timer* timer) {
+  struct xpushare_client* c = timer->data;
+  struct gpu_context* ctx = c->context;
+  long now_ms = current_time_ms();
+
+  log_warn("Client %016" PRIx64
+           " has not released the lock %ld ms after DROP_LOCK, marking it "
+           "overdue",
+           c->id, now_ms - c->last_drop_sent_ms);
+
+  /* Settle what it ran so far as usual, from here on it pays in full */
+  if (c->pending_drop) {
+    c->run_time_in_window_ms +=
+        drop_tail_billed(c, now_ms - c->current_run_start_ms);
+  } else {
+    accrue_running_usage(ctx, now_ms, NULL);
+  }
+  c->pending_drop = 1;
+  c->current_run_start_ms = now_ms;
+  timer_wheel_del(&ctx->timers, &c->quota_timer);
+
+  c->lease_overdue = 1;
+  c->lease_overdue_count++;
+  ctx->nr_overdue++;
+  metrics_inc_lease_overdue();
+
+  /* Let the next waiter in next to it, if memory allows */
+  check_wait_queue(ctx);
+  try_schedule(ctx);
+}
+
+/*
+ * Check the running set of a GPU against its safe limit after client grew.
+ * Must be called with ctx->lock held.
+ */
+static void check_overload(struct gpu_context* ctx,
+                           struct xpushare_client* client) {
+  size_t safe_limit = safe_memory_limit(ctx);
+  size_t resident = running_resident_memory(ctx);
+
+  if (resident <= safe_limit) return;
+  if (!ctx->memory_overloaded) {
+    ctx->memory_overloaded = 1;
+    ctx->overload_low_since_ms = 0;
+    ctx->overload_enter_count++;
+    log_warn("Memory overload detected on GPU %s: %zu MB > %zu MB limit",
+             ctx->uuid, resident / (1024 * 1024), safe_limit / (1024 * 1024));
+  }
+  /* Serial admission from now on; shed just enough runners */
+  preempt_for_memory(ctx, client, safe_limit);
+}
+
+/*
+ * Memory every client of a GPU keeps resident, running or not: what the GPU
+ * would have to hold if it went back to concurrent admission.
+ */
+static size_t demanded_memory(struct gpu_context* ctx) {
+  struct xpushare_client* c;
+  size_t total = 0;
+
+  DL_FOREACH2(ctx->clients, c, ctx_next) total += resident_memory(c);
+  return total;
+}
+
+/*
+ * Hysteresis for the memory overload fallback: it ends once the demand on
+ * the GPU has stayed below the low watermark for the dwell time. Call when
+ * the demand changes. Must be called with ctx->lock held.
+ */
+static void check_overload_recovery(struct gpu_context* ctx) {
+  size_t low_limit;
+
+  if (!ctx->memory_overloaded) return;
+
+  low_limit = ctx->total_memory * config.mem_wm_low_percent / 100;
+  if (demanded_memory(ctx) + unmanaged_memory(ctx) > low_limit) {
+    ctx->overload_low_since_ms = 0;
+    timer_wheel_del(&ctx->timers, &ctx->recovery_timer);
+    return;
+  }
+
+  if (ctx->overload_low_since_ms == 0) {
+    ctx->overload_low_since_ms = current_time_ms();
+    arm_timer(ctx, &ctx->recovery_timer,
+              ctx->overload_low_since_ms + config.mem_recovery_dwell_ms);
+  }
+}
+
+static void recovery_timer_fn(struct timer_wheel_timer* timer) {
+  struct gpu_context* ctx = timer->data;
+
+  log_info("Memory demand on GPU %s below %d%% for %ld ms (%zu MB), leaving "
+           "serial fallback",
+           ctx->uuid, config.mem_wm_low_percent,
+           current_time_ms() - ctx->overload_low_since_ms,
+           demanded_memory(ctx) / (1024 * 1024));
+  ctx->memory_overloaded = 0;
+  ctx->overload_low_since_ms = 0;
+  ctx->overload_exit_count++;
+
+  /* Waiters held back by the fallback may fit next to the holders now */
+  check_wait_queue(ctx);
+  try_schedule(ctx);
+}
+
+/*
+ * Thrash detection, AUTO mode. Co-runners whose working sets don't fit
+ * together keep faulting each other's pages in and out, and may get next to
+ * nothing done where each would run fine alone. Memory accounting can miss
+ * this: allocations are not working sets.
+ *
+ * Clients report how many kernels they complete per ms (CLIENT_PROGRESS). A
+ * sample taken alone feeds the client's solo rate, one taken next to others
+ * is held against it. Time-sliced co-runners add up to about one solo run;
+ * once they add up to less than config.thrash_progress_percent of that, the
+ * GPU goes serial. After thrash_backoff_ms it probes co-running again, and a
+ * probe that thrashes too doubles the wait.
+ *
+ * Must be called with ctx->lock held.
+ */
+static void check_thrash(struct gpu_context* ctx, long now_ms) {
+  struct xpushare_client *c, *tmp, *keep = NULL;
+  double progress = 0;
+  int n = 0;
+
+  DL_FOREACH2(ctx->queues[QUEUE_RUNNING], c, q_next) {
+    if (c->corun_ms < ctx->running_changed_ms ||
+        now_ms - c->corun_ms > THRASH_SAMPLE_MAX_AGE_MS)
+      continue;
+    /* Never ran alone: nothing to hold it against */
+    if (c->solo_rate <= 0) return;
+    progress += c->corun_rate / c->solo_rate;
+    n++;
+  }
+  if (n < 2) return;
+
+  ctx->corun_progress = progress;
+  if (progress * 100 >= config.thrash_progress_percent) {
+    if (ctx->thrash_probing) {
+      log_info("Co-run probe on GPU %s passed: %d clients at %.0f%% of a "
+               "solo run",
+               ctx->uuid, n, progress * 100);
+      ctx->thrash_probing = 0;
+      ctx->thrash_backoff_ms = config.thrash_probe_ms;
     }
+    return;
+  }
 
-    /* Handle must_reset_timer flag */
-    if (ctx->must_reset_timer) {
-      ctx->must_reset_timer = 0;
+  if (ctx->thrash_probing &&
+      ctx->thrash_backoff_ms < (long)config.thrash_probe_ms * THRASH_BACKOFF_MAX)
+    ctx->thrash_backoff_ms *= 2;
+  ctx->thrash_probing = 0;
+  ctx->thrashing = 1;
+  ctx->thrash_enter_count++;
+  log_warn("Co-running clients on GPU %s thrash: %d clients at %.0f%% of a "
+           "solo run, serial for %ld ms",
+           ctx->uuid, n, progress * 100, ctx->thrash_backoff_ms);
+
+  /* The longest running holder keeps the GPU, the others make way */
+  DL_FOREACH_SAFE2(ctx->queues[QUEUE_RUNNING], c, tmp, q_next) {
+    if (c->last_drop_sent_ms > 0) continue;
+    if (keep == NULL) {
+      keep = c;
       continue;
     }
+    preempt_client(c, now_ms);
   }
+  arm_timer(ctx, &ctx->thrash_timer, now_ms + ctx->thrash_backoff_ms);
+}
+
+/* A CLIENT_PROGRESS sample: kernels completed in busy_ms */
+static void observe_progress(struct xpushare_client* c, long kernels,
+                             long busy_ms) {
+  struct gpu_context* ctx = c->context;
+  long now_ms = current_time_ms();
+  long since_ms = c->progress_since_ms;
+  double rate = (double)kernels / busy_ms;
+
+  c->progress_since_ms = now_ms;
+  if (config.scheduling_mode != SCHED_MODE_AUTO ||
+      config.thrash_progress_percent == 0 || c->queue != QUEUE_RUNNING)
+    return;
+  /* Clients came or went while it was taken */
+  if (since_ms < ctx->running_changed_ms) return;
+
+  if (ctx->queue_len[QUEUE_RUNNING] == 1) {
+    c->solo_rate =
+        c->solo_rate <= 0 ? rate : (c->solo_rate * 3 + rate) / 4;
+    return;
+  }
+  c->corun_rate = rate;
+  c->corun_ms = now_ms;
+  if (!ctx->thrashing && !ctx->memory_overloaded) check_thrash(ctx, now_ms);
+}
+
+static void thrash_timer_fn(struct timer_wheel_timer* timer) {
+  struct gpu_context* ctx = timer->data;
+
+  log_info("GPU %s serial for %ld ms after thrashing, probing co-running",
+           ctx->uuid, ctx->thrash_backoff_ms);
+  ctx->thrashing = 0;
+  ctx->thrash_probing = 1;
+  ctx->thrash_exit_count++;
+
+  check_wait_queue(ctx);
+  try_schedule(ctx);
 }
 
 /* Annotation watcher configuration */
@@ -1405,24 +3666,250 @@ static int send_update_core_limit(struct xpushare_client* client,
   out_msg.id = client->id;
   out_msg.core_limit = new_core_limit;
 
-  client_id_as_string(id_str, sizeof(id_str), client->id);
-  log_info("Sending UPDATE_CORE_LIMIT to client %s: %d%%", id_str,
-           new_core_limit);
+  client_id_as_string(id_str, sizeof(id_str), client->id);
+  log_info("Sending UPDATE_CORE_LIMIT to client %s: %d%%", id_str,
+           new_core_limit);
+
+  return send_message(client, &out_msg);
+}
+
+/* Helper struct for snapshotting clients to avoid holding lock during I/O */
+struct client_info {
+  uint64_t id;
+  struct gpu_context* context;
+  char pod_name[POD_NAME_LEN_MAX];
+  char pod_namespace[POD_NAMESPACE_LEN_MAX];
+  struct client_info* next;
+};
+
+static struct client_info* new_client_info(struct xpushare_client* client) {
+  struct client_info* info = malloc(sizeof(struct client_info));
+
+  true_or_exit(info != NULL);
+  info->id = client->id;
+  info->context = client->context;
+  strlcpy(info->pod_name, client->pod_name, sizeof(info->pod_name));
+  strlcpy(info->pod_namespace, client->pod_namespace,
+          sizeof(info->pod_namespace));
+  info->next = NULL;
+  return info;
+}
+
+/*
+ * Called without any lock held. It never takes a ctx->lock while holding
+ * namespace_weights_mutex, that would invert the lock order.
+ */
+static int lookup_namespace_weight(const char* ns) {
+  static const char* const keys[] = {NAMESPACE_WEIGHT_ANNOTATION};
+  struct namespace_weight* w;
+  char* value;
+  int weight = 1;
+
+  true_or_exit(pthread_mutex_lock(&namespace_weights_mutex) == 0);
+  w = find_namespace_weight(ns);
+  if (w != NULL) weight = w->weight;
+  if (w != NULL && time(NULL) - w->fetched < ANNOTATION_CHECK_INTERVAL_SEC) {
+    true_or_exit(pthread_mutex_unlock(&namespace_weights_mutex) == 0);
+    return weight;
+  }
+  true_or_exit(pthread_mutex_unlock(&namespace_weights_mutex) == 0);
+
+  /* A namespace that can't be fetched keeps the weight it had */
+  if (k8s_get_namespace_annotations(ns, keys, &value, 1) == 0) {
+    weight = 1;
+    if (value != NULL && atoi(value) >= 1) weight = atoi(value);
+    free(value);
+  }
+
+  true_or_exit(pthread_mutex_lock(&namespace_weights_mutex) == 0);
+  w = find_namespace_weight(ns);
+  if (w == NULL) {
+    true_or_exit(w = calloc(1, sizeof(*w)));
+    strlcpy(w->ns, ns, sizeof(w->ns));
+    LL_PREPEND(namespace_weights, w);
+  }
+  w->weight = weight;
+  w->fetched = time(NULL);
+  true_or_exit(pthread_mutex_unlock(&namespace_weights_mutex) == 0);
+  return weight;
+}
+
+/*
+ * Look up the limits of a client's Pod and apply the ones that changed.
+ *
+ * Called without any lock held; the API request is made before taking the
+ * client's GPU lock. If the Pod cannot be fetched the limits are left alone.
+ */
+static void refresh_pod_limits(const struct client_info* info) {
+  static const char* const keys[] = {
+      MEMORY_LIMIT_ANNOTATION, CORE_LIMIT_ANNOTATION, PRIORITY_ANNOTATION,
+      MAX_WAIT_ANNOTATION, CORE_REQUEST_ANNOTATION};
+  char* values[5];
+  struct gpu_context* ctx = info->context;
+  struct xpushare_client* target_client;
+
+  if (k8s_get_pod_annotations(info->pod_namespace, info->pod_name, keys,
+                              values, 5) < 0)
+    return;
+  char* mem_limit_str = values[0];
+  char* core_limit_str = values[1];
+  char* priority_str = values[2];
+  char* max_wait_str = values[3];
+  char* core_request_str = values[4];
+  int ns_weight = lookup_namespace_weight(info->pod_namespace);
+
+  true_or_exit(pthread_mutex_lock(&ctx->lock) == 0);
+
+  /* Must find the client again as it might have disconnected */
+  true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
+  target_client = client_table_find(info->id);
+  if (target_client && target_client->context != ctx) target_client = NULL;
+  true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
+
+  if (target_client) {
+    /* Update Memory Limit */
+    if (mem_limit_str) {
+      size_t new_limit = parse_memory_size(mem_limit_str);
+      if (new_limit > 0 && new_limit != target_client->memory_limit) {
+        log_info("Memory limit changed for pod %s/%s: %zu -> %zu bytes",
+                 target_client->pod_namespace, target_client->pod_name,
+                 target_client->memory_limit, new_limit);
+        target_client->memory_limit = new_limit;
+        send_update_limit(target_client, new_limit);
+      }
+    }
+
+    /* Update Compute Request and Limit */
+    int new_core_limit = 100;
+    if (core_limit_str) {
+      int val = atoi(core_limit_str);
+      if (val >= 1 && val <= 100) new_core_limit = val;
+    }
+    int new_core_request = 0;
+    if (core_request_str) {
+      int val = atoi(core_request_str);
+      if (val >= 1 && val <= 100) new_core_request = val;
+    }
+
+    if (new_core_limit != target_client->core_limit ||
+        new_core_request != target_client->core_request) {
+      int old_guarantee = core_guarantee(target_client);
+      int old_core_limit = target_client->core_limit;
+
+      /* Re-arms the quota timers of this GPU */
+      set_core_limit(target_client, new_core_request, new_core_limit);
+      log_info("Compute request/limit changed for pod %s/%s: %d%%/%d%% -> "
+               "%d%%/%d%%",
+               target_client->pod_namespace, target_client->pod_name,
+               old_guarantee, old_core_limit, core_guarantee(target_client),
+               new_core_limit);
+      /* The client takes the lock for as long as it is guaranteed less */
+      if (core_guarantee(target_client) != old_guarantee)
+        send_update_core_limit(target_client, core_guarantee(target_client));
+    }
+
+    /* Update Namespace Weight */
+    if (ns_weight != target_client->ns_weight) {
+      log_info("Namespace weight changed for pod %s/%s: %d -> %d",
+               target_client->pod_namespace, target_client->pod_name,
+               target_client->ns_weight, ns_weight);
+      set_namespace_weight(target_client, ns_weight);
+    }
+
+    /* Update Priority Class */
+    enum priority_class new_priority = PRIORITY_STANDARD;
+    if (priority_str) {
+      int i;
+      for (i = 0; i < NR_PRIORITY_CLASSES; i++)
+        if (strcmp(priority_str, priority_class_names[i]) == 0) break;
+      if (i < NR_PRIORITY_CLASSES)
+        new_priority = (enum priority_class)i;
+      else
+        log_warn("Unknown priority class %s for pod %s/%s, using %s",
+                 priority_str, target_client->pod_namespace,
+                 target_client->pod_name,
+                 priority_class_names[PRIORITY_STANDARD]);
+    }
+
+    if (new_priority != target_client->priority) {
+      log_info("Priority class changed for pod %s/%s: %s -> %s",
+               target_client->pod_namespace, target_client->pod_name,
+               priority_class_names[target_client->priority],
+               priority_class_names[new_priority]);
+      set_priority(target_client, new_priority);
+    }
+
+    /* Update Lock Wait SLO */
+    long new_max_wait_ms = 0;
+    if (max_wait_str) {
+      long val = atol(max_wait_str);
+      if (val > 0) new_max_wait_ms = val;
+    }
+
+    if (new_max_wait_ms != target_client->max_wait_ms) {
+      log_info("Lock wait SLO changed for pod %s/%s: %ld -> %ld ms",
+               target_client->pod_namespace, target_client->pod_name,
+               target_client->max_wait_ms, new_max_wait_ms);
+      set_max_wait(target_client, new_max_wait_ms);
+    }
+  }
+
+  true_or_exit(pthread_mutex_unlock(&ctx->lock) == 0);
 
-  return send_message(client, &out_msg);
+  if (mem_limit_str) free(mem_limit_str);
+  if (core_limit_str) free(core_limit_str);
+  if (priority_str) free(priority_str);
+  if (max_wait_str) free(max_wait_str);
+  if (core_request_str) free(core_request_str);
 }
 
 /*
- * Annotation watcher thread - periodically checks pod annotations
- * for memory limit changes and notifies clients.
+ * Initial limits lookups of freshly registered clients, served by a few
+ * worker threads so that a slow API server delays neither the registration
+ * nor the clients queued behind it.
  */
-/* Helper struct for snapshotting clients to avoid holding lock during I/O */
-struct client_info {
-  uint64_t id;
-  char pod_name[POD_NAME_LEN_MAX];
-  char pod_namespace[POD_NAMESPACE_LEN_MAX];
-  struct client_info* next;
-};
+#define LIMITS_LOOKUP_WORKERS 4
+
+static pthread_mutex_t lookup_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lookup_cond = PTHREAD_COND_INITIALIZER;
+static struct client_info* lookup_queue = NULL;
+static int lookups_enabled = 0;
+
+/* Called with the client's GPU lock held, right after registration */
+static void queue_limits_lookup(struct xpushare_client* client) {
+  if (!lookups_enabled) return;
+  if (client->pod_name[0] == '\0' || client->pod_namespace[0] == '\0')
+    return;
+
+  true_or_exit(pthread_mutex_lock(&lookup_mutex) == 0);
+  LL_APPEND(lookup_queue, new_client_info(client));
+  true_or_exit(pthread_cond_signal(&lookup_cond) == 0);
+  true_or_exit(pthread_mutex_unlock(&lookup_mutex) == 0);
+}
+
+void* limits_lookup_fn(void* arg __attribute__((unused))) {
+  struct client_info* info;
+  int gone;
+
+  while (1) {
+    true_or_exit(pthread_mutex_lock(&lookup_mutex) == 0);
+    while (lookup_queue == NULL)
+      true_or_exit(pthread_cond_wait(&lookup_cond, &lookup_mutex) == 0);
+    info = lookup_queue;
+    LL_DELETE(lookup_queue, info);
+    true_or_exit(pthread_mutex_unlock(&lookup_mutex) == 0);
+
+    /* Short-lived clients may be gone already, spare the API server */
+    true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
+    gone = client_table_find(info->id) == NULL;
+    true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
+
+    if (!gone) refresh_pod_limits(info);
+    free(info);
+  }
+
+  return NULL;
+}
 
 /*
  * Annotation watcher thread - periodically checks pod annotations
@@ -1435,84 +3922,29 @@ void* annotation_watcher_fn(void* arg __attribute__((unused))) {
   while (1) {
     sleep(ANNOTATION_CHECK_INTERVAL_SEC);
 
-    /* 1. Snapshot registered clients quickly while holding lock */
+    /* 1. Snapshot registered clients quickly, one GPU at a time */
     struct client_info* snapshot = NULL;
     struct xpushare_client* client;
+    struct gpu_context* ctx;
 
     true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
-    LL_FOREACH(clients, client) {
-      /* Skip clients without pod info */
-      if (client->pod_name[0] != '\0' && client->pod_namespace[0] != '\0') {
-        struct client_info* info = malloc(sizeof(struct client_info));
-        info->id = client->id;
-        strlcpy(info->pod_name, client->pod_name, sizeof(info->pod_name));
-        strlcpy(info->pod_namespace, client->pod_namespace,
-                sizeof(info->pod_namespace));
-        LL_APPEND(snapshot, info);
+    ctx = gpu_contexts;
+    true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
+
+    for (; ctx != NULL; ctx = ctx->next) {
+      true_or_exit(pthread_mutex_lock(&ctx->lock) == 0);
+      DL_FOREACH2(ctx->clients, client, ctx_next) {
+        /* Skip clients without pod info */
+        if (client->pod_name[0] != '\0' && client->pod_namespace[0] != '\0')
+          LL_APPEND(snapshot, new_client_info(client));
       }
+      true_or_exit(pthread_mutex_unlock(&ctx->lock) == 0);
     }
-    true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
 
-    /* 2. Perform slow network I/O without lock */
+    /* 2. Perform slow network I/O without lock, then update each client */
     struct client_info *info, *tmp;
     LL_FOREACH_SAFE(snapshot, info, tmp) {
-      /* Query K8s API for annotation */
-      char* mem_limit_str = k8s_get_pod_annotation(
-          info->pod_namespace, info->pod_name, MEMORY_LIMIT_ANNOTATION);
-
-      char* core_limit_str = k8s_get_pod_annotation(
-          info->pod_namespace, info->pod_name, CORE_LIMIT_ANNOTATION);
-
-      /* 3. Re-acquire lock to update client state */
-      true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
-
-      /* Must find the client again as it might have disconnected */
-      struct xpushare_client* target_client = NULL;
-      LL_FOREACH(clients, client) {
-        if (client->id == info->id) {
-          target_client = client;
-          break;
-        }
-      }
-
-      if (target_client) {
-        /* Update Memory Limit */
-        if (mem_limit_str) {
-          size_t new_limit = parse_memory_size(mem_limit_str);
-          if (new_limit > 0 && new_limit != target_client->memory_limit) {
-            log_info("Memory limit changed for pod %s/%s: %zu -> %zu bytes",
-                     target_client->pod_namespace, target_client->pod_name,
-                     target_client->memory_limit, new_limit);
-            target_client->memory_limit = new_limit;
-            send_update_limit(target_client, new_limit);
-          }
-        }
-
-        /* Update Compute Limit */
-        int new_core_limit = 100;
-        if (core_limit_str) {
-          int val = atoi(core_limit_str);
-          if (val >= 1 && val <= 100) new_core_limit = val;
-        }
-
-        if (new_core_limit != target_client->core_limit) {
-          log_info("Compute limit changed for pod %s/%s: %d%% -> %d%%",
-                   target_client->pod_namespace, target_client->pod_name,
-                   target_client->core_limit, new_core_limit);
-          target_client->core_limit = new_core_limit;
-          send_update_core_limit(target_client, new_core_limit);
-          /* Wake up timer thread to re-evaluate immediately if running */
-          if (target_client->is_running && target_client->context) {
-            pthread_cond_broadcast(&target_client->context->timer_cv);
-          }
-        }
-      }
-
-      true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
-
-      if (mem_limit_str) free(mem_limit_str);
-      if (core_limit_str) free(core_limit_str);
-
+      refresh_pod_limits(info);
       LL_DELETE(snapshot, info);
       free(info);
     }
@@ -1521,17 +3953,24 @@ void* annotation_watcher_fn(void* arg __attribute__((unused))) {
   return NULL;
 }
 
-static void process_msg(struct xpushare_client* client,
-                        const struct message* in_msg) {
+/*
+ * Handle a message from a client that has not been handed over to a GPU
+ * event loop yet: either a REGISTER or a command from xpusharectl.
+ *
+ * Called from the control loop with no lock held. Returns 1 if the client
+ * still belongs to the control loop afterwards, 0 if it was deleted or handed
+ * over to its GPU.
+ */
+static int process_control_msg(struct xpushare_client* client,
+                               const struct message* in_msg) {
   int newtq;
+  int changed;
   char id_str[HEX_STR_LEN(client->id)];
   char* endptr;
+  struct gpu_context* c_ctx;
 
   /* Increment message counter for metrics */
   metrics_inc_msg((int)in_msg->type);
-  struct gpu_context* ctx = client->context;
-  /* Note: ctx might be NULL if client is not registered yet (except for
-   * REGISTER) */
 
   client_id_as_string(id_str, sizeof(id_str), client->id);
 
@@ -1539,22 +3978,18 @@ static void process_msg(struct xpushare_client* client,
     case REGISTER:
       log_info("Received %s", message_type_string[in_msg->type]);
 
-      if (register_client(client, in_msg) < 0)
-        delete_client(client);
-      else
-        log_info("Registered client %016" PRIx64
-                 " on GPU %s with Pod"
-                 " name = %s, Pod namespace = %s",
-                 client->id, client->context->uuid, client->pod_name,
-                 client->pod_namespace);
-      break;
+      if (register_client(client, in_msg) < 0) delete_client(client);
+      return 0;
 
     case SCHED_ON: /* xpusharectl */
       log_info("Received %s from %s", message_type_string[in_msg->type],
                id_str);
 
-      if (!scheduler_on) {
-        scheduler_on = 1;
+      true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
+      changed = !scheduler_on;
+      scheduler_on = 1;
+      true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
+      if (changed) {
         log_info("Scheduler turned ON, broadcasting it...");
         bcast_status();
       }
@@ -1564,19 +3999,21 @@ static void process_msg(struct xpushare_client* client,
       log_info("Received %s from %s", message_type_string[in_msg->type],
                id_str);
 
-      if (scheduler_on) {
+      true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
+      changed = scheduler_on;
+      scheduler_on = 0;
+      c_ctx = gpu_contexts;
+      true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
+      if (changed) {
         log_info("Scheduler turned OFF, broadcasting it...");
-        scheduler_on = 0;
         bcast_status();
 
-        struct gpu_context* c_ctx;
-        LL_FOREACH(gpu_contexts, c_ctx) {
-          struct xpushare_request *tmp, *r;
-          LL_FOREACH_SAFE(c_ctx->requests, r, tmp) {
-            LL_DELETE(c_ctx->requests, r);
-            free(r);
-          }
+        for (; c_ctx != NULL; c_ctx = c_ctx->next) {
+          true_or_exit(pthread_mutex_lock(&c_ctx->lock) == 0);
+          while (c_ctx->queues[QUEUE_REQUESTS] != NULL)
+            queue_move(c_ctx->queues[QUEUE_REQUESTS], QUEUE_NONE);
           c_ctx->lock_held = 0;
+          true_or_exit(pthread_mutex_unlock(&c_ctx->lock) == 0);
         }
       }
       break;
@@ -1588,39 +4025,81 @@ static void process_msg(struct xpushare_client* client,
       errno = 0;
       newtq = (int)strtoll(in_msg->data, &endptr, 0);
       if (in_msg->data != endptr && *endptr == '\0' && errno == 0) {
+        true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
         tq = newtq;
-        struct gpu_context* c_ctx;
-        LL_FOREACH(gpu_contexts, c_ctx) {
-          c_ctx->must_reset_timer = 1;
-          pthread_cond_broadcast(&c_ctx->timer_cv);
+        c_ctx = gpu_contexts;
+        true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
+        for (; c_ctx != NULL; c_ctx = c_ctx->next) {
+          true_or_exit(pthread_mutex_lock(&c_ctx->lock) == 0);
+          if (c_ctx->lock_held) arm_tq_timer(c_ctx); /* Restart the TQ */
+          true_or_exit(pthread_mutex_unlock(&c_ctx->lock) == 0);
         }
-        log_info("New TQ = %d", tq);
+        log_info("New TQ = %d", newtq);
       } else
         log_info("Failed to parse new TQ from message");
       break;
 
+    default: /* The client is not registered. Slam the door. */
+      log_info("Received %s from unregistered client %s",
+               (in_msg->type > 0 && in_msg->type <= CANCEL_SWAP_OUT)
+                   ? message_type_string[in_msg->type]
+                   : "unknown message",
+               id_str);
+      delete_client(client);
+      return 0;
+  }
+  return 1;
+}
+
+/*
+ * Handle a message from a registered client.
+ *
+ * Called from the event loop of the client's GPU with ctx->lock held.
+ */
+static void process_msg(struct xpushare_client* client,
+                        const struct message* in_msg) {
+  char id_str[HEX_STR_LEN(client->id)];
+  char stats[MSG_DATA_LEN + 1];
+  char* endptr;
+  long slowdown_ms;
+  long kernels, busy_ms;
+  size_t old_mem;
+
+  /* Increment message counter for metrics */
+  metrics_inc_msg((int)in_msg->type);
+  struct gpu_context* ctx = client->context;
+
+  client_id_as_string(id_str, sizeof(id_str), client->id);
+
+  switch (in_msg->type) {
+    case REGISTER:
+      log_warn("Client %s is already registered", id_str);
+      delete_client(client);
+      break;
+
+    case SCHED_ON:  /* xpusharectl only, never on a registered connection */
+    case SCHED_OFF: /* xpusharectl only, never on a registered connection */
+    case SET_TQ:    /* xpusharectl only, never on a registered connection */
+      log_warn("Ignoring %s from registered client %s",
+               message_type_string[in_msg->type], id_str);
+      break;
+
     case REQ_LOCK: /* client */
       log_info("Received %s from %s", message_type_string[in_msg->type],
                id_str);
 
-      if (has_registered(client)) {
-        if (scheduler_on) {
-          if (!ctx) {
-            log_warn("Registered client %s has no context!", id_str);
-            delete_client(client);
-            break;
-          }
-          insert_req(client);
-          /* In CONCURRENT/AUTO modes, always try to schedule - memory might
-           * fit. In SERIAL mode, only schedule if no one is running. */
-          if (config.scheduling_mode == SCHED_MODE_SERIAL) {
-            if (!ctx->lock_held) try_schedule(ctx);
-          } else {
-            try_schedule(ctx); /* Let try_schedule check memory limits */
-          }
+      if (scheduler_on) {
+        insert_req(client);
+        /* In CONCURRENT/AUTO modes, always try to schedule - memory might
+         * fit. In SERIAL mode, only schedule if no one is running. */
+        if (config.scheduling_mode == SCHED_MODE_SERIAL) {
+          if (!ctx->lock_held) try_schedule(ctx);
+        } else {
+          try_schedule(ctx); /* Let try_schedule check memory limits */
         }
-      } else { /* The client is not registered. Slam the door. */
-        delete_client(client);
+        /* Still waiting: lower classes and borrowers make way */
+        preempt_lower_classes(ctx, client);
+        reclaim_lent(ctx, client);
       }
       break;
 
@@ -1628,17 +4107,9 @@ static void process_msg(struct xpushare_client* client,
       log_info("Received %s from %s", message_type_string[in_msg->type],
                id_str);
 
-      if (has_registered(client)) {
-        if (scheduler_on) {
-          if (!ctx) {
-            delete_client(client);
-            break;
-          }
-          remove_req(client);
-          if (!ctx->lock_held) try_schedule(ctx);
-        }
-      } else { /* The client is not registered. Slam the door. */
-        delete_client(client);
+      if (scheduler_on) {
+        remove_req(client);
+        if (!ctx->lock_held) try_schedule(ctx);
       }
       break;
 
@@ -1647,46 +4118,92 @@ static void process_msg(struct xpushare_client* client,
                 message_type_string[in_msg->type], id_str,
                 in_msg->memory_usage / (1024 * 1024));
 
-      if (has_registered(client) && ctx) {
-        size_t old_mem = client->memory_allocated;
-        client->memory_allocated = in_msg->memory_usage;
+      old_mem = client->memory_allocated;
+      client->memory_allocated = in_msg->memory_usage;
 
-        /* Track peak managed allocation for metrics */
-        if (client->memory_allocated > client->peak_allocated) {
-          client->peak_allocated = client->memory_allocated;
-        }
+      /* Track peak managed allocation for metrics */
+      if (client->memory_allocated > client->peak_allocated) {
+        client->peak_allocated = client->memory_allocated;
+      }
+      if (client->peak_allocated > client->predicted_peak) {
+        char workload[PEAK_STORE_KEY_LEN];
 
-        /* Update running memory usage if client is running */
-        if (client->is_running) {
-          if (ctx->running_memory_usage >= old_mem) {
-            ctx->running_memory_usage -= old_mem;
-          }
-          ctx->running_memory_usage += client->memory_allocated;
+        client->predicted_peak = client->peak_allocated;
+        client_workload_key(client, workload);
+        peak_store_raise(workload, client->predicted_peak);
+      }
 
-          /* Track peak memory usage */
-          if (ctx->running_memory_usage > ctx->peak_memory_usage) {
-            ctx->peak_memory_usage = ctx->running_memory_usage;
-          }
+      /* Update running memory usage if client is running */
+      if (client->is_running) {
+        if (ctx->running_memory_usage >= old_mem) {
+          ctx->running_memory_usage -= old_mem;
+        }
+        ctx->running_memory_usage += client->memory_allocated;
 
-          log_debug("GPU %s running memory updated: %zu MB (peak: %zu MB)",
-                    ctx->uuid, ctx->running_memory_usage / (1024 * 1024),
-                    ctx->peak_memory_usage / (1024 * 1024));
-
-          /* Check for memory overload - only if not already in overload mode */
-          size_t safe_limit =
-              ctx->total_memory * (100 - config.memory_reserve_percent) / 100;
-          if (!ctx->memory_overloaded &&
-              ctx->running_memory_usage > safe_limit) {
-            ctx->memory_overloaded = 1;
-            log_warn(
-                "Memory overload detected on GPU %s: %zu MB > %zu MB limit",
-                ctx->uuid, ctx->running_memory_usage / (1024 * 1024),
-                safe_limit / (1024 * 1024));
-            /* Force preemption to fall back to serial mode */
-            force_preemption(ctx);
-          }
+        /* Track peak memory usage */
+        if (ctx->running_memory_usage > ctx->peak_memory_usage) {
+          ctx->peak_memory_usage = ctx->running_memory_usage;
         }
+
+        log_debug("GPU %s running memory updated: %zu MB (peak: %zu MB)",
+                  ctx->uuid, ctx->running_memory_usage / (1024 * 1024),
+                  ctx->peak_memory_usage / (1024 * 1024));
+
+        check_overload(ctx, client);
+      }
+      check_overload_recovery(ctx);
+      break;
+
+    case WSS_UPDATE: /* Working set of a quantum, from client */
+      log_debug("Received %s from %s: %zu MB",
+                message_type_string[in_msg->type], id_str,
+                in_msg->memory_usage / (1024 * 1024));
+      old_mem = resident_memory(client);
+      observe_wss(client, in_msg->memory_usage);
+      if (client->is_running) check_overload(ctx, client);
+      check_overload_recovery(ctx);
+      /* Waiters may fit next to it now */
+      if (scheduler_on && resident_memory(client) < old_mem) {
+        check_wait_queue(ctx);
+        try_schedule(ctx);
+      }
+      break;
+
+    case CLIENT_STATS: /* Switch slowdown from client */
+      strlcpy(stats, in_msg->data, sizeof(stats));
+      errno = 0;
+      slowdown_ms = strtol(stats, &endptr, 10);
+      if (stats == endptr || *endptr != '\0' || errno != 0 || slowdown_ms < 0) {
+        log_warn("Failed to parse %s from %s", message_type_string[in_msg->type],
+                 id_str);
+        break;
+      }
+      if (client->switch_drain_ms < 0) {
+        /* Admitted alongside the holders, or a repeated LOCK_OK */
+        log_debug("Ignoring %s from %s: its grant was not a switch",
+                  message_type_string[in_msg->type], id_str);
+        break;
+      }
+      log_debug("Received %s from %s: %ld ms slowdown for %zu MB after a "
+                "%ld ms drain",
+                message_type_string[in_msg->type], id_str, slowdown_ms,
+                in_msg->memory_usage / (1024 * 1024), client->switch_drain_ms);
+      observe_switch_cost(ctx, in_msg->memory_usage,
+                          client->switch_drain_ms + slowdown_ms);
+      client->switch_drain_ms = -1;
+      break;
+
+    case CLIENT_PROGRESS: /* Kernels completed, from client */
+      strlcpy(stats, in_msg->data, sizeof(stats));
+      if (sscanf(stats, "%ld %ld", &kernels, &busy_ms) != 2 || kernels < 0 ||
+          busy_ms <= 0) {
+        log_warn("Failed to parse %s from %s", message_type_string[in_msg->type],
+                 id_str);
+        break;
       }
+      log_debug("Received %s from %s: %ld kernels in %ld ms",
+                message_type_string[in_msg->type], id_str, kernels, busy_ms);
+      observe_progress(client, kernels, busy_ms);
       break;
 
     default: /* Unknown message type */
@@ -1698,77 +4215,417 @@ static void process_msg(struct xpushare_client* client,
   }
 }
 
-/* ---- Metrics snapshot (called by metrics_exporter under global_mutex) ---- */
+/* ---- Metrics snapshot (called by metrics_exporter, takes its own locks) ---- */
 
 void metrics_fill_scheduler_snapshot(struct scheduler_snapshot* snap) {
   struct xpushare_client* c;
   struct gpu_context* ctx;
-  struct xpushare_request* req;
-
-  /* Snapshot clients */
+  struct gpu_context* first_ctx;
   int ci = 0;
-  LL_FOREACH(clients, c) {
-    if (ci >= MAX_SNAPSHOT_CLIENTS) break;
-    if (c->id == XPUSHARE_UNREGISTERED_ID) continue;
-    struct client_snapshot* cs = &snap->clients[ci];
-    cs->id = c->id;
-    strlcpy(cs->pod_name, c->pod_name, sizeof(cs->pod_name));
-    strlcpy(cs->pod_namespace, c->pod_namespace, sizeof(cs->pod_namespace));
-    if (c->context) {
-      strlcpy(cs->gpu_uuid, c->context->uuid, sizeof(cs->gpu_uuid));
+  int gi = 0;
+
+  true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
+  first_ctx = gpu_contexts;
+  true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
+
+  /* Snapshot one GPU shard at a time, so a scrape never stalls every GPU */
+  for (ctx = first_ctx; ctx != NULL; ctx = ctx->next, gi++) {
+    true_or_exit(pthread_mutex_lock(&ctx->lock) == 0);
+
+    /* Snapshot clients */
+    DL_FOREACH2(ctx->clients, c, ctx_next) {
+      if (ci >= MAX_SNAPSHOT_CLIENTS) break;
+      if (c->id == XPUSHARE_UNREGISTERED_ID) continue;
+      struct client_snapshot* cs = &snap->clients[ci];
+      cs->id = c->id;
+      strlcpy(cs->pod_name, c->pod_name, sizeof(cs->pod_name));
+      strlcpy(cs->pod_namespace, c->pod_namespace, sizeof(cs->pod_namespace));
+      strlcpy(cs->gpu_uuid, ctx->uuid, sizeof(cs->gpu_uuid));
+      cs->gpu_index = -1; /* Will be resolved from NVML snapshot */
+      cs->host_pid = c->host_pid;
+      cs->memory_allocated = c->memory_allocated;
+      cs->peak_allocated = c->peak_allocated;
+      cs->predicted_peak = c->predicted_peak;
+      cs->wss = c->wss;
+      cs->memory_limit = c->memory_limit;
+      cs->core_limit = c->core_limit;
+      cs->core_request = core_guarantee(c);
+      cs->namespace_share = c->ns_entitled;
+      cs->priority = c->priority;
+      cs->mlfq_level = c->mlfq_level;
+      cs->burst_est_ms = c->burst_est_ms;
+      cs->max_wait_ms = c->max_wait_ms;
+      cs->deadline_miss_count = c->deadline_miss_count;
+      memcpy(cs->lock_wait_buckets, c->lock_wait_buckets,
+             sizeof(cs->lock_wait_buckets));
+      cs->lock_wait_sum_ms = c->lock_wait_sum_ms;
+      cs->is_running = c->is_running;
+      cs->is_throttled = c->is_throttled;
+      cs->core_borrowed_ms = c->borrowed_ms;
+      cs->core_lent_ms = c->lent_ms;
+      cs->pending_drop = c->pending_drop;
+      cs->lease_overdue = c->lease_overdue;
+      cs->lease_overdue_count = c->lease_overdue_count;
+      cs->run_time_in_window_ms = c->run_time_in_window_ms;
+      cs->quota_debt_ms = c->quota_debt_ms;
+      if (core_guarantee(c) < 100) {
+        cs->effective_quota_ms = get_effective_quota_ms(ctx, c);
+      } else {
+        cs->effective_quota_ms = config.compute_window_ms;
+      }
+      cs->window_limit_ms = config.compute_window_ms;
+      ci++;
     }
-    cs->gpu_index = -1; /* Will be resolved from NVML snapshot */
-    cs->host_pid = c->host_pid;
-    cs->memory_allocated = c->memory_allocated;
-    cs->peak_allocated = c->peak_allocated;
-    cs->memory_limit = c->memory_limit;
-    cs->core_limit = c->core_limit;
-    cs->is_running = c->is_running;
-    cs->is_throttled = c->is_throttled;
-    cs->pending_drop = c->pending_drop;
-    cs->run_time_in_window_ms = c->run_time_in_window_ms;
-    cs->quota_debt_ms = c->quota_debt_ms;
-    if (c->context && c->core_limit < 100) {
-      cs->effective_quota_ms = get_effective_quota_ms(c->context, c);
-    } else {
-      cs->effective_quota_ms = config.compute_window_ms;
+
+    /* Snapshot GPU context */
+    if (gi < MAX_SNAPSHOT_CONTEXTS) {
+      struct context_snapshot* gs = &snap->contexts[gi];
+      strlcpy(gs->uuid, ctx->uuid, sizeof(gs->uuid));
+      gs->gpu_index = gi;
+      gs->running_count = ctx->queue_len[QUEUE_RUNNING];
+      gs->request_count = ctx->queue_len[QUEUE_REQUESTS];
+      gs->wait_count = ctx->queue_len[QUEUE_WAIT];
+      gs->running_memory = ctx->running_memory_usage;
+      gs->peak_memory = ctx->peak_memory_usage;
+      gs->unmanaged_memory = unmanaged_memory(ctx);
+      gs->process_overhead = ctx->process_overhead;
+      gs->total_memory = ctx->total_memory;
+      gs->memory_reserve_percent = config.memory_reserve_percent;
+      gs->memory_overloaded = ctx->memory_overloaded;
+      gs->overload_enter_count = ctx->overload_enter_count;
+      gs->overload_exit_count = ctx->overload_exit_count;
+      gs->overload_victim_count = ctx->overload_victim_count;
+      gs->backfill_count = ctx->backfill_count;
+      gs->host_mem_defer_count = ctx->host_mem_defer_count;
+      gs->thrashing = ctx->thrashing;
+      gs->thrash_enter_count = ctx->thrash_enter_count;
+      gs->thrash_exit_count = ctx->thrash_exit_count;
+      gs->corun_progress = ctx->corun_progress;
+      gs->priority_preempt_count = ctx->priority_preempt_count;
+      gs->deadline_preempt_count = ctx->deadline_preempt_count;
+      double fixed_ms, ms_per_gib;
+      long cost_ms = predicted_switch_cost_ms(ctx);
+      gs->switch_bandwidth = 0;
+      if (switch_cost_fit(ctx, &fixed_ms, &ms_per_gib) && ms_per_gib > 0)
+        gs->switch_bandwidth = 1000.0 * 1024 * 1024 * 1024 / ms_per_gib;
+      gs->switch_overhead =
+          cost_ms >= 0 ? (double)cost_ms / (tq_length_ms(ctx) + cost_ms) : -1;
+      gs->switch_cost_total_ms = ctx->switch_cost_total_ms;
+      gs->paced_count = ctx->paced_count;
+      gs->prepared_count = ctx->prepared_count;
     }
-    cs->window_limit_ms = config.compute_window_ms;
-    ci++;
+
+    true_or_exit(pthread_mutex_unlock(&ctx->lock) == 0);
   }
   snap->client_count = ci;
-
-  /* Snapshot GPU contexts */
-  int gi = 0;
-  LL_FOREACH(gpu_contexts, ctx) {
-    if (gi >= MAX_SNAPSHOT_CONTEXTS) break;
-    struct context_snapshot* gs = &snap->contexts[gi];
-    strlcpy(gs->uuid, ctx->uuid, sizeof(gs->uuid));
-    gs->gpu_index = gi;
-    /* Count running list */
-    gs->running_count = 0;
-    LL_FOREACH(ctx->running_list, req) { gs->running_count++; }
-    /* Count request queue */
-    gs->request_count = 0;
-    LL_FOREACH(ctx->requests, req) { gs->request_count++; }
-    /* Count wait queue */
-    gs->wait_count = 0;
-    LL_FOREACH(ctx->wait_queue, req) { gs->wait_count++; }
-    gs->running_memory = ctx->running_memory_usage;
-    gs->peak_memory = ctx->peak_memory_usage;
-    gs->total_memory = ctx->total_memory;
-    gs->memory_reserve_percent = config.memory_reserve_percent;
-    gs->memory_overloaded = ctx->memory_overloaded;
-    gi++;
-  }
-  snap->context_count = gi;
+  snap->context_count = gi < MAX_SNAPSHOT_CONTEXTS ? gi : MAX_SNAPSHOT_CONTEXTS;
 
   /* Snapshot event counters */
-  memcpy(snap->msg_counts, g_metrics_msg_count, sizeof(snap->msg_counts));
-  snap->drop_lock_count = g_metrics_drop_lock_count;
-  snap->client_disconnect_count = g_metrics_client_disconnect_count;
-  snap->wait_for_mem_count = g_metrics_wait_for_mem_count;
-  snap->mem_available_count = g_metrics_mem_available_count;
+  for (int i = 0; i < XPUSHARE_MSG_TYPE_COUNT; i++)
+    snap->msg_counts[i] = metrics_load_counter(&g_metrics_msg_count[i]);
+  snap->drop_lock_count = metrics_load_counter(&g_metrics_drop_lock_count);
+  snap->client_disconnect_count =
+      metrics_load_counter(&g_metrics_client_disconnect_count);
+  snap->wait_for_mem_count = metrics_load_counter(&g_metrics_wait_for_mem_count);
+  snap->mem_available_count =
+      metrics_load_counter(&g_metrics_mem_available_count);
+  snap->lease_overdue_count =
+      metrics_load_counter(&g_metrics_lease_overdue_count);
+  {
+    struct host_mem hm;
+
+    snap->host_mem_known = current_host_mem(&hm);
+    snap->host_mem_total = hm.total;
+    snap->host_mem_available = hm.available;
+  }
+  for (int i = 0; i <= XPUSHARE_DROP_RELEASE_BUCKETS; i++)
+    snap->drop_release_buckets[i] =
+        metrics_load_counter(&g_metrics_drop_release_buckets[i]);
+  snap->drop_release_sum_ms =
+      metrics_load_counter(&g_metrics_drop_release_sum_ms);
+}
+
+/* Run the timers of a GPU whose timerfd fired. ctx->lock must be held. */
+static void run_timers(struct gpu_context* ctx) {
+  timer_wheel_advance(&ctx->timers, (uint64_t)current_time_ms());
+  set_timer_fd(ctx, timer_wheel_next_expiry(&ctx->timers));
+}
+
+/*
+ * Feed bytes received from a registered client into its message buffer,
+ * processing every message they complete. A partial message is kept for the
+ * next read. Stops if a message gets the client deleted.
+ */
+static void consume_rx(struct xpushare_client* client, const char* buf,
+                       size_t len) {
+  size_t n;
+
+  while (len > 0 && !client->dead) {
+    n = sizeof(client->rx_msg) - client->rx_len;
+    if (n > len) n = len;
+    memcpy((char*)&client->rx_msg + client->rx_len, buf, n);
+    client->rx_len += n;
+    buf += n;
+    len -= n;
+    if (client->rx_len == sizeof(client->rx_msg)) {
+      client->rx_len = 0;
+      process_msg(client, &client->rx_msg);
+    }
+  }
+}
+
+/*
+ * Read and handle everything a client has sent, a few chunks per wakeup, so a
+ * burst from one client cannot hog its GPU's loop; epoll is level-triggered
+ * and brings us back for the rest.
+ *
+ * Returns -1 if the client is gone.
+ */
+static int drain_client(struct xpushare_client* client) {
+  char buf[RX_CHUNK_SIZE];
+  ssize_t n;
+
+  for (int i = 0; i < RX_MAX_CHUNKS; i++) {
+    n = receive_bytes(client, buf, sizeof(buf));
+    if (n < 0) return -1;
+    consume_rx(client, buf, n);
+    if (client->dead || (size_t)n < sizeof(buf)) break;
+  }
+  return 0;
+}
+
+/* Write out what the clients of a GPU got queued while the loop ran */
+static void flush_pending(struct gpu_context* ctx) {
+  struct xpushare_client* c;
+
+  while ((c = ctx->tx_pending) != NULL) {
+    DL_DELETE2(ctx->tx_pending, c, tx_prev, tx_next);
+    c->tx_queued = 0;
+    if (flush_client(c) < 0) {
+      delete_client(c);
+      if (!ctx->lock_held && scheduler_on) try_schedule(ctx);
+    }
+  }
+}
+
+static void handle_recv_uring(struct gpu_context* ctx,
+                              struct xpushare_client* client, int res,
+                              unsigned flags) {
+  if (flags & IORING_CQE_F_BUFFER) {
+    unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    if (res > 0) consume_rx(client, uring_buffer(&ctx->ring, bid), res);
+    uring_recycle_buffer(&ctx->ring, bid);
+  }
+  if (flags & IORING_CQE_F_MORE) return;
+
+  /* The multishot recv is over. Out of buffers is fine, just re-arm it */
+  if (!client->dead && (res > 0 || res == -ENOBUFS)) {
+    uring_prep_recv_multishot(&ctx->ring, client->fd,
+                              IO_DATA(client, IO_OP_RECV));
+    return;
+  }
+  if (!client->dead) {
+    if (res < 0) log_info("Failed to receive message from client %016" PRIx64,
+                          client->id);
+    delete_client(client);
+    if (!ctx->lock_held && scheduler_on) try_schedule(ctx);
+  }
+  put_client(client);
+}
+
+static void handle_send_uring(struct gpu_context* ctx,
+                              struct xpushare_client* client, int res) {
+  if (client->dead) {
+    put_client(client);
+    return;
+  }
+
+  if (res < 0) {
+    /* Strict as ever: the recv sees the hangup and deletes the client */
+    log_info("Failed to send message to client %016" PRIx64, client->id);
+    client->tx_len = client->tx_out_len = 0;
+    shutdown(client->fd, SHUT_RDWR);
+  } else if (client->tx_out_sent + res < client->tx_out_len) {
+    /* Partial send, keep our reference for the rest */
+    client->tx_out_sent += res;
+    uring_prep_send(&ctx->ring, client->fd, client->tx_out + client->tx_out_sent,
+                    client->tx_out_len - client->tx_out_sent,
+                    MSG_NOSIGNAL | MSG_WAITALL, IO_DATA(client, IO_OP_SEND));
+    return;
+  } else {
+    client->tx_out_len = 0;
+    start_send_uring(client);
+  }
+  put_client(client);
+}
+
+/*
+ * Event loop of a single GPU, io_uring flavor. Everything queued while a
+ * batch of completions is handled goes to the kernel with the next wait.
+ */
+static void gpu_loop_uring(struct gpu_context* ctx) {
+  struct io_uring_cqe* cqe;
+  uint64_t data;
+  unsigned flags, to_submit;
+  int ret, res;
+
+  true_or_exit(pthread_mutex_lock(&ctx->lock) == 0);
+  for (;;) {
+    to_submit = uring_take_pending(&ctx->ring);
+    true_or_exit(pthread_mutex_unlock(&ctx->lock) == 0);
+
+    ret = uring_enter(&ctx->ring, to_submit, 1);
+    if (ret < 0)
+      log_fatal("io_uring_enter() failed for GPU %s: %s", ctx->uuid,
+                strerror(-ret));
+
+    true_or_exit(pthread_mutex_lock(&ctx->lock) == 0);
+    ctx->dispatching = 1;
+    while ((cqe = uring_peek_cqe(&ctx->ring)) != NULL) {
+      data = cqe->user_data;
+      res = cqe->res;
+      flags = cqe->flags;
+      uring_cqe_seen(&ctx->ring);
+
+      switch (data & IO_OP_MASK) {
+        case IO_OP_TIMER:
+          run_timers(ctx);
+          uring_prep_read(&ctx->ring, ctx->timer_fd, &ctx->timer_expirations,
+                          sizeof(ctx->timer_expirations),
+                          IO_DATA(ctx, IO_OP_TIMER));
+          break;
+        case IO_OP_RECV:
+          handle_recv_uring(ctx, IO_PTR(data), res, flags);
+          break;
+        case IO_OP_SEND:
+          handle_send_uring(ctx, IO_PTR(data), res);
+          break;
+      }
+    }
+    ctx->dispatching = 0;
+  }
+}
+
+/*
+ * Event loop of a single GPU.
+ *
+ * Serves every client registered on this GPU, and runs its timers. Clients
+ * arrive here after the control loop has processed their REGISTER message.
+ */
+void* gpu_loop_fn(void* arg) {
+  struct gpu_context* ctx = (struct gpu_context*)arg;
+  struct xpushare_client* client;
+  struct epoll_event events[EPOLL_MAX_EVENTS];
+  int ret, num_fds;
+
+  if (config.io_engine == IO_ENGINE_URING) {
+    gpu_loop_uring(ctx);
+    return NULL;
+  }
+
+  for (;;) {
+    num_fds =
+        RETRY_INTR(epoll_wait(ctx->epoll_fd, events, EPOLL_MAX_EVENTS, -1));
+
+    if (num_fds < 0) log_fatal("epoll_wait() failed for GPU %s", ctx->uuid);
+
+    true_or_exit(pthread_mutex_lock(&ctx->lock) == 0);
+    ctx->dispatching = 1;
+
+    for (int i = 0; i < num_fds; i++) {
+      if (events[i].data.ptr == ctx) { /* timer_fd */
+        uint64_t expirations;
+        if (read(ctx->timer_fd, &expirations, sizeof(expirations)) < 0 &&
+            errno != EAGAIN)
+          log_fatal_errno("Failed to read timerfd of GPU %s", ctx->uuid);
+        run_timers(ctx);
+        continue;
+      }
+
+      client = (struct xpushare_client*)events[i].data.ptr;
+
+      /* Hold the client, messages we handle may get it deleted */
+      client->refs++;
+      ret = 0;
+      if (events[i].events & EPOLLOUT) ret = flush_client(client);
+      if (ret == 0 && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+        ret = drain_client(client);
+      if (ret < 0 && !client->dead) {
+        delete_client(client);
+        if (!ctx->lock_held && scheduler_on) try_schedule(ctx);
+      }
+      put_client(client);
+    }
+
+    flush_pending(ctx);
+    ctx->dispatching = 0;
+    true_or_exit(pthread_mutex_unlock(&ctx->lock) == 0);
+  }
+
+  return NULL;
+}
+
+/*
+ * The control loop, io_uring flavor. A multishot accept brings in new
+ * connections. Clients here only ever send one message at a time and wait
+ * for it to be handled, so each gets a one-shot recv of a whole message,
+ * re-armed while the client stays with us. That leaves nothing on this ring
+ * once a client moves to its GPU.
+ */
+static void control_loop_uring(int lsock) {
+  struct xpushare_client* client;
+  struct io_uring_cqe* cqe;
+  uint64_t data;
+  unsigned flags;
+  int ret, res;
+
+  if (uring_init(&ctl_ring, URING_ENTRIES) < 0)
+    log_fatal_errno("Failed to set up the io_uring of the control loop");
+  uring_prep_accept_multishot(&ctl_ring, lsock, IO_DATA(NULL, IO_OP_ACCEPT));
+
+  for (;;) {
+    ret = uring_enter(&ctl_ring, uring_take_pending(&ctl_ring), 1);
+    if (ret < 0) log_fatal("io_uring_enter() failed: %s", strerror(-ret));
+
+    while ((cqe = uring_peek_cqe(&ctl_ring)) != NULL) {
+      data = cqe->user_data;
+      res = cqe->res;
+      flags = cqe->flags;
+      uring_cqe_seen(&ctl_ring);
+
+      if ((data & IO_OP_MASK) == IO_OP_ACCEPT) {
+        if (res >= 0) {
+          true_or_exit(client = calloc(1, sizeof(*client)));
+          client->fd = res;
+          client->id = XPUSHARE_UNREGISTERED_ID;
+          client->context = NULL;
+          client->refs = 1;
+          uring_prep_recv(&ctl_ring, client->fd, &client->rx_msg,
+                          sizeof(client->rx_msg), MSG_WAITALL,
+                          IO_DATA(client, IO_OP_RECV));
+        } else if (res != -ECONNABORTED && res != -EAGAIN && res != -EINTR) {
+          log_fatal("accept() failed non-transiently: %s", strerror(-res));
+        }
+        if (!(flags & IORING_CQE_F_MORE))
+          uring_prep_accept_multishot(&ctl_ring, lsock,
+                                      IO_DATA(NULL, IO_OP_ACCEPT));
+        continue;
+      }
+
+      /* IO_OP_RECV, the only request of this client */
+      client = IO_PTR(data);
+      client->refs--;
+      if (res != (int)sizeof(client->rx_msg)) {
+        log_debug("Client %d has closed the connection", client->fd);
+        delete_client(client);
+      } else if (process_control_msg(client, &client->rx_msg)) {
+        client->refs++;
+        uring_prep_recv(&ctl_ring, client->fd, &client->rx_msg,
+                        sizeof(client->rx_msg), MSG_WAITALL,
+                        IO_DATA(client, IO_OP_RECV));
+      }
+    }
+  }
 }
 
 int main(int argc __attribute__((unused)),
@@ -1776,7 +4633,6 @@ int main(int argc __attribute__((unused)),
   struct xpushare_client* client;
   int ret, err, lsock, rsock, num_fds;
   char* debug_val;
-  struct message in_msg = {0};
   struct epoll_event event, events[EPOLL_MAX_EVENTS];
 
   debug_val = getenv(ENV_XPUSHARE_DEBUG);
@@ -1796,6 +4652,19 @@ int main(int argc __attribute__((unused)),
 
   /* Initialize memory-aware scheduling configuration */
   init_config();
+  peak_store_open(config.peak_store_path);
+  if (config.peak_store_path != NULL) {
+    static sigset_t signals;
+    pthread_t sync_tid;
+
+    /* Before any other thread exists, so all of them inherit the mask */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    true_or_exit(pthread_sigmask(SIG_BLOCK, &signals, NULL) == 0);
+    true_or_exit(pthread_create(&sync_tid, NULL, peak_store_sync_thread_fn,
+                                &signals) == 0);
+  }
 
   if (getenv(ENV_XPUSHARE_DEBUG)) __debug = 1;
 
@@ -1809,52 +4678,60 @@ int main(int argc __attribute__((unused)),
   if (xpushare_get_scheduler_path(nvscheduler_socket_path) != 0)
     log_fatal("xpushare_get_scheduler_path() failed!");
 
-  /* Timer threads are spawned per GPU context */
+  /* Event loop threads are spawned per GPU context */
 
   /* Initialize K8s API and start annotation watcher thread */
   if (k8s_api_init() == 0) {
     pthread_t annotation_watcher_tid;
+    pthread_t lookup_tid;
     true_or_exit(pthread_create(&annotation_watcher_tid, NULL,
                                 annotation_watcher_fn, NULL) == 0);
+    for (int i = 0; i < LIMITS_LOOKUP_WORKERS; i++)
+      true_or_exit(pthread_create(&lookup_tid, NULL, limits_lookup_fn, NULL) ==
+                   0);
+    lookups_enabled = 1;
     log_info("Annotation watcher enabled for dynamic memory limits");
   } else {
     log_warn(
         "K8s API init failed, dynamic memory limit via annotation disabled");
   }
 
-  true_or_exit((epoll_fd = epoll_create(1)) >= 0);
-
   true_or_exit(xpushare_bind_and_listen(&lsock, nvscheduler_socket_path) == 0);
 
-  event.data.fd = lsock;
-  event.events = EPOLLIN;
-  true_or_exit(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, lsock, &event) == 0);
+  if (config.io_engine == IO_ENGINE_EPOLL) {
+    true_or_exit((epoll_fd = epoll_create(1)) >= 0);
+    event.data.fd = lsock;
+    event.events = EPOLLIN;
+    true_or_exit(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, lsock, &event) == 0);
+  }
 
   if (chmod(nvscheduler_socket_path, S_IRWXU | S_IWGRP | S_IWOTH) != 0)
     log_fatal("chmod() failed for %s", nvscheduler_socket_path);
 
-  out_msg.id = 7331;
-
   log_info("xpushare-scheduler listening on %s", nvscheduler_socket_path);
 
+  /*
+   * The GPU sampler feeds memory admission (see unmanaged_memory()) as well
+   * as the metrics, so it runs whether or not the exporter does.
+   */
+  char* nvml_interval = getenv("XPUSHARE_METRICS_NVML_INTERVAL_MS");
+  if (nvml_interval) {
+    nvml_sampler_set_interval_ms(atoi(nvml_interval));
+  }
+  if (nvml_sampler_init() == 0) {
+    pthread_t nvml_tid;
+    true_or_exit(
+        pthread_create(&nvml_tid, NULL, nvml_sampler_thread_fn, NULL) == 0);
+    log_info("GPU sampler thread started");
+  } else {
+    log_warn(
+        "GPU sampler init failed, unmanaged memory is not accounted and "
+        "GPU-level metrics will be zeros");
+  }
+
   /* Initialize and start Prometheus metrics exporter */
   metrics_exporter_init_config();
   if (g_metrics_config.enabled) {
-    /* Initialize NVML sampler */
-    char* nvml_interval = getenv("XPUSHARE_METRICS_NVML_INTERVAL_MS");
-    if (nvml_interval) {
-      nvml_sampler_set_interval_ms(atoi(nvml_interval));
-    }
-
-    if (nvml_sampler_init() == 0) {
-      pthread_t nvml_tid;
-      true_or_exit(
-          pthread_create(&nvml_tid, NULL, nvml_sampler_thread_fn, NULL) == 0);
-      log_info("GPU sampler thread started");
-    } else {
-      log_warn("GPU sampler init failed, GPU-level metrics will be zeros");
-    }
-
     /* Start metrics HTTP server thread */
     pthread_t metrics_tid;
     true_or_exit(pthread_create(&metrics_tid, NULL, metrics_exporter_thread_fn,
@@ -1867,21 +4744,24 @@ int main(int argc __attribute__((unused)),
         "enable)");
   }
 
+  /*
+   * The control loop: accepts connections and serves clients until they
+   * register. Registered clients are served by their GPU's event loop.
+   */
+  if (config.io_engine == IO_ENGINE_URING) control_loop_uring(lsock);
+
   for (;;) {
     num_fds = RETRY_INTR(epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS, -1));
 
     if (num_fds < 0) log_fatal("epoll_wait() failed");
 
-    true_or_exit(pthread_mutex_lock(&global_mutex) == 0);
-
     for (int i = 0; i < num_fds; i++) {
       if (events[i].data.fd == lsock) {
         ret = xpushare_accept(events[i].data.fd, &rsock);
         if (ret == 0) { /* OK */
-          client = malloc(sizeof(*client));
+          true_or_exit(client = calloc(1, sizeof(*client)));
           client->fd = rsock;
           client->id = XPUSHARE_UNREGISTERED_ID;
-          client->next = NULL;
           client->context = NULL;
 
           event.data.ptr = client;
@@ -1890,8 +4770,7 @@ int main(int argc __attribute__((unused)),
             log_warn("Couldn't add %d to the epoll interest list", rsock);
             close(rsock);
             free(client);
-          } else
-            LL_APPEND(clients, client); /* OK */
+          }
         } else if (errno != ECONNABORTED && errno != EAGAIN &&
                    errno != EWOULDBLOCK)
           log_fatal("accept() failed non-transiently");
@@ -1899,24 +4778,23 @@ int main(int argc __attribute__((unused)),
       } else { /* Some event other than new connection */
         client = (struct xpushare_client*)events[i].data.ptr;
 
-        if (events[i].events & EPOLLIN) {
-          ret = receive_message(client, &in_msg);
+        /*
+         * One message at a time, anything after a REGISTER is for the GPU's
+         * loop. A short read is simply continued on the next wakeup.
+         */
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+          ret = (int)receive_bytes(client,
+                                   (char*)&client->rx_msg + client->rx_len,
+                                   sizeof(client->rx_msg) - client->rx_len);
           if (ret < 0) {
-            struct gpu_context* ctx =
-                client->context;  // Save context before delete
             delete_client(client);
-            if (ctx && !ctx->lock_held && scheduler_on) try_schedule(ctx);
-          } else
-            process_msg(client, &in_msg); /* OK */
-
-        } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
-          struct gpu_context* ctx = client->context;  // Save context
-          delete_client(client);
-          if (ctx && !ctx->lock_held && scheduler_on) try_schedule(ctx);
+          } else if ((client->rx_len += ret) == sizeof(client->rx_msg)) {
+            client->rx_len = 0;
+            process_control_msg(client, &client->rx_msg);
+          }
         }
       }
     }
-    true_or_exit(pthread_mutex_unlock(&global_mutex) == 0);
   }
 
   return -1;
@@ -0,0 +1,147 @@
+/*
+ * Hierarchical timer wheel for xpushare-scheduler.
+ *
+ * Level L holds timers due within 64^(L+1) ticks, in the slot picked by bits
+ * [6L, 6L+6) of their deadline. Whenever the low bits of the current tick
+ * wrap, the next slot of the level above is re-filed into the levels below,
+ * so every timer reaches level 0 before its deadline.
+ */
+
+#include "timer_wheel.h"
+
+#include "utlist.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(level) ((level) * TIMER_WHEEL_SLOT_BITS)
+#define WHEEL_SPAN (1ULL << LEVEL_SHIFT(TIMER_WHEEL_LEVELS))
+
+static void place(struct timer_wheel* wheel, struct timer_wheel_timer* timer) {
+  uint64_t expires = timer->expires < wheel->now ? wheel->now : timer->expires;
+  uint64_t delta = expires - wheel->now;
+  int level;
+
+  for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+    if (delta < (1ULL << LEVEL_SHIFT(level + 1))) break;
+
+  /* Too far out: park it at the end, it is re-filed with its real deadline */
+  if (delta >= WHEEL_SPAN) expires = wheel->now + WHEEL_SPAN - 1;
+
+  timer->slot =
+      &wheel->slots[level][(expires >> LEVEL_SHIFT(level)) & SLOT_MASK];
+  DL_APPEND2(*timer->slot, timer, prev, next);
+}
+
+/*
+ * Move the timers of a slot onto a private list. Each keeps pointing at the
+ * list it is on, so timer_wheel_del() still works while we walk it.
+ */
+static void detach_slot(struct timer_wheel_timer** slot,
+                        struct timer_wheel_timer** list) {
+  struct timer_wheel_timer* timer;
+
+  *list = *slot;
+  *slot = NULL;
+  DL_FOREACH2(*list, timer, next) timer->slot = list;
+}
+
+static void cascade(struct timer_wheel* wheel, int level, int index) {
+  struct timer_wheel_timer *list, *timer;
+
+  detach_slot(&wheel->slots[level][index], &list);
+  while ((timer = list) != NULL) {
+    DL_DELETE2(list, timer, prev, next);
+    place(wheel, timer);
+  }
+}
+
+void timer_wheel_init(struct timer_wheel* wheel, uint64_t now_ms) {
+  wheel->now = now_ms;
+  wheel->count = 0;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) wheel->slots[level][i] = NULL;
+}
+
+void timer_wheel_timer_init(struct timer_wheel_timer* timer, timer_wheel_fn fn,
+                            void* data) {
+  timer->expires = 0;
+  timer->fn = fn;
+  timer->data = data;
+  timer->slot = NULL;
+  timer->prev = timer->next = NULL;
+}
+
+void timer_wheel_add(struct timer_wheel* wheel, struct timer_wheel_timer* timer,
+                     uint64_t expires_ms) {
+  timer_wheel_del(wheel, timer);
+  timer->expires = expires_ms;
+  place(wheel, timer);
+  wheel->count++;
+}
+
+void timer_wheel_del(struct timer_wheel* wheel,
+                     struct timer_wheel_timer* timer) {
+  if (!timer_wheel_pending(timer)) return;
+  DL_DELETE2(*timer->slot, timer, prev, next);
+  timer->slot = NULL;
+  wheel->count--;
+}
+
+void timer_wheel_advance(struct timer_wheel* wheel, uint64_t now_ms) {
+  struct timer_wheel_timer *list, *timer;
+  uint64_t tick;
+  int index;
+
+  while (wheel->now <= now_ms) {
+    /* Nothing can be due, skip the idle ticks */
+    if (wheel->count == 0) {
+      wheel->now = now_ms + 1;
+      return;
+    }
+
+    tick = wheel->now;
+    if ((tick & SLOT_MASK) == 0) {
+      for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        index = (tick >> LEVEL_SHIFT(level)) & SLOT_MASK;
+        cascade(wheel, level, index);
+        if (index != 0) break;
+      }
+    }
+
+    /*
+     * Timers armed by the callbacks below are filed relative to the next
+     * tick, so they never land on the list we are running.
+     */
+    detach_slot(&wheel->slots[0][tick & SLOT_MASK], &list);
+    wheel->now = tick + 1;
+    while ((timer = list) != NULL) {
+      DL_DELETE2(list, timer, prev, next);
+      timer->slot = NULL;
+      wheel->count--;
+      timer->fn(timer);
+    }
+  }
+}
+
+uint64_t timer_wheel_next_expiry(const struct timer_wheel* wheel) {
+  uint64_t earliest = TIMER_WHEEL_NEVER;
+  struct timer_wheel_timer* timer;
+
+  if (wheel->count == 0) return earliest;
+
+  /* Level 0 is exact: the first busy slot from the current tick wins */
+  for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+    timer = wheel->slots[0][(wheel->now + i) & SLOT_MASK];
+    if (timer != NULL) {
+      earliest = wheel->now + i;
+      break;
+    }
+  }
+
+  /* Upper levels are coarse; they hold few timers, so look at each one */
+  for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++)
+      DL_FOREACH2(wheel->slots[level][i], timer, next)
+        if (timer->expires < earliest) earliest = timer->expires;
+
+  return earliest;
+}
@@ -0,0 +1,65 @@
+/*
+ * Hierarchical timer wheel for xpushare-scheduler.
+ *
+ * Four levels of 64 slots with a 1 ms tick, covering about 4.6 hours; later
+ * deadlines are parked in the last level and re-filed as the wheel turns.
+ * Adding and removing a timer is O(1). The wheel does no locking and never
+ * reads a clock: its owner passes CLOCK_MONOTONIC milliseconds to
+ * timer_wheel_advance() and arms a timerfd for timer_wheel_next_expiry().
+ */
+
+#ifndef _XPUSHARE_TIMER_WHEEL_H_
+#define _XPUSHARE_TIMER_WHEEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+/* Returned by timer_wheel_next_expiry() when no timer is pending */
+#define TIMER_WHEEL_NEVER UINT64_MAX
+
+struct timer_wheel_timer;
+typedef void (*timer_wheel_fn)(struct timer_wheel_timer* timer);
+
+/* Embed one of these in the object the timer belongs to */
+struct timer_wheel_timer {
+  uint64_t expires; /* ms */
+  timer_wheel_fn fn;
+  void* data;
+  struct timer_wheel_timer** slot; /* NULL when not pending */
+  struct timer_wheel_timer *prev, *next;
+};
+
+struct timer_wheel {
+  uint64_t now; /* Next tick to run; every earlier tick has run */
+  int count;    /* Pending timers */
+  struct timer_wheel_timer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+void timer_wheel_init(struct timer_wheel* wheel, uint64_t now_ms);
+void timer_wheel_timer_init(struct timer_wheel_timer* timer, timer_wheel_fn fn,
+                            void* data);
+
+/* (Re)arm a timer to fire at expires_ms. Past deadlines fire on next advance */
+void timer_wheel_add(struct timer_wheel* wheel, struct timer_wheel_timer* timer,
+                     uint64_t expires_ms);
+/* Disarm a timer. Harmless if it is not pending */
+void timer_wheel_del(struct timer_wheel* wheel, struct timer_wheel_timer* timer);
+
+static inline int timer_wheel_pending(const struct timer_wheel_timer* timer) {
+  return timer->slot != NULL;
+}
+
+/*
+ * Run every timer due at or before now_ms. Callbacks may add and delete
+ * timers, including their own.
+ */
+void timer_wheel_advance(struct timer_wheel* wheel, uint64_t now_ms);
+
+/* Earliest pending deadline, or TIMER_WHEEL_NEVER */
+uint64_t timer_wheel_next_expiry(const struct timer_wheel* wheel);
+
+#endif /* _XPUSHARE_TIMER_WHEEL_H_ */
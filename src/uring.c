@@ -0,0 +1,308 @@
+/*
+ * Minimal io_uring wrapper for xpushare-scheduler.
+ *
+ * The ring layout follows io_uring_setup(2): the SQ and CQ rings share one
+ * mapping (IORING_FEAT_SINGLE_MMAP) and the SQE array has its own. Ring
+ * indices are shared with the kernel, hence the acquire/release accesses.
+ */
+
+#include "uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg,
+                                 unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int uring_supported(void) {
+  /* Multishot recv came with 6.0, as did SEND_ZC, which the probe can see */
+  static const int opcodes[] = {IORING_OP_ACCEPT, IORING_OP_RECV,
+                                IORING_OP_SEND, IORING_OP_READ,
+                                IORING_OP_SEND_ZC};
+  struct io_uring_probe* probe;
+  struct uring ring;
+  size_t probe_size;
+  int ok = 0;
+
+  if (uring_init(&ring, 2) < 0) return 0;
+
+  probe_size = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+  probe = calloc(1, probe_size);
+  if (probe == NULL) goto out;
+  if (sys_io_uring_register(ring.fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+    goto out_free;
+
+  ok = 1;
+  for (size_t i = 0; i < sizeof(opcodes) / sizeof(opcodes[0]); i++) {
+    if (opcodes[i] > probe->last_op ||
+        !(probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED))
+      ok = 0;
+  }
+  /* Provided buffer rings, needed by multishot recv */
+  if (ok && uring_setup_buffers(&ring, 0, 1, 64) < 0) ok = 0;
+
+out_free:
+  free(probe);
+out:
+  uring_exit(&ring);
+  return ok;
+}
+
+int uring_init(struct uring* ring, unsigned entries) {
+  struct io_uring_params p;
+  char* ptr;
+  int saved_errno;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_COOP_TASKRUN;
+  ring->fd = sys_io_uring_setup(entries, &p);
+  if (ring->fd < 0) return -1;
+
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(p.features & IORING_FEAT_NODROP)) {
+    close(ring->fd);
+    errno = ENOSYS;
+    return -1;
+  }
+
+  ring->ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  if (p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) >
+      ring->ring_size)
+    ring->ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->ring_ptr = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->ring_ptr == MAP_FAILED) goto out_close;
+
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) goto out_unmap;
+
+  ptr = ring->ring_ptr;
+  ring->sq_head = (unsigned*)(ptr + p.sq_off.head);
+  ring->sq_tail = (unsigned*)(ptr + p.sq_off.tail);
+  ring->sq_mask = *(unsigned*)(ptr + p.sq_off.ring_mask);
+  ring->sq_entries = p.sq_entries;
+  ring->sq_array = (unsigned*)(ptr + p.sq_off.array);
+  ring->cq_head = (unsigned*)(ptr + p.cq_off.head);
+  ring->cq_tail = (unsigned*)(ptr + p.cq_off.tail);
+  ring->cq_mask = *(unsigned*)(ptr + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)(ptr + p.cq_off.cqes);
+
+  /* SQEs are always used in order, so the indirection array is fixed */
+  for (unsigned i = 0; i < p.sq_entries; i++) ring->sq_array[i] = i;
+  return 0;
+
+out_unmap:
+  saved_errno = errno;
+  munmap(ring->ring_ptr, ring->ring_size);
+  errno = saved_errno;
+out_close:
+  saved_errno = errno;
+  close(ring->fd);
+  errno = saved_errno;
+  return -1;
+}
+
+void uring_exit(struct uring* ring) {
+  size_t br_size = ring->nr_bufs * sizeof(struct io_uring_buf);
+
+  munmap(ring->sqes, ring->sqes_size);
+  munmap(ring->ring_ptr, ring->ring_size);
+  close(ring->fd);
+  if (ring->buf_ring != NULL) {
+    munmap(ring->buf_ring, br_size);
+    free(ring->bufs);
+  }
+}
+
+int uring_setup_buffers(struct uring* ring, uint16_t bgid, unsigned nr_bufs,
+                        unsigned buf_size) {
+  struct io_uring_buf_reg reg;
+  size_t br_size = nr_bufs * sizeof(struct io_uring_buf);
+  int saved_errno;
+
+  /* The kernel wants a power of two and a page aligned ring */
+  if (nr_bufs == 0 || (nr_bufs & (nr_bufs - 1)) != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  ring->buf_ring = mmap(NULL, br_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->buf_ring == MAP_FAILED) {
+    ring->buf_ring = NULL;
+    return -1;
+  }
+  ring->bufs = malloc((size_t)nr_bufs * buf_size);
+  if (ring->bufs == NULL) goto out_unmap;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+  reg.ring_entries = nr_bufs;
+  reg.bgid = bgid;
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    goto out_free;
+
+  ring->nr_bufs = nr_bufs;
+  ring->buf_size = buf_size;
+  ring->bgid = bgid;
+  for (unsigned bid = 0; bid < nr_bufs; bid++) uring_recycle_buffer(ring, bid);
+  return 0;
+
+out_free:
+  saved_errno = errno;
+  free(ring->bufs);
+  ring->bufs = NULL;
+  errno = saved_errno;
+out_unmap:
+  saved_errno = errno;
+  munmap(ring->buf_ring, br_size);
+  ring->buf_ring = NULL;
+  errno = saved_errno;
+  return -1;
+}
+
+void uring_recycle_buffer(struct uring* ring, unsigned bid) {
+  struct io_uring_buf_ring* br = ring->buf_ring;
+  unsigned short tail = br->tail;
+  struct io_uring_buf* buf = &br->bufs[tail & (ring->nr_bufs - 1)];
+
+  buf->addr = (uint64_t)(uintptr_t)uring_buffer(ring, bid);
+  buf->len = ring->buf_size;
+  buf->bid = (unsigned short)bid;
+  store_release(&br->tail, (unsigned short)(tail + 1));
+}
+
+/*
+ * Grab the next free SQE, zeroed. If the queue is full, push all of it to the
+ * kernel first; without SQPOLL that frees the whole queue. Entries some other
+ * thread has claimed but not entered yet go too, the kernel never submits
+ * more than there is.
+ */
+static struct io_uring_sqe* get_sqe(struct uring* ring) {
+  unsigned tail = *ring->sq_tail;
+  unsigned queued = tail - load_acquire(ring->sq_head);
+  struct io_uring_sqe* sqe;
+
+  if (queued >= ring->sq_entries) {
+    uring_enter(ring, queued, 0);
+    ring->to_submit = 0;
+  }
+  sqe = &ring->sqes[tail & ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+/* Publish the SQE returned by the last get_sqe() */
+static void queue_sqe(struct uring* ring) {
+  store_release(ring->sq_tail, *ring->sq_tail + 1);
+  ring->to_submit++;
+}
+
+void uring_prep_accept_multishot(struct uring* ring, int fd,
+                                 uint64_t user_data) {
+  struct io_uring_sqe* sqe = get_sqe(ring);
+
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = user_data;
+  queue_sqe(ring);
+}
+
+void uring_prep_recv_multishot(struct uring* ring, int fd,
+                               uint64_t user_data) {
+  struct io_uring_sqe* sqe = get_sqe(ring);
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = ring->bgid;
+  sqe->user_data = user_data;
+  queue_sqe(ring);
+}
+
+void uring_prep_recv(struct uring* ring, int fd, void* buf, size_t len,
+                     int flags, uint64_t user_data) {
+  struct io_uring_sqe* sqe = get_sqe(ring);
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = (uint32_t)len;
+  sqe->msg_flags = (uint32_t)flags;
+  sqe->user_data = user_data;
+  queue_sqe(ring);
+}
+
+void uring_prep_send(struct uring* ring, int fd, const void* buf, size_t len,
+                     int flags, uint64_t user_data) {
+  struct io_uring_sqe* sqe = get_sqe(ring);
+
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = (uint32_t)len;
+  sqe->msg_flags = (uint32_t)flags;
+  sqe->user_data = user_data;
+  queue_sqe(ring);
+}
+
+void uring_prep_read(struct uring* ring, int fd, void* buf, size_t len,
+                     uint64_t user_data) {
+  struct io_uring_sqe* sqe = get_sqe(ring);
+
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = (uint32_t)len;
+  sqe->off = (uint64_t)-1; /* Current position, for non-seekable files */
+  sqe->user_data = user_data;
+  queue_sqe(ring);
+}
+
+int uring_enter(struct uring* ring, unsigned to_submit, unsigned wait_nr) {
+  unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+  int ret;
+
+  do {
+    ret = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags);
+    /* On EINTR nothing was submitted, so try the same again */
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) return -errno;
+  return ret;
+}
+
+struct io_uring_cqe* uring_peek_cqe(struct uring* ring) {
+  unsigned head = *ring->cq_head;
+
+  if (head == load_acquire(ring->cq_tail)) return NULL;
+  return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring* ring) {
+  store_release(ring->cq_head, *ring->cq_head + 1);
+}
@@ -0,0 +1,101 @@
+/*
+ * Minimal io_uring wrapper for xpushare-scheduler.
+ *
+ * Talks to the kernel through the raw system calls, so the scheduler does not
+ * depend on liburing. Only what the scheduler's event loops need is here:
+ * multishot accept and recv, provided buffers for the latter, plain sends and
+ * reads, and batched submission.
+ *
+ * The submission queue may be filled by several threads if they serialize on
+ * a lock of their own; io_uring_enter() itself is thread-safe. Completions
+ * must be reaped by a single thread.
+ */
+
+#ifndef _XPUSHARE_URING_H_
+#define _XPUSHARE_URING_H_
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct uring {
+  int fd;
+  /* Submission queue */
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+  unsigned to_submit; /* Queued, not yet passed to the kernel */
+  /* Completion queue */
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+  /* Mappings, for cleanup */
+  void* ring_ptr;
+  size_t ring_size;
+  size_t sqes_size;
+  /* Provided buffers for multishot recv, see uring_setup_buffers() */
+  struct io_uring_buf_ring* buf_ring;
+  char* bufs;
+  unsigned nr_bufs;
+  unsigned buf_size;
+  uint16_t bgid;
+};
+
+/* Check whether the running kernel supports everything used here */
+int uring_supported(void);
+
+/* Return 0 on success, -1 with errno set on failure */
+int uring_init(struct uring* ring, unsigned entries);
+void uring_exit(struct uring* ring);
+
+/* Register nr_bufs buffers of buf_size bytes as buffer group bgid */
+int uring_setup_buffers(struct uring* ring, uint16_t bgid, unsigned nr_bufs,
+                        unsigned buf_size);
+static inline char* uring_buffer(struct uring* ring, unsigned bid) {
+  return ring->bufs + (size_t)bid * ring->buf_size;
+}
+/* Give a buffer picked by the kernel back to it */
+void uring_recycle_buffer(struct uring* ring, unsigned bid);
+
+/*
+ * Queue requests. Nothing reaches the kernel before the next uring_submit()
+ * or uring_enter(), unless the submission queue is full.
+ */
+void uring_prep_accept_multishot(struct uring* ring, int fd,
+                                 uint64_t user_data);
+void uring_prep_recv_multishot(struct uring* ring, int fd, uint64_t user_data);
+void uring_prep_recv(struct uring* ring, int fd, void* buf, size_t len,
+                     int flags, uint64_t user_data);
+void uring_prep_send(struct uring* ring, int fd, const void* buf, size_t len,
+                     int flags, uint64_t user_data);
+void uring_prep_read(struct uring* ring, int fd, void* buf, size_t len,
+                     uint64_t user_data);
+
+/*
+ * Hand to_submit queued requests to the kernel and wait for wait_nr
+ * completions. Returns a negative errno on failure.
+ */
+int uring_enter(struct uring* ring, unsigned to_submit, unsigned wait_nr);
+
+/* Claim the requests queued so far, for a later uring_enter() */
+static inline unsigned uring_take_pending(struct uring* ring) {
+  unsigned n = ring->to_submit;
+  ring->to_submit = 0;
+  return n;
+}
+
+/* Submit everything queued, without waiting */
+static inline int uring_submit(struct uring* ring) {
+  unsigned n = uring_take_pending(ring);
+  return n ? uring_enter(ring, n, 0) : 0;
+}
+
+/* Next completion, or NULL. Call uring_cqe_seen() when done with it. */
+struct io_uring_cqe* uring_peek_cqe(struct uring* ring);
+void uring_cqe_seen(struct uring* ring);
+
+#endif /* _XPUSHARE_URING_H_ */
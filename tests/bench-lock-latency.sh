@@ -0,0 +1,22 @@
+#!/bin/bash
+#
+# Sweep the number of GPUs and report REQ_LOCK -> LOCK_OK latency.
+# Expects xpushare-scheduler to be running locally. To compare I/O engines,
+# run it once per scheduler started with XPUSHARE_IO_ENGINE=epoll and
+# XPUSHARE_IO_ENGINE=io_uring.
+#
+# Usage: ./bench-lock-latency.sh [iterations] [storm_clients]
+
+set -e
+
+DIR="$(cd "$(dirname "$0")" && pwd)"
+ITERATIONS="${1:-2000}"
+STORM="${2:-4}"
+
+gcc -O2 -pthread -o "$DIR/bench_lock_latency" "$DIR/bench_lock_latency.c" \
+    "$DIR/../src/comm.o" "$DIR/../src/common.o"
+
+for gpus in 1 2 4 8; do
+    "$DIR/bench_lock_latency" -g "$gpus" -c 1 -n "$ITERATIONS" -s 0
+    "$DIR/bench_lock_latency" -g "$gpus" -c 1 -n "$ITERATIONS" -s "$STORM"
+done
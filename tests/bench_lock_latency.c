@@ -0,0 +1,234 @@
+/*
+ * Lock dispatch latency benchmark for xpushare-scheduler.
+ *
+ * Spawns fake clients against a running scheduler and measures the time from
+ * sending REQ_LOCK to receiving LOCK_OK. Measured clients are spread over
+ * -g fake GPUs ("bench-gpu-<n>"). Optionally, -s "storm" clients hammer an
+ * extra GPU with lock churn and MEM_UPDATE bursts, so that the latency seen
+ * on the other GPUs shows how much one busy GPU slows down the rest.
+ *
+ * With -r, every iteration registers a fresh client instead, and the time
+ * from sending REGISTER to the first LOCK_OK is measured. Run it against a
+ * scheduler pointed at a slow API server (see fake-k8s-api.py) to check that
+ * Pod annotation lookups stay off the registration path.
+ *
+ * Build (from the repository root, after `make -C src`):
+ *   gcc -O2 -pthread -o tests/bench_lock_latency tests/bench_lock_latency.c \
+ *       src/comm.o src/common.o
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/comm.h"
+#include "../src/common.h"
+
+#define STORM_MEM_UPDATES 64
+
+static int nr_gpus = 1;
+static int clients_per_gpu = 1;
+static int iterations = 1000;
+static int storm_clients = 0;
+static int measure_register = 0;
+
+static volatile int storm_stop = 0;
+static char sock_path[XPUSHARE_SOCK_PATH_MAX];
+
+struct bench_client {
+  pthread_t tid;
+  int fd;
+  int gpu;
+  int index;
+  uint64_t* samples; /* nanoseconds */
+  int nr_samples;
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void send_msg(int fd, enum message_type type, size_t memory_usage) {
+  struct message msg = {0};
+
+  msg.type = type;
+  msg.protocol_version = XPUSHARE_PROTOCOL_VERSION;
+  msg.memory_usage = memory_usage;
+  true_or_exit(write_whole(fd, &msg, sizeof(msg)) == sizeof(msg));
+}
+
+/* Read messages until one of the given type arrives, answering DROP_LOCK. */
+static void wait_for(int fd, enum message_type type) {
+  struct message msg;
+
+  for (;;) {
+    true_or_exit(read_whole(fd, &msg, sizeof(msg)) == sizeof(msg));
+    if (msg.type == type) return;
+    if (msg.type == DROP_LOCK) send_msg(fd, LOCK_RELEASED, 0);
+  }
+}
+
+static void client_register(struct bench_client* bc) {
+  struct message msg = {0};
+
+  if (xpushare_connect(&bc->fd, sock_path) < 0)
+    log_fatal("Cannot connect to %s, is xpushare-scheduler running?",
+              sock_path);
+
+  msg.type = REGISTER;
+  msg.protocol_version = XPUSHARE_PROTOCOL_VERSION;
+  snprintf(msg.pod_name, sizeof(msg.pod_name), "bench-%d-%d", bc->gpu,
+           bc->index);
+  snprintf(msg.pod_namespace, sizeof(msg.pod_namespace), "bench");
+  snprintf(msg.gpu_uuid, sizeof(msg.gpu_uuid), "bench-gpu-%d", bc->gpu);
+  msg.host_pid = getpid();
+  true_or_exit(write_whole(bc->fd, &msg, sizeof(msg)) == sizeof(msg));
+
+  for (;;) {
+    true_or_exit(read_whole(bc->fd, &msg, sizeof(msg)) == sizeof(msg));
+    if (msg.type == SCHED_ON) return;
+    if (msg.type == SCHED_OFF)
+      log_fatal("Scheduler is off, enable it with `xpusharectl -S on'");
+  }
+}
+
+static void* measured_fn(void* arg) {
+  struct bench_client* bc = arg;
+  uint64_t t0;
+
+  if (measure_register) {
+    for (int i = 0; i < iterations; i++) {
+      t0 = now_ns();
+      client_register(bc);
+      send_msg(bc->fd, REQ_LOCK, 0);
+      wait_for(bc->fd, LOCK_OK);
+      bc->samples[bc->nr_samples++] = now_ns() - t0;
+      send_msg(bc->fd, LOCK_RELEASED, 0);
+      close(bc->fd);
+    }
+    return NULL;
+  }
+
+  client_register(bc);
+  for (int i = 0; i < iterations; i++) {
+    t0 = now_ns();
+    send_msg(bc->fd, REQ_LOCK, 0);
+    wait_for(bc->fd, LOCK_OK);
+    bc->samples[bc->nr_samples++] = now_ns() - t0;
+    send_msg(bc->fd, LOCK_RELEASED, 0);
+  }
+  close(bc->fd);
+  return NULL;
+}
+
+static void* storm_fn(void* arg) {
+  struct bench_client* bc = arg;
+
+  client_register(bc);
+  while (!storm_stop) {
+    send_msg(bc->fd, REQ_LOCK, 0);
+    wait_for(bc->fd, LOCK_OK);
+    for (int i = 0; i < STORM_MEM_UPDATES; i++)
+      send_msg(bc->fd, MEM_UPDATE, (size_t)(i + 1) << 20);
+    send_msg(bc->fd, LOCK_RELEASED, 0);
+  }
+  close(bc->fd);
+  return NULL;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+          "Usage: %s [-g gpus] [-c clients_per_gpu] [-n iterations] "
+          "[-s storm_clients] [-r]\n",
+          prog);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+  struct bench_client *measured, *storm;
+  int opt, nr_measured;
+  uint64_t *all, total = 0;
+  size_t nr_all = 0;
+
+  while ((opt = getopt(argc, argv, "g:c:n:s:r")) != -1) {
+    switch (opt) {
+      case 'g':
+        nr_gpus = atoi(optarg);
+        break;
+      case 'c':
+        clients_per_gpu = atoi(optarg);
+        break;
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      case 's':
+        storm_clients = atoi(optarg);
+        break;
+      case 'r':
+        measure_register = 1;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (nr_gpus < 1 || clients_per_gpu < 1 || iterations < 1 ||
+      storm_clients < 0)
+    usage(argv[0]);
+
+  true_or_exit(xpushare_get_scheduler_path(sock_path) == 0);
+
+  /* Storm clients live on GPU 0, measured clients on GPUs 1..nr_gpus. */
+  storm = calloc(storm_clients ? storm_clients : 1, sizeof(*storm));
+  true_or_exit(storm != NULL);
+  for (int i = 0; i < storm_clients; i++) {
+    storm[i].gpu = 0;
+    storm[i].index = i;
+    true_or_exit(pthread_create(&storm[i].tid, NULL, storm_fn, &storm[i]) ==
+                 0);
+  }
+
+  nr_measured = nr_gpus * clients_per_gpu;
+  measured = calloc(nr_measured, sizeof(*measured));
+  true_or_exit(measured != NULL);
+  for (int i = 0; i < nr_measured; i++) {
+    measured[i].gpu = 1 + i / clients_per_gpu;
+    measured[i].index = i % clients_per_gpu;
+    measured[i].samples = calloc(iterations, sizeof(uint64_t));
+    true_or_exit(measured[i].samples != NULL);
+    true_or_exit(pthread_create(&measured[i].tid, NULL, measured_fn,
+                                &measured[i]) == 0);
+  }
+
+  for (int i = 0; i < nr_measured; i++) pthread_join(measured[i].tid, NULL);
+  storm_stop = 1;
+  for (int i = 0; i < storm_clients; i++) pthread_join(storm[i].tid, NULL);
+
+  all = calloc((size_t)nr_measured * iterations, sizeof(uint64_t));
+  true_or_exit(all != NULL);
+  for (int i = 0; i < nr_measured; i++) {
+    memcpy(all + nr_all, measured[i].samples,
+           measured[i].nr_samples * sizeof(uint64_t));
+    nr_all += measured[i].nr_samples;
+  }
+  qsort(all, nr_all, sizeof(uint64_t), cmp_u64);
+  for (size_t i = 0; i < nr_all; i++) total += all[i];
+
+  printf("%sgpus=%d clients_per_gpu=%d storm=%d samples=%zu "
+         "mean_us=%.1f p50_us=%.1f p99_us=%.1f max_us=%.1f\n",
+         measure_register ? "register " : "", nr_gpus, clients_per_gpu,
+         storm_clients, nr_all,
+         total / 1000.0 / nr_all, all[nr_all / 2] / 1000.0,
+         all[(nr_all * 99) / 100] / 1000.0, all[nr_all - 1] / 1000.0);
+  return 0;
+}
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+#
+# Stand-in Kubernetes API server for scheduler benchmarks.
+#
+# Answers every GET /api/v1/namespaces/<ns>/pods/<pod> with a Pod carrying
+# xpushare.com annotations, after an artificial delay. Point the scheduler at
+# it with XPUSHARE_K8S_API_URL=http://127.0.0.1:<port>.
+#
+# Usage: ./fake-k8s-api.py [--port 8080] [--delay-ms 500] [--core-limit 50]
+#                          [--memory-limit 4Gi] [--priority POD=CLASS ...]
+#                          [--max-wait POD=MS ...]
+
+import argparse
+import json
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+def make_handler(args):
+    class Handler(BaseHTTPRequestHandler):
+        def do_GET(self):
+            parts = self.path.strip('/').split('/')
+            # api/v1/namespaces/<ns>/pods/<pod>
+            if len(parts) != 6 or parts[:3] != ['api', 'v1', 'namespaces'] \
+                    or parts[4] != 'pods':
+                self.send_error(404)
+                return
+
+            time.sleep(args.delay_ms / 1000.0)
+
+            annotations = {}
+            if args.core_limit:
+                annotations['xpushare.com/gpu-core-limit'] = str(args.core_limit)
+            if args.memory_limit:
+                annotations['xpushare.com/gpu-memory-limit'] = args.memory_limit
+            if parts[5] in args.priorities:
+                annotations['xpushare.com/gpu-priority'] = \
+                    args.priorities[parts[5]]
+            if parts[5] in args.max_waits:
+                annotations['xpushare.com/gpu-max-wait-ms'] = \
+                    args.max_waits[parts[5]]
+            body = json.dumps({
+                'kind': 'Pod',
+                'metadata': {
+                    'namespace': parts[3],
+                    'name': parts[5],
+                    'annotations': annotations,
+                },
+            }).encode()
+
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def log_message(self, fmt, *a):
+            pass
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--port', type=int, default=8080)
+    parser.add_argument('--delay-ms', type=int, default=500)
+    parser.add_argument('--core-limit', type=int, default=50)
+    parser.add_argument('--memory-limit', default='4Gi')
+    parser.add_argument('--priority', action='append', default=[],
+                        metavar='POD=CLASS',
+                        help='xpushare.com/gpu-priority of a pod')
+    parser.add_argument('--max-wait', action='append', default=[],
+                        metavar='POD=MS',
+                        help='xpushare.com/gpu-max-wait-ms of a pod')
+    args = parser.parse_args()
+    args.priorities = dict(p.split('=', 1) for p in args.priority)
+    args.max_waits = dict(p.split('=', 1) for p in args.max_wait)
+
+    server = ThreadingHTTPServer(('127.0.0.1', args.port), make_handler(args))
+    server.daemon_threads = True
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
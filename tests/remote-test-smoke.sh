@@ -1080,8 +1080,6 @@ ${extra_mounts_block}
           value: "4000"
         - name: XPUSHARE_QUOTA_CARRYOVER_PERCENT
           value: "0"
-        - name: XPUSHARE_QUOTA_SAMPLE_INTERVAL_MS
-          value: "20"
         - name: XPUSHARE_DROP_TAIL_BILLING_PERCENT
           value: "70"
         - name: XPUSHARE_MEM_WM_HIGH_PERCENT
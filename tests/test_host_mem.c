@@ -0,0 +1,80 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/host_mem.h"
+
+/*
+ * Build: gcc -o test_host_mem test_host_mem.c ../src/host_mem.c
+ */
+
+#define GiB (1024UL * 1024 * 1024)
+
+static char dir[] = "/tmp/test_host_mem.XXXXXX";
+
+static const char* fixture(const char* name, const char* content) {
+  static char path[256];
+  FILE* f;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  assert((f = fopen(path, "w")) != NULL);
+  fputs(content, f);
+  fclose(f);
+  return path;
+}
+
+int main() {
+  struct host_mem hm;
+  char meminfo[256];
+
+  printf("Running host memory tests...\n");
+  assert(mkdtemp(dir) != NULL);
+
+  strcpy(meminfo, fixture("meminfo",
+                          "MemTotal:       16777216 kB\n"
+                          "MemFree:         1048576 kB\n"
+                          "MemAvailable:    4194304 kB\n"
+                          "Buffers:          123456 kB\n"));
+  assert(host_mem_read(meminfo, NULL, &hm) == 0);
+  assert(hm.total == 16 * GiB);
+  assert(hm.available == 4 * GiB);
+  printf("PASS: meminfo\n");
+
+  /* No limit on the cgroup: the node bounds it */
+  fixture("memory.max", "max\n");
+  fixture("memory.current", "1073741824\n");
+  assert(host_mem_read(meminfo, dir, &hm) == 0);
+  assert(hm.total == 16 * GiB && hm.available == 4 * GiB);
+
+  /* A tighter cgroup limit wins */
+  fixture("memory.max", "8589934592\n");
+  fixture("memory.current", "6442450944\n");
+  assert(host_mem_read(meminfo, dir, &hm) == 0);
+  assert(hm.total == 8 * GiB && hm.available == 2 * GiB);
+
+  /* Over the limit already */
+  fixture("memory.current", "9663676416\n");
+  assert(host_mem_read(meminfo, dir, &hm) == 0);
+  assert(hm.available == 0);
+  printf("PASS: cgroup v2\n");
+
+  /* Kernels before 3.14 have no MemAvailable */
+  assert(host_mem_read(fixture("old", "MemTotal: 1024 kB\nMemFree: 512 kB\n"),
+                       NULL, &hm) < 0);
+  assert(host_mem_read("/nonexistent/meminfo", NULL, &hm) < 0);
+  printf("PASS: unreadable\n");
+
+  /* Clean up the fixtures */
+  const char* names[] = {"meminfo", "memory.max", "memory.current", "old"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+    unlink(path);
+  }
+  rmdir(dir);
+
+  printf("All host memory tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/peak_store.h"
+
+/*
+ * Build: gcc -o test_peak_store test_peak_store.c ../src/peak_store.c \
+ *            ../src/common.c -lpthread
+ */
+
+static void check_key(const char* pod, const char* expected) {
+  char key[PEAK_STORE_KEY_LEN];
+
+  peak_store_workload_key("ns", pod, key, sizeof(key));
+  if (strcmp(key, expected) != 0) {
+    printf("FAIL: %s -> %s, expected %s\n", pod, key, expected);
+    exit(1);
+  }
+}
+
+int main() {
+  char path[] = "/tmp/test_peak_store.XXXXXX";
+  int fd;
+
+  printf("Running peak store tests...\n");
+
+  /* Deployment, Job, StatefulSet, indexed Job, bare pod */
+  check_key("trainer-7d4b9c6f8d-x2k9p", "ns/trainer");
+  check_key("resnet-train-q7wzl", "ns/resnet-train");
+  check_key("inference-2", "ns/inference");
+  check_key("sweep-3-h8gfz", "ns/sweep");
+  check_key("notebook", "ns/notebook");
+  /* Words with vowels are never taken for generated suffixes */
+  check_key("bert-large", "ns/bert-large");
+  check_key("my-model-serve", "ns/my-model-serve");
+  printf("PASS: Workload keys\n");
+
+  assert((fd = mkstemp(path)) >= 0);
+  close(fd);
+  unlink(path);
+
+  /* Missing file: empty store */
+  assert(peak_store_open(path) == 0);
+  assert(peak_store_get("ns/trainer") == 0);
+
+  peak_store_raise("ns/trainer", 4000);
+  peak_store_raise("ns/trainer", 1000);
+  assert(peak_store_get("ns/trainer") == 4000);
+
+  /* A smaller run pulls it down by a quarter of the difference */
+  peak_store_record("ns/trainer", 2000);
+  assert(peak_store_get("ns/trainer") == 3500);
+  /* An empty run teaches nothing */
+  peak_store_record("ns/trainer", 0);
+  assert(peak_store_get("ns/trainer") == 3500);
+  peak_store_raise("ns/inference", 123);
+  printf("PASS: Raise and record\n");
+
+  assert(peak_store_sync() == 0);
+  peak_store_raise("ns/trainer", 9999); /* Not synced, must not survive */
+  assert(peak_store_open(path) == 0);
+  /* Reloading overwrites what is in memory with the file */
+  assert(peak_store_get("ns/trainer") == 3500);
+  assert(peak_store_get("ns/inference") == 123);
+  printf("PASS: Sync and reload\n");
+
+  unlink(path);
+  printf("All peak store tests passed.\n");
+  return 0;
+}
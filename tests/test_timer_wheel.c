@@ -0,0 +1,88 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/timer_wheel.h"
+
+/*
+ * Build: gcc -o test_timer_wheel test_timer_wheel.c ../src/timer_wheel.c
+ */
+
+#define NR_TIMERS 2000
+
+static uint64_t clock_ms;
+static uint64_t fired_at[NR_TIMERS];
+static struct timer_wheel_timer timers[NR_TIMERS];
+static struct timer_wheel wheel;
+
+static void record_fn(struct timer_wheel_timer* t) {
+  fired_at[t - timers] = clock_ms;
+}
+
+/* Re-arms itself three times, 100 ms apart */
+static int rearm_left = 3;
+static void rearm_fn(struct timer_wheel_timer* t) {
+  if (rearm_left-- > 0) timer_wheel_add(&wheel, t, clock_ms + 100);
+}
+
+/* Advance one millisecond at a time, like a timerfd firing on every tick */
+static void run_until(uint64_t end) {
+  while (clock_ms < end) {
+    clock_ms++;
+    timer_wheel_advance(&wheel, clock_ms);
+  }
+}
+
+int main() {
+  printf("Running timer wheel tests...\n");
+
+  clock_ms = 1000;
+  timer_wheel_init(&wheel, clock_ms);
+  assert(timer_wheel_next_expiry(&wheel) == TIMER_WHEEL_NEVER);
+
+  /* Random deadlines across every level, some beyond the wheel span */
+  srand(42);
+  for (int i = 0; i < NR_TIMERS; i++) {
+    uint64_t delta = (uint64_t)rand() % (1 << (6 * (1 + i % 4)));
+    if (i % 97 == 0) delta = (1ULL << 24) + (uint64_t)rand() % 5000;
+    timer_wheel_timer_init(&timers[i], record_fn, NULL);
+    timer_wheel_add(&wheel, &timers[i], clock_ms + delta + 1);
+  }
+
+  /* Delete every tenth timer; they must never fire */
+  for (int i = 0; i < NR_TIMERS; i += 10) timer_wheel_del(&wheel, &timers[i]);
+
+  uint64_t next = timer_wheel_next_expiry(&wheel);
+  for (int i = 0; i < NR_TIMERS; i++)
+    if (i % 10) assert(next <= timers[i].expires);
+
+  run_until(1000 + (1ULL << 24) + 6000);
+
+  for (int i = 0; i < NR_TIMERS; i++) {
+    if (i % 10 == 0)
+      assert(fired_at[i] == 0);
+    else
+      assert(fired_at[i] == timers[i].expires);
+    assert(!timer_wheel_pending(&timers[i]));
+  }
+  assert(timer_wheel_next_expiry(&wheel) == TIMER_WHEEL_NEVER);
+  printf("PASS: Timers fire exactly on their deadline\n");
+
+  /* Large jumps run everything that is due, past deadlines included */
+  struct timer_wheel_timer t;
+  timer_wheel_timer_init(&t, rearm_fn, NULL);
+  timer_wheel_add(&wheel, &t, clock_ms - 5);
+  assert(timer_wheel_next_expiry(&wheel) == clock_ms + 1);
+  clock_ms += 1;
+  timer_wheel_advance(&wheel, clock_ms);
+  assert(rearm_left == 2 && t.expires == clock_ms + 100);
+  clock_ms += 1000;
+  timer_wheel_advance(&wheel, clock_ms);
+  assert(rearm_left == 1);
+  run_until(clock_ms + 250);
+  assert(rearm_left == -1 && !timer_wheel_pending(&t));
+  printf("PASS: Callbacks can re-arm their own timer\n");
+
+  printf("All tests passed!\n");
+  return 0;
+}